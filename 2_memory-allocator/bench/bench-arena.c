@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Bulk-free workload: every round builds a batch of short-lived objects
+ * (think of the nodes of one parsed command line) and drops all of them.
+ * The batch is first served by os_malloc/os_free, one block per object,
+ * then by an arena that is reset after each round.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "osmem.h"
+#include "block_meta.h"
+
+#define ROUNDS			2000
+#define MAX_OBJECTS		4096
+#define MIN_SIZE		16
+#define MAX_SIZE		128
+
+static void *objects[MAX_OBJECTS];
+
+static size_t next_size(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return MIN_SIZE + (*seed >> 8) % (MAX_SIZE - MIN_SIZE);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double run_malloc(size_t batch)
+{
+	unsigned int seed = 42;
+	double start = now_ns();
+
+	for (size_t round = 0; round < ROUNDS; ++round) {
+		for (size_t i = 0; i < batch; ++i)
+			objects[i] = os_malloc(next_size(&seed));
+		for (size_t i = 0; i < batch; ++i)
+			os_free(objects[i]);
+	}
+	return (now_ns() - start) / (ROUNDS * batch);
+}
+
+static double run_arena(size_t batch)
+{
+	struct os_arena *arena = os_arena_create(0);
+	unsigned int seed = 42;
+
+	DIE(arena == NULL, "os_arena_create");
+
+	double start = now_ns();
+
+	for (size_t round = 0; round < ROUNDS; ++round) {
+		for (size_t i = 0; i < batch; ++i)
+			objects[i] = os_arena_alloc(arena, next_size(&seed));
+		os_arena_reset(arena);
+	}
+
+	double elapsed = now_ns() - start;
+
+	os_arena_destroy(arena);
+	return elapsed / (ROUNDS * batch);
+}
+
+int main(void)
+{
+	for (size_t batch = 64; batch <= MAX_OBJECTS; batch *= 4)
+		fprintf(stderr, "%6zu objects/round  malloc+free %7.1f ns/object  arena %7.1f ns/object\n",
+				batch, run_malloc(batch), run_arena(batch));
+	return 0;
+}
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+
+"""
+Compare two result files written by `make suite` (lines of bench-suite
+output) and flag every metric that got worse by more than the threshold.
+Exits with 1 if anything regressed, so it can gate a merge:
+
+    ./bench-compare.py results/1a2b3c4.txt results/5d6e7f8.txt
+"""
+
+import argparse
+import sys
+
+# metric -> True if higher is better
+METRICS = {
+    "ops_per_sec": True,
+    "p50_ns": False,
+    "p99_ns": False,
+    "peak_rss_kib": False,
+    "overhead": False,
+}
+
+
+def load(path):
+    results = {}
+    with open(path) as file:
+        for line in file:
+            fields = line.split()
+            if len(fields) < 3 or "=" not in fields[2]:
+                continue
+            values = dict(field.split("=", 1) for field in fields[2:])
+            results[(fields[0], fields[1])] = {key: float(values[key]) for key in METRICS if key in values}
+    return results
+
+
+def change(old, new):
+    if old == 0:
+        return 0.0 if new == 0 else float("inf")
+    return (new - old) / old * 100
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-t", "--threshold", type=float, default=10, help="percent a metric may get worse")
+    parser.add_argument("old")
+    parser.add_argument("new")
+    args = parser.parse_args()
+
+    old, new = load(args.old), load(args.new)
+    regressions = 0
+
+    print(f"{'workload':<28} {'metric':<14} {'old':>14} {'new':>14} {'change':>9}")
+    for key in sorted(old.keys() & new.keys()):
+        for metric, higher_better in METRICS.items():
+            if metric not in old[key] or metric not in new[key]:
+                continue
+            delta = change(old[key][metric], new[key][metric])
+            worse = -delta if higher_better else delta
+            flag = ""
+            if worse > args.threshold:
+                flag = "  REGRESSION"
+                regressions += 1
+            print(f"{' '.join(key)[:28]:<28} {metric:<14} {old[key][metric]:>14.6g} "
+                  f"{new[key][metric]:>14.6g} {delta:>+8.1f}%{flag}")
+
+    for key in sorted(old.keys() ^ new.keys()):
+        print(f"{' '.join(key)[:28]:<28} only in {args.old if key in old else args.new}")
+
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
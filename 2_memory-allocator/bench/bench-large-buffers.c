@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Large buffer churn: every round takes a buffer of 1 to 8 MiB, writes
+ * all of it and frees it again, the way a request handler treats its
+ * scratch buffers. Built against libosmem.so, where every buffer is a
+ * fresh mmap, and as bench-large-buffers-mt against libosmem_mt.so,
+ * whose large mappings are huge page aligned and cached between rounds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "osmem.h"
+#include "block_meta.h"
+
+#define ROUNDS			2000
+#define MIN_SIZE		(1024 * 1024)
+#define MAX_SIZE		(8 * 1024 * 1024)
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void)
+{
+	unsigned int seed = 42;
+	double alloc_ns = 0, touch_ns = 0, free_ns = 0;
+
+	for (int round = 0; round < ROUNDS; ++round) {
+		seed = seed * 1103515245 + 12345;
+
+		/* sizes cluster around a few buffer sizes, as real ones do */
+		size_t size = MIN_SIZE * (1 + (seed >> 8) % 8) - (seed >> 16) % 4096;
+		double start = now_ns();
+		char *buffer = os_malloc(size);
+		double allocated = now_ns();
+
+		DIE(buffer == NULL, "os_malloc");
+		memset(buffer, round, size);
+
+		double touched = now_ns();
+
+		os_free(buffer);
+		free_ns += now_ns() - touched;
+		touch_ns += touched - allocated;
+		alloc_ns += allocated - start;
+	}
+
+	fprintf(stderr, "malloc %8.1f us/op\n", alloc_ns / ROUNDS / 1000);
+	fprintf(stderr, "touch  %8.1f us/op\n", touch_ns / ROUNDS / 1000);
+	fprintf(stderr, "free   %8.1f us/op\n", free_ns / ROUNDS / 1000);
+	return 0;
+}
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Allocation latency against the number of live blocks.
+ *
+ * For every heap population the child process allocates that many small
+ * blocks, frees every other one (so half of them sit in the free lists,
+ * none of them adjacent) and then times a malloc/free churn on top of it.
+ * With a segregated-fit engine the time per operation should stay flat as
+ * the population grows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "osmem.h"
+#include "block_meta.h"
+
+#define CHURN_OPS		200000
+#define MIN_SIZE		8
+#define MAX_SIZE		256
+
+static size_t populations[] = {1000, 10000, 100000, 1000000};
+
+static unsigned int seed = 42;
+
+static size_t next_size(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return MIN_SIZE + (seed >> 8) % (MAX_SIZE - MIN_SIZE);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(size_t live)
+{
+	void **blocks = os_malloc(live * sizeof(*blocks));
+	void *churn[64];
+
+	for (size_t i = 0; i < live; ++i)
+		blocks[i] = os_malloc(next_size());
+	for (size_t i = 0; i < live; i += 2)
+		os_free(blocks[i]);
+
+	double start = now_ns();
+
+	for (size_t i = 0; i < CHURN_OPS; ++i) {
+		size_t slot = i % 64;
+
+		if (i >= 64)
+			os_free(churn[slot]);
+		churn[slot] = os_malloc(next_size());
+	}
+
+	double elapsed = now_ns() - start;
+
+	fprintf(stderr, "%10zu live blocks %10.1f ns/op\n", live, elapsed / (2 * CHURN_OPS));
+}
+
+int main(int argc, char *argv[])
+{
+	size_t count = sizeof(populations) / sizeof(populations[0]);
+
+	if (argc > 1) {
+		run(strtoul(argv[1], NULL, 10));
+		return 0;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		pid_t pid = fork();
+
+		DIE(pid < 0, "fork");
+		if (pid == 0) {
+			run(populations[i]);
+			exit(0);
+		}
+		waitpid(pid, NULL, 0);
+	}
+	return 0;
+}
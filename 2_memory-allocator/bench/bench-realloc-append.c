@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Append loops in the style of the shell's read_line/get_word: a line
+ * buffer grows by realloc one character at a time, and every few
+ * characters a small word is allocated, so the buffer is rarely the last
+ * block of the heap. Linked against libosmem.so (bench-realloc-append)
+ * the buffer grows by exactly what is asked for; libosmem_seg.so
+ * (bench-realloc-append-seg) is built with geometric realloc growth.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "osmem.h"
+#include "block_meta.h"
+
+#define LINES			200
+#define WORD_EVERY		8
+#define MAX_WORDS		(16384 / WORD_EVERY)
+
+static void *words[MAX_WORDS];
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(size_t line_length)
+{
+	size_t appends = 0;
+	double start = now_ns();
+
+	for (size_t line = 0; line < LINES; ++line) {
+		char *buffer = NULL;
+		size_t count = 0;
+
+		for (size_t i = 0; i < line_length; ++i) {
+			buffer = os_realloc(buffer, i + 2);
+			DIE(buffer == NULL, "os_realloc");
+			buffer[i] = 'a' + i % 26;
+			buffer[i + 1] = '\0';
+			if (i % WORD_EVERY == WORD_EVERY - 1)
+				words[count++] = os_malloc(WORD_EVERY + 1);
+		}
+		appends += line_length;
+		for (size_t i = 0; i < count; ++i)
+			os_free(words[i]);
+		os_free(buffer);
+	}
+
+	fprintf(stderr, "%6zu chars/line %10.1f ns/append\n", line_length, (now_ns() - start) / appends);
+}
+
+int main(void)
+{
+	for (size_t line_length = 64; line_length <= 16384; line_length *= 4)
+		run(line_length);
+	return 0;
+}
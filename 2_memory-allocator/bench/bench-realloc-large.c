@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Large realloc and calloc.
+ *
+ * A buffer grows from 64 KiB to 16 MiB one realloc at a time, 64 KiB per
+ * step, which is dominated by moving the contents when the block cannot
+ * grow in place. Then big calloc'd buffers are requested, which come
+ * straight from mmap and need no zeroing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "osmem.h"
+#include "block_meta.h"
+
+#define STEP			(64 * 1024)
+#define MAX_BUFFER		(16 * 1024 * 1024)
+#define CALLOC_SIZE		(8 * 1024 * 1024)
+#define CALLOC_ROUNDS		256
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void run_realloc(void)
+{
+	char *buffer = NULL;
+	double start = now_ms();
+
+	for (size_t size = STEP; size <= MAX_BUFFER; size += STEP) {
+		buffer = os_realloc(buffer, size);
+		DIE(buffer == NULL, "os_realloc");
+		buffer[size - 1] = 1;
+	}
+
+	fprintf(stderr, "realloc 64 KiB -> 16 MiB  %10.1f ms\n", now_ms() - start);
+	os_free(buffer);
+}
+
+static void run_calloc(void)
+{
+	double start = now_ms();
+
+	for (size_t i = 0; i < CALLOC_ROUNDS; ++i) {
+		char *buffer = os_calloc(1, CALLOC_SIZE);
+
+		DIE(buffer == NULL, "os_calloc");
+		buffer[i] = 1;
+		os_free(buffer);
+	}
+
+	fprintf(stderr, "calloc 8 MiB x %d      %10.1f ms\n", CALLOC_ROUNDS, now_ms() - start);
+}
+
+int main(void)
+{
+	run_realloc();
+	run_calloc();
+	return 0;
+}
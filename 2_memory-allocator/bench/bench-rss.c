@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Resident memory over the life of a bursty workload.
+ *
+ * The heap is filled up to a peak with small and medium blocks, then the
+ * blocks are freed in random order, a tenth at a time, and the resident
+ * set size is printed after every step. The same source is linked against
+ * libosmem.so (bench-rss) and libosmem_seg.so (bench-rss-seg): an sbrk
+ * heap stays at its peak, a segmented one should shrink with the live set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "osmem.h"
+#include "block_meta.h"
+
+#define PEAK_BYTES		(256UL * 1024 * 1024)
+#define MIN_SIZE		64
+#define MAX_SIZE		(64 * 1024)
+#define STEPS			10
+
+static unsigned int seed = 42;
+
+static unsigned int next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static size_t rss_kb(void)
+{
+	unsigned long size, resident;
+	FILE *statm = fopen("/proc/self/statm", "r");
+
+	DIE(statm == NULL, "fopen");
+	DIE(fscanf(statm, "%lu %lu", &size, &resident) != 2, "fscanf");
+	fclose(statm);
+	return resident * (getpagesize() / 1024);
+}
+
+static void report(const char *phase, size_t live)
+{
+	fprintf(stderr, "%-12s live %8zu KiB   rss %8zu KiB\n", phase, live / 1024, rss_kb());
+}
+
+int main(void)
+{
+	size_t capacity = PEAK_BYTES / MIN_SIZE, count = 0, live = 0;
+	void **blocks = os_malloc(capacity * sizeof(*blocks));
+	size_t *sizes = os_malloc(capacity * sizeof(*sizes));
+
+	report("start", live);
+	while (live < PEAK_BYTES) {
+		size_t size = MIN_SIZE + next_random() % (MAX_SIZE - MIN_SIZE);
+
+		blocks[count] = os_malloc(size);
+		memset(blocks[count], 1, size);
+		sizes[count++] = size;
+		live += size;
+	}
+	report("peak", live);
+
+	/* shuffle so every step frees blocks from all over the heap */
+	for (size_t i = count - 1; i > 0; --i) {
+		size_t j = next_random() % (i + 1);
+		void *block = blocks[i];
+		size_t size = sizes[i];
+
+		blocks[i] = blocks[j];
+		sizes[i] = sizes[j];
+		blocks[j] = block;
+		sizes[j] = size;
+	}
+
+	for (size_t step = 1; step <= STEPS; ++step) {
+		char phase[32];
+
+		for (size_t i = (step - 1) * count / STEPS; i < step * count / STEPS; ++i) {
+			os_free(blocks[i]);
+			live -= sizes[i];
+		}
+		snprintf(phase, sizeof(phase), "freed %zu%%", step * 100 / STEPS);
+		report(phase, live);
+	}
+
+	os_free(blocks);
+	os_free(sizes);
+	return 0;
+}
@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Small-object workload: a million live objects of 8 to 64 bytes, then a
+ * churn that frees and reallocates random ones. Reports the time per
+ * operation and the memory the allocator holds per live object. Built
+ * against libosmem.so, where every object carries a block header, and as
+ * bench-small-objects-seg against a variant library with the slab tier.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "osmem.h"
+#include "block_meta.h"
+
+#define OBJECTS			1000000
+#define CHURN_OPS		2000000
+#define MIN_SIZE		8
+#define MAX_SIZE		64
+
+static void *objects[OBJECTS];
+static unsigned int seed = 42;
+
+static unsigned int next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static size_t next_size(void)
+{
+	return MIN_SIZE + next_random() % (MAX_SIZE - MIN_SIZE + 1);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void)
+{
+	struct os_stats stats;
+	size_t requested = 0;
+
+	double start = now_ns();
+
+	for (size_t i = 0; i < OBJECTS; ++i) {
+		size_t size = next_size();
+
+		objects[i] = os_malloc(size);
+		DIE(objects[i] == NULL, "os_malloc");
+		requested += size;
+	}
+
+	double filled = now_ns();
+
+	for (size_t i = 0; i < CHURN_OPS; ++i) {
+		size_t slot = next_random() % OBJECTS;
+
+		os_free(objects[slot]);
+		objects[slot] = os_malloc(next_size());
+	}
+
+	double churned = now_ns();
+
+	os_stats_get(&stats);
+
+	size_t held = stats.heap_size + stats.slab_pages * 4096;
+
+	fprintf(stderr, "fill  %8.1f ns/malloc\n", (filled - start) / OBJECTS);
+	fprintf(stderr, "churn %8.1f ns/op\n", (churned - filled) / (2 * CHURN_OPS));
+	fprintf(stderr, "held  %8.1f bytes/object (%.1f requested)\n",
+			(double)held / OBJECTS, (double)requested / OBJECTS);
+
+	for (size_t i = 0; i < OBJECTS; ++i)
+		os_free(objects[i]);
+	return 0;
+}
@@ -0,0 +1,648 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * bench-suite [-l label] [-t threads] [-n ops] [-r runs] [workload...]
+ *
+ * Allocator benchmark suite. Every workload runs in a child process of
+ * its own, runs times, and the run with the best throughput is printed
+ * as one line of key=value pairs:
+ *
+ *   label workload threads=T ops=N ops_per_sec=... p50_ns=... p99_ns=...
+ *   p999_ns=... max_ns=... peak_rss_kib=... frag=... overhead=...
+ *
+ * Every malloc, free and realloc is timed on its own; the percentiles
+ * come from a log-linear histogram with 8 buckets per power of two, so
+ * they are exact to 12.5%. peak_rss_kib is the VmHWM of the child, frag
+ * the fragmentation reported by os_stats_get before the final frees and
+ * overhead the memory the allocator holds then (heap, mappings and slabs)
+ * over the bytes live in the workload.
+ *
+ * Workloads (ops is per thread):
+ *   larson      every thread replaces random blocks of 16-512 bytes in its
+ *               own set; the sets are handed to new threads ROUNDS times,
+ *               so blocks are freed by other threads than allocated them
+ *   threadtest  every thread allocates batches of 64-byte blocks and
+ *               frees them again
+ *   realloc     every thread resizes random chains between 8 bytes and
+ *               64 KiB, dropping one chain in eight
+ *   FILE.trace  replays a trace recorded by libosmem_preload.so with
+ *               OSMEM_TRACE_FILE, single-threaded
+ *
+ * A trace has one line per call: "op size ptr arg", op one of m (malloc),
+ * c (calloc), a (memalign, arg is the alignment), r (realloc, arg is the
+ * old pointer) or f (free), ptr and arg in hex. Blocks the program never
+ * freed are freed after the measurement.
+ *
+ * Only link this against libosmem.so with -t 1, the other workloads
+ * need the thread-safe libosmem_mt.so.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "osmem.h"
+#include "block_meta.h"
+
+#define MAX_THREADS		64
+#define LATENCY_BUCKETS		(64 * 8)
+
+#define LARSON_SLOTS		1000
+#define LARSON_ROUNDS		10
+#define LARSON_MIN_SIZE		16
+#define LARSON_MAX_SIZE		512
+
+#define THREADTEST_BATCH	1000
+#define THREADTEST_SIZE		64
+
+#define REALLOC_CHAINS		256
+#define REALLOC_MIN_SIZE	8
+#define REALLOC_MAX_SIZE	(64 * 1024)
+
+struct latency {
+	uint64_t buckets[LATENCY_BUCKETS];
+	uint64_t count;
+	uint64_t max;
+};
+
+struct block {
+	void *ptr;
+	size_t size;
+};
+
+struct result {
+	double seconds;
+	uint64_t ops;
+	struct latency latency;
+	size_t live;
+	struct os_stats stats;
+};
+
+struct worker {
+	pthread_t thread;
+	unsigned int seed;
+	size_t ops;
+	struct block *blocks;
+	struct latency latency;
+};
+
+struct trace_op {
+	char op;
+	uint32_t slot;
+	uint32_t arg;
+	size_t size;
+};
+
+static const char *label = "osmem";
+static int threads = 1;
+static size_t ops_per_thread = 1000000;
+static int runs = 3;
+
+static struct worker workers[MAX_THREADS];
+static struct trace_op *trace_ops;
+static size_t trace_count;
+static size_t trace_slots;
+
+static unsigned int next_random(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t latency_bucket(uint64_t ns)
+{
+	if (ns < 8)
+		return ns;
+
+	size_t log = 63 - __builtin_clzll(ns);
+
+	return (log - 2) * 8 + ((ns >> (log - 3)) & 7);
+}
+
+static uint64_t bucket_floor(size_t bucket)
+{
+	if (bucket < 8)
+		return bucket;
+
+	size_t log = bucket / 8 + 2;
+
+	return (8 + bucket % 8) << (log - 3);
+}
+
+static void latency_add(struct latency *latency, uint64_t start)
+{
+	uint64_t ns = now_ns() - start;
+
+	latency->buckets[latency_bucket(ns)]++;
+	latency->count++;
+	if (ns > latency->max)
+		latency->max = ns;
+}
+
+static void latency_merge(struct latency *into, struct latency *from)
+{
+	for (size_t i = 0; i < LATENCY_BUCKETS; ++i)
+		into->buckets[i] += from->buckets[i];
+	into->count += from->count;
+	if (from->max > into->max)
+		into->max = from->max;
+}
+
+static uint64_t percentile(struct latency *latency, double fraction)
+{
+	uint64_t rank = latency->count * fraction;
+	uint64_t seen = 0;
+
+	for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+		seen += latency->buckets[i];
+		if (seen > rank)
+			return bucket_floor(i);
+	}
+	return latency->max;
+}
+
+static void *timed_malloc(struct latency *latency, size_t size)
+{
+	uint64_t start = now_ns();
+	void *ptr = os_malloc(size);
+
+	latency_add(latency, start);
+	DIE(ptr == NULL, "os_malloc");
+	return ptr;
+}
+
+static void timed_free(struct latency *latency, void *ptr)
+{
+	uint64_t start = now_ns();
+
+	os_free(ptr);
+	latency_add(latency, start);
+}
+
+static void *timed_realloc(struct latency *latency, void *ptr, size_t size)
+{
+	uint64_t start = now_ns();
+
+	ptr = os_realloc(ptr, size);
+	latency_add(latency, start);
+	DIE(ptr == NULL, "os_realloc");
+	return ptr;
+}
+
+static void run_workers(void *(*loop)(void *))
+{
+	int rc;
+
+	for (int i = 0; i < threads; ++i) {
+		rc = pthread_create(&workers[i].thread, NULL, loop, &workers[i]);
+		DIE(rc != 0, "pthread_create");
+	}
+	for (int i = 0; i < threads; ++i)
+		pthread_join(workers[i].thread, NULL);
+}
+
+/* Snapshot the heap, then free every block the workers still hold. */
+static void finish(struct result *result, size_t slots)
+{
+	for (int i = 0; i < threads; ++i) {
+		latency_merge(&result->latency, &workers[i].latency);
+		for (size_t slot = 0; slot < slots; ++slot)
+			result->live += workers[i].blocks[slot].size;
+	}
+	result->ops = result->latency.count;
+	os_stats_get(&result->stats);
+
+	for (int i = 0; i < threads; ++i) {
+		for (size_t slot = 0; slot < slots; ++slot)
+			os_free(workers[i].blocks[slot].ptr);
+		free(workers[i].blocks);
+	}
+}
+
+static void *larson_loop(void *arg)
+{
+	struct worker *self = arg;
+
+	for (size_t i = 0; i < self->ops / 2; ++i) {
+		struct block *block = &self->blocks[next_random(&self->seed) % LARSON_SLOTS];
+		size_t size = LARSON_MIN_SIZE + next_random(&self->seed) % (LARSON_MAX_SIZE - LARSON_MIN_SIZE);
+
+		timed_free(&self->latency, block->ptr);
+		block->ptr = timed_malloc(&self->latency, size);
+		block->size = size;
+	}
+	return NULL;
+}
+
+static void larson(struct result *result)
+{
+	for (int i = 0; i < threads; ++i) {
+		workers[i].seed = i + 1;
+		workers[i].blocks = calloc(LARSON_SLOTS, sizeof(struct block));
+		workers[i].ops = ops_per_thread / LARSON_ROUNDS;
+		for (size_t slot = 0; slot < LARSON_SLOTS; ++slot) {
+			size_t size = LARSON_MIN_SIZE + next_random(&workers[i].seed) % (LARSON_MAX_SIZE - LARSON_MIN_SIZE);
+
+			workers[i].blocks[slot].ptr = os_malloc(size);
+			workers[i].blocks[slot].size = size;
+		}
+	}
+
+	uint64_t start = now_ns();
+
+	/* every round a new thread inherits each block set */
+	for (int round = 0; round < LARSON_ROUNDS; ++round)
+		run_workers(larson_loop);
+	result->seconds = (now_ns() - start) / 1e9;
+	finish(result, LARSON_SLOTS);
+}
+
+static void *threadtest_loop(void *arg)
+{
+	struct worker *self = arg;
+
+	for (size_t done = 0; done < self->ops; done += 2 * THREADTEST_BATCH) {
+		for (size_t slot = 0; slot < THREADTEST_BATCH; ++slot)
+			self->blocks[slot].ptr = timed_malloc(&self->latency, THREADTEST_SIZE);
+		for (size_t slot = 0; slot < THREADTEST_BATCH; ++slot)
+			timed_free(&self->latency, self->blocks[slot].ptr);
+	}
+	for (size_t slot = 0; slot < THREADTEST_BATCH; ++slot)
+		self->blocks[slot].ptr = NULL;
+	return NULL;
+}
+
+static void threadtest(struct result *result)
+{
+	for (int i = 0; i < threads; ++i) {
+		workers[i].blocks = calloc(THREADTEST_BATCH, sizeof(struct block));
+		workers[i].ops = ops_per_thread;
+	}
+
+	uint64_t start = now_ns();
+
+	run_workers(threadtest_loop);
+	result->seconds = (now_ns() - start) / 1e9;
+	finish(result, THREADTEST_BATCH);
+}
+
+static void *realloc_loop(void *arg)
+{
+	struct worker *self = arg;
+
+	for (size_t i = 0; i < self->ops; ++i) {
+		struct block *block = &self->blocks[next_random(&self->seed) % REALLOC_CHAINS];
+		unsigned int dice = next_random(&self->seed);
+
+		if (block->ptr && dice % 8 == 0) {
+			timed_free(&self->latency, block->ptr);
+			block->ptr = NULL;
+			block->size = 0;
+			continue;
+		}
+
+		/* mostly grow, by up to 2x, sometimes shrink by up to half */
+		size_t size = block->size ? block->size : REALLOC_MIN_SIZE;
+
+		if (dice % 4 == 0)
+			size -= size * (dice >> 8 & 127) / 256;
+		else
+			size += size * (dice >> 8 & 255) / 256 + 1;
+		if (size > REALLOC_MAX_SIZE)
+			size = REALLOC_MIN_SIZE;
+
+		block->ptr = timed_realloc(&self->latency, block->ptr, size);
+		((char *)block->ptr)[size - 1] = 1;
+		block->size = size;
+	}
+	return NULL;
+}
+
+static void realloc_chains(struct result *result)
+{
+	for (int i = 0; i < threads; ++i) {
+		workers[i].seed = i + 1;
+		workers[i].blocks = calloc(REALLOC_CHAINS, sizeof(struct block));
+		workers[i].ops = ops_per_thread;
+	}
+
+	uint64_t start = now_ns();
+
+	run_workers(realloc_loop);
+	result->seconds = (now_ns() - start) / 1e9;
+	finish(result, REALLOC_CHAINS);
+}
+
+/* Recorded addresses to replay slots, open addressing on the address. */
+struct address_map {
+	uintptr_t *keys;
+	uint32_t *slots;
+	size_t mask;
+	uint32_t *free_slots;
+	size_t free_count;
+};
+
+static size_t address_find(struct address_map *map, uintptr_t address)
+{
+	size_t index = (address >> 4) * 0x9E3779B97F4A7C15ULL & map->mask;
+
+	while (map->keys[index] && map->keys[index] != address)
+		index = (index + 1) & map->mask;
+	return index;
+}
+
+static uint32_t address_add(struct address_map *map, uintptr_t address, uint32_t slot)
+{
+	size_t index = address_find(map, address);
+
+	if (slot == UINT32_MAX)
+		slot = map->free_count ? map->free_slots[--map->free_count] : trace_slots++;
+	map->keys[index] = address;
+	map->slots[index] = slot;
+	return slot;
+}
+
+/*
+ * Returns the slot of a live address and forgets the address, UINT32_MAX
+ * if it is unknown. The slot is recycled unless keep is set.
+ */
+static uint32_t address_remove(struct address_map *map, uintptr_t address, int keep)
+{
+	size_t index = address_find(map, address);
+	uint32_t slot = map->slots[index];
+
+	if (map->keys[index] == 0)
+		return UINT32_MAX;
+
+	/* backward-shift deletion keeps the probe chains intact */
+	size_t hole = index;
+
+	for (size_t next = (hole + 1) & map->mask; map->keys[next]; next = (next + 1) & map->mask) {
+		size_t home = (map->keys[next] >> 4) * 0x9E3779B97F4A7C15ULL & map->mask;
+
+		if (((next - home) & map->mask) >= ((next - hole) & map->mask)) {
+			map->keys[hole] = map->keys[next];
+			map->slots[hole] = map->slots[next];
+			hole = next;
+		}
+	}
+	map->keys[hole] = 0;
+	if (!keep)
+		map->free_slots[map->free_count++] = slot;
+	return slot;
+}
+
+/*
+ * Parse a trace into operations on slots before anything is timed. The
+ * slot of a block is reused once it is freed, so replaying needs as many
+ * slots as the trace has live blocks at most.
+ */
+static void trace_load(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	struct address_map map = { 0 };
+	size_t capacity = 1 << 16, lines = 0;
+	uintptr_t ptr, arg;
+	size_t size;
+	char op;
+
+	DIE(file == NULL, path);
+	while (fscanf(file, " %c %zu %lx %lx", &op, &size, &ptr, &arg) == 4)
+		lines++;
+	rewind(file);
+
+	map.mask = 1;
+	while (map.mask < 2 * lines)
+		map.mask <<= 1;
+	map.keys = calloc(map.mask, sizeof(*map.keys));
+	map.slots = calloc(map.mask, sizeof(*map.slots));
+	map.free_slots = calloc(lines + 1, sizeof(*map.free_slots));
+	map.mask--;
+	trace_ops = malloc(capacity * sizeof(*trace_ops));
+
+	while (fscanf(file, " %c %zu %lx %lx", &op, &size, &ptr, &arg) == 4) {
+		struct trace_op entry = { .op = op, .size = size ? size : 1 };
+
+		if (op == 'f') {
+			entry.slot = address_remove(&map, ptr, 0);
+		} else if (op == 'r' && ptr == 0) {
+			/* realloc to size 0 */
+			entry.op = 'f';
+			entry.slot = arg ? address_remove(&map, arg, 0) : UINT32_MAX;
+		} else if (op == 'r') {
+			/* the block keeps its slot, a realloc of an unknown block is a malloc */
+			uint32_t old = arg ? address_remove(&map, arg, 1) : UINT32_MAX;
+
+			if (old == UINT32_MAX)
+				entry.op = 'm';
+			entry.slot = address_add(&map, ptr, old);
+		} else if (ptr) {
+			entry.slot = address_add(&map, ptr, UINT32_MAX);
+			entry.arg = arg;
+		} else {
+			continue;
+		}
+		/* frees of blocks allocated before the trace started */
+		if (entry.op == 'f' && entry.slot == UINT32_MAX)
+			continue;
+
+		if (trace_count == capacity) {
+			capacity *= 2;
+			trace_ops = realloc(trace_ops, capacity * sizeof(*trace_ops));
+		}
+		trace_ops[trace_count++] = entry;
+	}
+	fclose(file);
+	free(map.keys);
+	free(map.slots);
+	free(map.free_slots);
+}
+
+static void trace_replay(struct result *result)
+{
+	struct worker *self = &workers[0];
+	struct block *blocks = calloc(trace_slots, sizeof(struct block));
+
+	uint64_t start = now_ns();
+
+	for (size_t i = 0; i < trace_count; ++i) {
+		struct trace_op *entry = &trace_ops[i];
+		struct block *block = &blocks[entry->slot];
+		uint64_t op_start = now_ns();
+
+		switch (entry->op) {
+		case 'm':
+			block->ptr = os_malloc(entry->size);
+			break;
+		case 'c':
+			block->ptr = os_calloc(1, entry->size);
+			break;
+		case 'a':
+			block->ptr = os_memalign(entry->arg, entry->size);
+			break;
+		case 'r':
+			block->ptr = os_realloc(block->ptr, entry->size);
+			break;
+		case 'f':
+			os_free(block->ptr);
+			block->ptr = NULL;
+			break;
+		}
+		latency_add(&self->latency, op_start);
+		block->size = entry->op == 'f' ? 0 : entry->size;
+	}
+	result->seconds = (now_ns() - start) / 1e9;
+
+	self->blocks = blocks;
+	finish(result, trace_slots);
+}
+
+static size_t peak_rss_kib(void)
+{
+	char line[256];
+	size_t peak = 0;
+	FILE *file = fopen("/proc/self/status", "r");
+
+	if (file == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), file))
+		if (sscanf(line, "VmHWM: %zu", &peak) == 1)
+			break;
+	fclose(file);
+	return peak;
+}
+
+/* Run one workload in a child, which writes its result and peak RSS back. */
+static int run_child(void (*workload)(struct result *), struct result *result, size_t *peak)
+{
+	int fds[2];
+	pid_t pid;
+
+	DIE(pipe(fds) < 0, "pipe");
+	pid = fork();
+	DIE(pid < 0, "fork");
+	if (pid == 0) {
+		close(fds[0]);
+		memset(result, 0, sizeof(*result));
+		workload(result);
+		*peak = peak_rss_kib();
+		DIE(write(fds[1], result, sizeof(*result)) != sizeof(*result), "write");
+		DIE(write(fds[1], peak, sizeof(*peak)) != sizeof(*peak), "write");
+		_exit(0);
+	}
+	close(fds[1]);
+
+	int ok = read(fds[0], result, sizeof(*result)) == sizeof(*result)
+		&& read(fds[0], peak, sizeof(*peak)) == sizeof(*peak);
+
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	return ok;
+}
+
+static void run(const char *name, void (*workload)(struct result *))
+{
+	struct result best, result;
+	size_t best_peak = 0, peak;
+	double best_rate = -1;
+
+	for (int i = 0; i < runs; ++i) {
+		if (!run_child(workload, &result, &peak)) {
+			printf("%s %s failed\n", label, name);
+			return;
+		}
+		double rate = result.ops / result.seconds;
+
+		if (rate > best_rate) {
+			best_rate = rate;
+			best = result;
+			best_peak = peak;
+		}
+	}
+
+	size_t held = best.stats.heap_size + best.stats.mapped_bytes + best.stats.slab_pages * 4096;
+
+	printf("%s %s threads=%d ops=%lu ops_per_sec=%.0f p50_ns=%lu p99_ns=%lu p999_ns=%lu max_ns=%lu"
+		   " peak_rss_kib=%zu frag=%.3f overhead=%.3f\n",
+		   label, name, threads, (unsigned long)best.ops, best_rate,
+		   (unsigned long)percentile(&best.latency, 0.5), (unsigned long)percentile(&best.latency, 0.99),
+		   (unsigned long)percentile(&best.latency, 0.999), (unsigned long)best.latency.max,
+		   best_peak, best.stats.fragmentation, best.live ? (double)held / best.live : 0.0);
+	fflush(stdout);
+}
+
+static void usage(const char *program)
+{
+	fprintf(stderr, "Usage: %s [-l label] [-t threads] [-n ops] [-r runs] "
+			"[larson|threadtest|realloc|FILE.trace]...\n", program);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int option;
+
+	while ((option = getopt(argc, argv, "l:t:n:r:")) != -1) {
+		switch (option) {
+		case 'l':
+			label = optarg;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'n':
+			ops_per_thread = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (threads < 1 || threads > MAX_THREADS || runs < 1)
+		usage(argv[0]);
+
+	if (optind == argc) {
+		run("larson", larson);
+		run("threadtest", threadtest);
+		run("realloc", realloc_chains);
+		return 0;
+	}
+
+	for (int i = optind; i < argc; ++i) {
+		const char *name = argv[i];
+
+		if (strcmp(name, "larson") == 0) {
+			run(name, larson);
+		} else if (strcmp(name, "threadtest") == 0) {
+			run(name, threadtest);
+		} else if (strcmp(name, "realloc") == 0) {
+			run(name, realloc_chains);
+		} else {
+			int saved = threads;
+			const char *base = strrchr(name, '/');
+
+			trace_load(name);
+			threads = 1;
+			run(base ? base + 1 : name, trace_replay);
+			threads = saved;
+			free(trace_ops);
+			trace_ops = NULL;
+			trace_count = trace_slots = 0;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Multi-threaded malloc/free churn against libosmem_mt.so.
+ *
+ * Every worker allocates blocks and hands most of them to the next worker
+ * through a single-producer/single-consumer ring, so half of the frees are
+ * remote frees of blocks another thread allocated. The rest is local churn.
+ * Throughput is reported for 1, 2, 4, ... up to the given number of threads.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "osmem.h"
+#include "block_meta.h"
+
+#define OPS_PER_THREAD		1000000
+#define RING_SIZE		1024
+#define LOCAL_SLOTS		64
+#define MAX_THREADS		64
+#define MIN_SIZE		8
+#define MAX_SIZE		512
+
+struct ring {
+	void *slots[RING_SIZE];
+	unsigned long head;	/* written by the consumer */
+	unsigned long tail;	/* written by the producer */
+} __attribute__((aligned(64)));
+
+struct worker {
+	pthread_t thread;
+	struct ring *in;
+	struct ring *out;
+	unsigned int seed;
+};
+
+static struct ring rings[MAX_THREADS];
+static struct worker workers[MAX_THREADS];
+
+static size_t next_size(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return MIN_SIZE + (*seed >> 8) % (MAX_SIZE - MIN_SIZE);
+}
+
+static int ring_push(struct ring *ring, void *ptr)
+{
+	unsigned long tail = ring->tail;
+
+	if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == RING_SIZE)
+		return 0;
+	ring->slots[tail % RING_SIZE] = ptr;
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static void *ring_pop(struct ring *ring)
+{
+	unsigned long head = ring->head;
+
+	if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	void *ptr = ring->slots[head % RING_SIZE];
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return ptr;
+}
+
+static void *worker_loop(void *arg)
+{
+	struct worker *self = arg;
+	void *local[LOCAL_SLOTS] = {0};
+	void *ptr;
+
+	for (unsigned long i = 0; i < OPS_PER_THREAD; ++i) {
+		size_t slot = i % LOCAL_SLOTS;
+
+		ptr = os_malloc(next_size(&self->seed));
+		if (i % 2 == 0 && ring_push(self->out, ptr))
+			ptr = NULL;
+
+		os_free(local[slot]);
+		local[slot] = ptr;
+
+		ptr = ring_pop(self->in);
+		if (ptr)
+			os_free(ptr);
+	}
+
+	for (size_t slot = 0; slot < LOCAL_SLOTS; ++slot)
+		os_free(local[slot]);
+	return NULL;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int threads)
+{
+	void *ptr;
+	int rc;
+
+	for (int i = 0; i < threads; ++i) {
+		workers[i].in = &rings[i];
+		workers[i].out = &rings[(i + 1) % threads];
+		workers[i].seed = i + 1;
+	}
+
+	double start = now_s();
+
+	for (int i = 0; i < threads; ++i) {
+		rc = pthread_create(&workers[i].thread, NULL, worker_loop, &workers[i]);
+		DIE(rc != 0, "pthread_create");
+	}
+	for (int i = 0; i < threads; ++i)
+		pthread_join(workers[i].thread, NULL);
+
+	double elapsed = now_s() - start;
+
+	for (int i = 0; i < threads; ++i)
+		while ((ptr = ring_pop(&rings[i])) != NULL)
+			os_free(ptr);
+
+	/* one malloc and one free per op */
+	double mops = 2.0 * OPS_PER_THREAD * threads / elapsed / 1e6;
+
+	fprintf(stderr, "%3d threads %8.2f Mops/s %8.2f Mops/s/thread\n", threads, mops, mops / threads);
+}
+
+int main(int argc, char *argv[])
+{
+	int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+
+	if (max_threads > MAX_THREADS)
+		max_threads = MAX_THREADS;
+
+	for (int threads = 1; threads <= max_threads; threads *= 2)
+		run(threads);
+	return 0;
+}
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+
+"""
+Run real workloads on glibc's malloc and on osmem (LD_PRELOAD of
+libosmem_preload.so) and report wall time and peak RSS for each.
+
+By default the workloads are the serial and parallel graph sums of
+3_thread-pool-graph over its tests/in/*.in inputs. Any other command can
+be measured instead:
+
+    ./compare-preload.py -- ../../4_mini-shell/src/mini-shell script.sh
+"""
+
+import argparse
+import glob
+import os
+import signal
+import subprocess
+import sys
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+PRELOAD = os.path.join(BENCH_DIR, "..", "src", "libosmem_preload.so")
+RUNSTAT = os.path.join(BENCH_DIR, "runstat")
+GRAPH_DIR = os.path.join(BENCH_DIR, "..", "..", "3_thread-pool-graph")
+
+
+def run_once(cmd, preload, timeout):
+    """Returns (seconds, max RSS in KiB, failure), failure is None on success"""
+    env = os.environ.copy()
+    if preload:
+        env["LD_PRELOAD"] = os.path.realpath(PRELOAD)
+
+    proc = subprocess.Popen([RUNSTAT] + cmd, env=env, stdout=subprocess.DEVNULL,
+                            stderr=subprocess.PIPE, start_new_session=True)
+    try:
+        _, stderr = proc.communicate(timeout=timeout)
+    except subprocess.TimeoutExpired:
+        os.killpg(proc.pid, signal.SIGKILL)
+        proc.communicate()
+        return None, None, "timeout"
+
+    if proc.returncode > 128:
+        return None, None, f"signal {proc.returncode - 128}"
+    if proc.returncode:
+        return None, None, f"exit {proc.returncode}"
+
+    elapsed, maxrss = stderr.decode().split()[-2:]
+    return float(elapsed), int(maxrss), None
+
+
+def measure(cmd, preload, runs, timeout):
+    """Returns (best time, max RSS) or (failure, None) if any run failed"""
+    times, rss = [], 0
+    for _ in range(runs):
+        elapsed, maxrss, failure = run_once(cmd, preload, timeout)
+        if failure:
+            return failure, None
+        times.append(elapsed)
+        rss = max(rss, maxrss)
+    return min(times), rss
+
+
+def graph_workloads():
+    src = os.path.join(GRAPH_DIR, "src")
+    subprocess.run(["make", "-s", "-C", src], check=True)
+    inputs = sorted(glob.glob(os.path.join(GRAPH_DIR, "tests", "in", "*.in")),
+                    key=lambda path: int("".join(filter(str.isdigit, os.path.basename(path))) or 0))
+    for program in ("serial", "parallel"):
+        for path in inputs:
+            name = f"{program} {os.path.basename(path)}"
+            yield name, [os.path.join(src, program), path]
+
+
+def fmt_time(seconds):
+    return seconds if isinstance(seconds, str) else f"{seconds * 1000:.1f} ms"
+
+
+def fmt_rss(kib):
+    return "-" if kib is None else f"{kib} KiB"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-n", "--runs", type=int, default=3, help="runs per workload, best time is kept")
+    parser.add_argument("-t", "--timeout", type=float, default=10, help="seconds before a run is killed")
+    parser.add_argument("command", nargs="*", help="measure this command instead of the graph workloads")
+    args = parser.parse_args()
+
+    subprocess.run(["make", "-s", "-C", BENCH_DIR, "runstat", "src"], check=True)
+
+    workloads = [(" ".join(args.command), args.command)] if args.command else graph_workloads()
+
+    print(f"{'workload':<24} {'glibc':>12} {'osmem':>12} {'glibc rss':>12} {'osmem rss':>12}")
+    for name, cmd in workloads:
+        glibc_time, glibc_rss = measure(cmd, False, args.runs, args.timeout)
+        osmem_time, osmem_rss = measure(cmd, True, args.runs, args.timeout)
+        print(f"{name[:24]:<24} {fmt_time(glibc_time):>12} {fmt_time(osmem_time):>12} "
+              f"{fmt_rss(glibc_rss):>12} {fmt_rss(osmem_rss):>12}")
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
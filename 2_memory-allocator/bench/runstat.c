@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * runstat command [args...]
+ *
+ * Runs the command and prints its wall time in seconds and its peak RSS
+ * in KiB to stderr. The peak RSS of a process carries over its exec from
+ * whatever forked it, so measuring straight from a big interpreter would
+ * report the interpreter's size; this launcher is small.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "block_meta.h"
+
+int main(int argc, char *argv[])
+{
+	struct timespec start, end;
+	struct rusage usage;
+	int status;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s command [args...]\n", argv[0]);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid_t pid = fork();
+
+	DIE(pid < 0, "fork");
+	if (pid == 0) {
+		execvp(argv[1], argv + 1);
+		_exit(127);
+	}
+	DIE(wait4(pid, &status, 0, &usage) < 0, "wait4");
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(stderr, "%.6f %ld\n", end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9,
+			usage.ru_maxrss);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
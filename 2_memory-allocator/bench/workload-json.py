@@ -0,0 +1,19 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+
+"""
+Allocation-heavy workload to record a trace from: round trips of a JSON
+document with many small and medium objects through the json module.
+Deterministic, so the recorded trace is the same on every run with the
+same interpreter.
+"""
+
+import json
+import random
+
+random.seed(1)
+doc = [{"id": i, "name": "item%d" % i * random.randint(1, 40), "tags": list(range(random.randint(0, 80)))}
+       for i in range(20000)]
+for _ in range(3):
+    doc = json.loads(json.dumps(doc))
+print(len(doc))
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <stdint.h>
+#include "osmem.h"
+#include "linked_list.h"
+
+/*
+ * A chunk is one ordinary osmem allocation: small chunks come from the
+ * heap, big ones are mapped, exactly like any other os_malloc. Objects
+ * are carved out of it by bumping a cursor, so they carry no block_meta
+ * and freeing one of them is a no-op.
+ *
+ * Chunks are never released before os_arena_destroy. Reset only rewinds
+ * the cursor to the first chunk, and the next allocations walk the chunk
+ * list again, refilling the chunks in the order they were first used.
+ */
+struct arena_chunk {
+	struct arena_chunk *next;
+	char *cursor;
+	char *end;
+};
+
+struct os_arena {
+	struct arena_chunk *first;
+	struct arena_chunk *current;
+	size_t chunk_size;
+};
+
+#define CHUNK_HEADER_SIZE	(pad(sizeof(struct arena_chunk)))
+/* anything bigger would wrap around in pad() or in the chunk size */
+#define ARENA_OBJECT_MAX	(SIZE_MAX - CHUNK_HEADER_SIZE - OS_ALIGNMENT)
+
+static char *chunk_start(struct arena_chunk *chunk)
+{
+	return (char *)chunk + CHUNK_HEADER_SIZE;
+}
+
+static struct arena_chunk *chunk_new(size_t capacity)
+{
+	struct arena_chunk *chunk = os_malloc(CHUNK_HEADER_SIZE + capacity);
+
+	if (chunk == NULL)
+		return NULL;
+	chunk->next = NULL;
+	chunk->cursor = chunk_start(chunk);
+	chunk->end = chunk->cursor + capacity;
+	return chunk;
+}
+
+static void *chunk_bump(struct arena_chunk *chunk, size_t size)
+{
+	void *object = chunk->cursor;
+
+	if ((size_t)(chunk->end - chunk->cursor) < size)
+		return NULL;
+	chunk->cursor += size;
+	return object;
+}
+
+struct os_arena *os_arena_create(size_t chunk_size)
+{
+	struct os_arena *arena;
+
+	if (chunk_size == 0)
+		chunk_size = OS_ARENA_CHUNK_SIZE;
+	if (chunk_size > ARENA_OBJECT_MAX)
+		return NULL;
+	chunk_size = pad(chunk_size);
+
+	arena = os_malloc(sizeof(*arena));
+	if (arena == NULL)
+		return NULL;
+	arena->chunk_size = chunk_size;
+	arena->first = chunk_new(chunk_size);
+	arena->current = arena->first;
+	if (arena->first == NULL) {
+		os_free(arena);
+		return NULL;
+	}
+	return arena;
+}
+
+void *os_arena_alloc(struct os_arena *arena, size_t size)
+{
+	struct arena_chunk *chunk;
+	void *object;
+
+	if (size == 0 || size > ARENA_OBJECT_MAX)
+		return NULL;
+	size = pad(size);
+
+	object = chunk_bump(arena->current, size);
+	if (object)
+		return object;
+
+	/* Chunks kept from before the last reset, in their original order */
+	for (chunk = arena->current->next; chunk; chunk = chunk->next) {
+		chunk->cursor = chunk_start(chunk);
+		arena->current = chunk;
+		object = chunk_bump(chunk, size);
+		if (object)
+			return object;
+	}
+
+	chunk = chunk_new(size > arena->chunk_size ? size : arena->chunk_size);
+	if (chunk == NULL)
+		return NULL;
+	arena->current->next = chunk;
+	arena->current = chunk;
+	return chunk_bump(chunk, size);
+}
+
+void os_arena_reset(struct os_arena *arena)
+{
+	arena->current = arena->first;
+	arena->first->cursor = chunk_start(arena->first);
+}
+
+void os_arena_destroy(struct os_arena *arena)
+{
+	struct arena_chunk *chunk, *next;
+
+	if (arena == NULL)
+		return;
+	for (chunk = arena->first; chunk; chunk = next) {
+		next = chunk->next;
+		os_free(chunk);
+	}
+	os_free(arena);
+}
@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+#include "free_bins.h"
+#include "free_tree.h"
+#include "linked_list.h"
+
+static int before(struct block_meta *a, struct block_meta *b);
+static int lower_address(struct block_meta *a, struct block_meta *b);
+
+static struct block_meta *bins_static[BINS_COUNT][BINS_STATIC_SLOTS];
+static struct free_bin bins[BINS_COUNT];
+static uint64_t bins_map[BINS_MAP_WORDS];
+static struct free_tree size_tree = { .before = before };
+static struct free_tree address_tree = { .before = lower_address };
+static void *next_fit_from;
+static int fit_policy = -1;
+static size_t fit_searches[OS_STATS_FIT_BUCKETS];
+
+/* Read on first use: the heap may be used before any constructor ran. */
+static int policy(void)
+{
+	if (__builtin_expect(fit_policy < 0, 0)) {
+		char *name = getenv("OSMEM_FIT_POLICY");
+
+		fit_policy = FIT_BEST;
+		if (name && strcmp(name, "first") == 0)
+			fit_policy = FIT_FIRST;
+		else if (name && strcmp(name, "next") == 0)
+			fit_policy = FIT_NEXT;
+	}
+	return fit_policy;
+}
+
+static size_t bin_index(size_t size)
+{
+	return size == 0 ? 0 : (size - 1) >> 3;
+}
+
+/* The tree a block of this size is kept in, NULL for the bins. */
+static struct free_tree *block_tree(size_t size)
+{
+	if (policy() != FIT_BEST)
+		return &address_tree;
+	return size > BINS_EXACT_LIMIT ? &size_tree : NULL;
+}
+
+static void bin_grow(struct free_bin *bin, size_t index)
+{
+	if (bin->slots == NULL) {
+		bin->slots = bins_static[index];
+		bin->capacity = BINS_STATIC_SLOTS;
+		return;
+	}
+
+	size_t capacity = bin->capacity * 2;
+	struct block_meta **slots = mmap(0, capacity * sizeof(*slots), PROT_READ | PROT_WRITE,
+									 MAP_PRIVATE | MAP_ANON, -1, 0);
+
+	DIE(slots == MAP_FAILED, "Error mapping free bin");
+	memcpy(slots, bin->slots, bin->count * sizeof(*slots));
+	if (bin->slots != bins_static[index])
+		munmap(bin->slots, bin->capacity * sizeof(*slots));
+	bin->slots = slots;
+	bin->capacity = capacity;
+}
+
+static int before(struct block_meta *a, struct block_meta *b)
+{
+	return a->size < b->size || (a->size == b->size && a < b);
+}
+
+static int lower_address(struct block_meta *a, struct block_meta *b)
+{
+	return a < b;
+}
+
+static void bin_place(struct free_bin *bin, uint32_t slot, struct block_meta *block)
+{
+	bin->slots[slot] = block;
+	block->bin_slot = slot;
+}
+
+static void sift_up(struct free_bin *bin, uint32_t slot)
+{
+	struct block_meta *block = bin->slots[slot];
+
+	while (slot > 0) {
+		uint32_t parent = (slot - 1) / 2;
+
+		if (!before(block, bin->slots[parent]))
+			break;
+		bin_place(bin, slot, bin->slots[parent]);
+		slot = parent;
+	}
+	bin_place(bin, slot, block);
+}
+
+static void sift_down(struct free_bin *bin, uint32_t slot)
+{
+	struct block_meta *block = bin->slots[slot];
+
+	while (1) {
+		uint32_t child = 2 * slot + 1;
+
+		if (child >= bin->count)
+			break;
+		if (child + 1 < bin->count && before(bin->slots[child + 1], bin->slots[child]))
+			child++;
+		if (!before(bin->slots[child], block))
+			break;
+		bin_place(bin, slot, bin->slots[child]);
+		slot = child;
+	}
+	bin_place(bin, slot, block);
+}
+
+void os_bins_insert(struct block_meta *block)
+{
+	struct free_tree *tree = block_tree(block->size);
+
+	if (block->bin_slot != BIN_SLOT_NONE)
+		os_bins_remove(block);
+#ifdef OSMEM_SEGMENTS
+	/* it was just freed, split or coalesced: some pages may be dirty */
+	os_block_clear_flags(block, FLAG_PURGED);
+#endif
+	if (tree) {
+		os_tree_insert(tree, block);
+		return;
+	}
+
+	size_t index = bin_index(block->size);
+	struct free_bin *bin = &bins[index];
+
+	if (bin->count == bin->capacity)
+		bin_grow(bin, index);
+
+	bin_place(bin, bin->count++, block);
+	sift_up(bin, block->bin_slot);
+	bins_map[index >> 6] |= 1UL << (index & 63);
+}
+
+void os_bins_remove(struct block_meta *block)
+{
+	if (block->bin_slot == BIN_SLOT_NONE)
+		return;
+
+	struct free_tree *tree = block_tree(block->size);
+
+	if (tree) {
+		os_tree_remove(tree, block);
+		return;
+	}
+
+	size_t index = bin_index(block->size);
+	struct free_bin *bin = &bins[index];
+	uint32_t slot = block->bin_slot;
+	struct block_meta *last = bin->slots[--bin->count];
+
+	block->bin_slot = BIN_SLOT_NONE;
+	if (last != block) {
+		bin_place(bin, slot, last);
+		sift_up(bin, slot);
+		sift_down(bin, last->bin_slot);
+	}
+	if (bin->count == 0)
+		bins_map[index >> 6] &= ~(1UL << (index & 63));
+}
+
+static long next_bin(size_t index)
+{
+	size_t word = index >> 6;
+
+	if (index >= BINS_COUNT)
+		return -1;
+
+	uint64_t bits = bins_map[word] & (~0UL << (index & 63));
+
+	while (bits == 0) {
+		if (++word >= BINS_MAP_WORDS)
+			return -1;
+		bits = bins_map[word];
+	}
+	return (long)((word << 6) + __builtin_ctzl(bits));
+}
+
+/* Bucket 0 counts searches that found nothing to look at, bucket b > 0
+ * the ones that inspected [2^(b-1), 2^b) blocks. */
+static void record_search(size_t inspected)
+{
+	size_t bucket = inspected ? 64 - __builtin_clzl(inspected) : 0;
+
+	if (bucket >= OS_STATS_FIT_BUCKETS)
+		bucket = OS_STATS_FIT_BUCKETS - 1;
+	fit_searches[bucket]++;
+}
+
+static struct block_meta *take_first(size_t size, size_t *inspected)
+{
+	void *from = policy() == FIT_NEXT ? next_fit_from : NULL;
+	struct block_meta *fit = os_tree_first(&address_tree, size, from, inspected);
+
+	if (fit == NULL && from)
+		fit = os_tree_first(&address_tree, size, NULL, inspected);
+	next_fit_from = fit;
+	return fit;
+}
+
+struct block_meta *os_bins_take(size_t size)
+{
+	struct block_meta *fit = NULL;
+	size_t inspected = 0;
+
+	if (policy() != FIT_BEST) {
+		fit = take_first(size, &inspected);
+	} else if (size <= BINS_EXACT_LIMIT) {
+		long index = next_bin(bin_index(size));
+
+		if (index >= 0) {
+			fit = bins[index].slots[0];
+			inspected++;
+		}
+	}
+	if (fit == NULL && policy() == FIT_BEST)
+		fit = os_tree_best(&size_tree, size, &inspected);
+
+	record_search(inspected);
+	if (fit)
+		os_bins_remove(fit);
+	return fit;
+}
+
+void os_bins_searches(size_t *buckets)
+{
+	memcpy(buckets, fit_searches, sizeof(fit_searches));
+}
+
+void os_bins_walk(size_t min_size, void (*visit)(struct block_meta *block))
+{
+	if (policy() != FIT_BEST) {
+		os_tree_walk(&address_tree, min_size, visit);
+		return;
+	}
+
+	for (long index = next_bin(bin_index(min_size)); index >= 0; index = next_bin(index + 1)) {
+		struct free_bin *bin = &bins[index];
+
+		for (uint32_t i = 0; i < bin->count; ++i)
+			if (bin->slots[i]->size >= min_size)
+				visit(bin->slots[i]);
+	}
+	os_tree_walk(&size_tree, min_size, visit);
+}
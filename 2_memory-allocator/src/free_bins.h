@@ -0,0 +1,79 @@
+#pragma once
+// SPDX-License-Identifier: BSD-3-Clause
+#include <stdint.h>
+#include "block_meta.h"
+
+/*
+ * Free block index. Payload sizes up to BINS_EXACT_LIMIT get one bin per
+ * multiple of 8, every block in such a bin has the same size. A bin is a
+ * binary min-heap of block pointers ordered by address, so its head is the
+ * lowest-addressed block of that size, and a binned block keeps its heap
+ * index in bin_slot, which makes unlinking it O(log n) without touching its
+ * payload. Each bin starts on a small static array and moves to an mmap'd
+ * one once it outgrows it. Bigger blocks go to a red-black tree ordered by
+ * (size, address) (see free_tree.h). Either way os_bins_take finds the
+ * best fit with the lowest address in O(log n).
+ *
+ * That is the best-fit policy. Setting OSMEM_FIT_POLICY to "first" or
+ * "next" in the environment puts every free block in one tree ordered by
+ * address instead, which serves the lowest-addressed block that fits, or
+ * the first one after the previous fit, wrapping around. The policy is
+ * fixed for the life of the process.
+ */
+#define BINS_EXACT_LIMIT	1024
+#define BINS_COUNT		(BINS_EXACT_LIMIT / 8)
+#define BINS_MAP_WORDS		((BINS_COUNT + 63) / 64)
+#define BINS_STATIC_SLOTS	16
+#define BIN_SLOT_NONE		(-1)
+
+#define FIT_BEST		0
+#define FIT_FIRST		1
+#define FIT_NEXT		2
+
+struct free_bin {
+	struct block_meta **slots;
+	uint32_t count;
+	uint32_t capacity;
+};
+
+/**
+ * @brief Add a free heap block to its size-class bin. In the segments
+ * build the block loses FLAG_PURGED, its pages may be in use again
+ *
+ * @param block
+ */
+void os_bins_insert(struct block_meta *block);
+
+/**
+ * @brief Unlink a block from its bin. Does nothing if the block is
+ * not binned, so it is safe to call on any heap block
+ *
+ * @param block
+ */
+void os_bins_remove(struct block_meta *block);
+
+/**
+ * @brief Finds and unlinks the block the fit policy picks for a payload
+ * of size bytes. Returns NULL if none fits
+ *
+ * @param size padded payload size
+ * @return struct block_meta*
+ */
+struct block_meta *os_bins_take(size_t size);
+
+/**
+ * @brief Copy the histogram of how many blocks os_bins_take inspected
+ * per search, OS_STATS_FIT_BUCKETS power-of-two buckets
+ *
+ * @param buckets
+ */
+void os_bins_searches(size_t *buckets);
+
+/**
+ * @brief Calls visit on every binned block with a payload of at least
+ * min_size bytes. visit must not insert or remove blocks
+ *
+ * @param min_size
+ * @param visit
+ */
+void os_bins_walk(size_t min_size, void (*visit)(struct block_meta *block));
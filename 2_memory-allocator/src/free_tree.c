@@ -0,0 +1,334 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "free_tree.h"
+#include "free_bins.h"
+
+static struct tree_node chunk_static[TREE_CHUNK_NODES];
+static struct tree_node *chunks[TREE_CHUNKS] = { chunk_static };
+static struct tree_node *free_nodes;
+static long nodes_carved;
+
+static struct tree_node *node_at(long index)
+{
+	return &chunks[index / TREE_CHUNK_NODES][index % TREE_CHUNK_NODES];
+}
+
+static struct tree_node *node_new(void)
+{
+	struct tree_node *node = free_nodes;
+
+	if (node) {
+		free_nodes = node->left;
+		return node;
+	}
+
+	long index = nodes_carved++;
+	long chunk = index / TREE_CHUNK_NODES;
+
+	DIE(chunk >= TREE_CHUNKS, "Too many free blocks");
+	if (chunks[chunk] == NULL) {
+		chunks[chunk] = mmap(0, TREE_CHUNK_NODES * sizeof(struct tree_node), PROT_READ | PROT_WRITE,
+							 MAP_PRIVATE | MAP_ANON, -1, 0);
+		DIE(chunks[chunk] == MAP_FAILED, "Error mapping free tree nodes");
+	}
+	node = node_at(index);
+	node->index = index;
+	return node;
+}
+
+static void node_free(struct tree_node *node)
+{
+	node->left = free_nodes;
+	free_nodes = node;
+}
+
+static size_t subtree_max(struct tree_node *node)
+{
+	return node ? node->max_size : 0;
+}
+
+static void update(struct tree_node *node)
+{
+	size_t max = node->block->size;
+
+	if (subtree_max(node->left) > max)
+		max = node->left->max_size;
+	if (subtree_max(node->right) > max)
+		max = node->right->max_size;
+	node->max_size = max;
+}
+
+static void update_up(struct tree_node *node)
+{
+	for (; node; node = node->parent)
+		update(node);
+}
+
+static void replace_child(struct free_tree *tree, struct tree_node *parent,
+						  struct tree_node *old, struct tree_node *new)
+{
+	if (parent == NULL)
+		tree->root = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+	if (new)
+		new->parent = parent;
+}
+
+static void rotate_left(struct free_tree *tree, struct tree_node *node)
+{
+	struct tree_node *pivot = node->right;
+
+	node->right = pivot->left;
+	if (pivot->left)
+		pivot->left->parent = node;
+	replace_child(tree, node->parent, node, pivot);
+	pivot->left = node;
+	node->parent = pivot;
+	update(node);
+	update(pivot);
+}
+
+static void rotate_right(struct free_tree *tree, struct tree_node *node)
+{
+	struct tree_node *pivot = node->left;
+
+	node->left = pivot->right;
+	if (pivot->right)
+		pivot->right->parent = node;
+	replace_child(tree, node->parent, node, pivot);
+	pivot->right = node;
+	node->parent = pivot;
+	update(node);
+	update(pivot);
+}
+
+static int is_red(struct tree_node *node)
+{
+	return node && node->red;
+}
+
+static void insert_fixup(struct free_tree *tree, struct tree_node *node)
+{
+	struct tree_node *parent, *grandparent, *uncle;
+
+	while ((parent = node->parent) && parent->red) {
+		grandparent = parent->parent;
+		if (parent == grandparent->left) {
+			uncle = grandparent->right;
+			if (is_red(uncle)) {
+				parent->red = uncle->red = 0;
+				grandparent->red = 1;
+				node = grandparent;
+				continue;
+			}
+			if (node == parent->right) {
+				rotate_left(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+			parent->red = 0;
+			grandparent->red = 1;
+			rotate_right(tree, grandparent);
+		} else {
+			uncle = grandparent->left;
+			if (is_red(uncle)) {
+				parent->red = uncle->red = 0;
+				grandparent->red = 1;
+				node = grandparent;
+				continue;
+			}
+			if (node == parent->left) {
+				rotate_right(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+			parent->red = 0;
+			grandparent->red = 1;
+			rotate_left(tree, grandparent);
+		}
+	}
+	tree->root->red = 0;
+}
+
+void os_tree_insert(struct free_tree *tree, struct block_meta *block)
+{
+	struct tree_node *node = node_new();
+	struct tree_node *parent = NULL;
+	struct tree_node **link = &tree->root;
+
+	while (*link) {
+		parent = *link;
+		link = tree->before(block, parent->block) ? &parent->left : &parent->right;
+	}
+	node->block = block;
+	node->left = node->right = NULL;
+	node->parent = parent;
+	node->max_size = block->size;
+	node->red = 1;
+	*link = node;
+	block->bin_slot = node->index;
+
+	update_up(parent);
+	insert_fixup(tree, node);
+}
+
+/* node is the (possibly empty) child that took the place of a black node */
+static void remove_fixup(struct free_tree *tree, struct tree_node *node, struct tree_node *parent)
+{
+	struct tree_node *sibling;
+
+	while (node != tree->root && !is_red(node)) {
+		if (node == parent->left) {
+			sibling = parent->right;
+			if (sibling->red) {
+				sibling->red = 0;
+				parent->red = 1;
+				rotate_left(tree, parent);
+				sibling = parent->right;
+			}
+			if (!is_red(sibling->left) && !is_red(sibling->right)) {
+				sibling->red = 1;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+			if (!is_red(sibling->right)) {
+				sibling->left->red = 0;
+				sibling->red = 1;
+				rotate_right(tree, sibling);
+				sibling = parent->right;
+			}
+			sibling->red = parent->red;
+			parent->red = 0;
+			sibling->right->red = 0;
+			rotate_left(tree, parent);
+		} else {
+			sibling = parent->left;
+			if (sibling->red) {
+				sibling->red = 0;
+				parent->red = 1;
+				rotate_right(tree, parent);
+				sibling = parent->left;
+			}
+			if (!is_red(sibling->left) && !is_red(sibling->right)) {
+				sibling->red = 1;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+			if (!is_red(sibling->left)) {
+				sibling->right->red = 0;
+				sibling->red = 1;
+				rotate_left(tree, sibling);
+				sibling = parent->left;
+			}
+			sibling->red = parent->red;
+			parent->red = 0;
+			sibling->left->red = 0;
+			rotate_right(tree, parent);
+		}
+		node = tree->root;
+	}
+	if (node)
+		node->red = 0;
+}
+
+void os_tree_remove(struct free_tree *tree, struct block_meta *block)
+{
+	struct tree_node *node = node_at(block->bin_slot);
+	struct tree_node *child, *parent;
+	int removed_red = node->red;
+
+	if (node->left == NULL || node->right == NULL) {
+		child = node->left ? node->left : node->right;
+		parent = node->parent;
+		replace_child(tree, parent, node, child);
+	} else {
+		/* the successor takes the node's place and colour */
+		struct tree_node *next = node->right;
+
+		while (next->left)
+			next = next->left;
+		removed_red = next->red;
+		child = next->right;
+		if (next->parent == node) {
+			parent = next;
+		} else {
+			parent = next->parent;
+			replace_child(tree, parent, next, child);
+			next->right = node->right;
+			next->right->parent = next;
+		}
+		replace_child(tree, node->parent, node, next);
+		next->left = node->left;
+		next->left->parent = next;
+		next->red = node->red;
+	}
+
+	update_up(parent);
+	if (!removed_red)
+		remove_fixup(tree, child, parent);
+	block->bin_slot = BIN_SLOT_NONE;
+	node_free(node);
+}
+
+struct block_meta *os_tree_best(struct free_tree *tree, size_t size, size_t *inspected)
+{
+	struct tree_node *best = NULL;
+
+	for (struct tree_node *node = tree->root; node; (*inspected)++) {
+		if (node->block->size >= size) {
+			best = node;
+			node = node->left;
+		} else {
+			node = node->right;
+		}
+	}
+	return best ? best->block : NULL;
+}
+
+static struct tree_node *first_fit(struct tree_node *node, size_t size, void *from, size_t *inspected)
+{
+	while (node && node->max_size >= size) {
+		(*inspected)++;
+		if ((void *)node->block < from) {
+			node = node->right;
+			continue;
+		}
+
+		struct tree_node *left = first_fit(node->left, size, from, inspected);
+
+		if (left)
+			return left;
+		if (node->block->size >= size)
+			return node;
+		node = node->right;
+	}
+	return NULL;
+}
+
+struct block_meta *os_tree_first(struct free_tree *tree, size_t size, void *from, size_t *inspected)
+{
+	struct tree_node *node = first_fit(tree->root, size, from, inspected);
+
+	return node ? node->block : NULL;
+}
+
+static void walk(struct tree_node *node, size_t min_size, void (*visit)(struct block_meta *block))
+{
+	while (node && node->max_size >= min_size) {
+		walk(node->left, min_size, visit);
+		if (node->block->size >= min_size)
+			visit(node->block);
+		node = node->right;
+	}
+}
+
+void os_tree_walk(struct free_tree *tree, size_t min_size, void (*visit)(struct block_meta *block))
+{
+	walk(tree->root, min_size, visit);
+}
@@ -0,0 +1,84 @@
+#pragma once
+// SPDX-License-Identifier: BSD-3-Clause
+#include <stdint.h>
+#include "block_meta.h"
+
+/*
+ * Red-black trees of free blocks. The nodes live outside the blocks, in
+ * chunks of TREE_CHUNK_NODES, so nothing is written into a freed payload;
+ * a block in a tree keeps the index of its node in bin_slot. The first
+ * chunk is static, the others are mmap'd as the trees grow.
+ *
+ * Every node also carries the largest block size in its subtree, so a
+ * tree ordered by address can answer "lowest address at or after a given
+ * one with at least this much room" in O(log n), the query first-fit and
+ * next-fit need. A tree ordered by (size, address) answers best-fit with a
+ * plain lower bound.
+ */
+#define TREE_CHUNK_NODES	1024
+#define TREE_CHUNKS		16384
+
+struct tree_node {
+	struct block_meta *block;
+	struct tree_node *left;
+	struct tree_node *right;
+	struct tree_node *parent;
+	size_t max_size;
+	long index;
+	int red;
+};
+
+struct free_tree {
+	struct tree_node *root;
+	/* strict order of the blocks in the tree */
+	int (*before)(struct block_meta *a, struct block_meta *b);
+};
+
+/**
+ * @brief Add a free block to a tree, its node index goes to bin_slot
+ *
+ * @param tree
+ * @param block
+ */
+void os_tree_insert(struct free_tree *tree, struct block_meta *block);
+
+/**
+ * @brief Unlink a block from the tree it is in
+ *
+ * @param tree
+ * @param block
+ */
+void os_tree_remove(struct free_tree *tree, struct block_meta *block);
+
+/**
+ * @brief Smallest block of at least size bytes, lowest address among
+ * equals. The tree must be ordered by (size, address)
+ *
+ * @param tree
+ * @param size
+ * @param inspected incremented for every node looked at
+ * @return struct block_meta*
+ */
+struct block_meta *os_tree_best(struct free_tree *tree, size_t size, size_t *inspected);
+
+/**
+ * @brief Lowest-addressed block at or after from with at least size
+ * bytes. The tree must be ordered by address
+ *
+ * @param tree
+ * @param size
+ * @param from
+ * @param inspected incremented for every node looked at
+ * @return struct block_meta*
+ */
+struct block_meta *os_tree_first(struct free_tree *tree, size_t size, void *from, size_t *inspected);
+
+/**
+ * @brief Calls visit on every block of at least min_size bytes, in tree
+ * order. visit must not change the tree
+ *
+ * @param tree
+ * @param min_size
+ * @param visit
+ */
+void os_tree_walk(struct free_tree *tree, size_t min_size, void (*visit)(struct block_meta *block));
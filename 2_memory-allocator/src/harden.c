@@ -0,0 +1,388 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include "harden.h"
+
+#ifdef OSMEM_HARDEN
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include "linked_list.h"
+#include "stats.h"
+
+#ifdef OSMEM_THREAD_SAFE
+#include <pthread.h>
+
+static __thread long guard_countdown;
+static __thread unsigned int jitter_seed;
+static pthread_mutex_t harden_lock = PTHREAD_MUTEX_INITIALIZER;
+#define harden_lock()		pthread_mutex_lock(&harden_lock)
+#define harden_unlock()		pthread_mutex_unlock(&harden_lock)
+#else
+static long guard_countdown;
+static unsigned int jitter_seed;
+#define harden_lock()
+#define harden_unlock()
+#endif
+
+struct harden_trailer {
+	uint64_t size;
+	uint64_t checksum;
+};
+
+struct guard_slot {
+	size_t size;
+	int live;
+};
+
+int os_hardened = -1;
+static uint64_t secret;
+static size_t page;
+
+static void *quarantine[QUARANTINE_SLOTS];
+static size_t quarantine_head;
+static size_t quarantine_count;
+static size_t quarantine_bytes;
+static size_t quarantine_limit = QUARANTINE_BYTES;
+
+static char *guard_pool;
+static size_t guard_pool_size;
+static long guard_rate = GUARD_RATE;
+static struct guard_slot guard_slots[GUARD_SLOTS];
+static uint32_t guard_fifo[GUARD_SLOTS];
+static size_t guard_head;
+static size_t guard_count;
+static struct sigaction previous_action;
+
+__attribute__((noreturn))
+static void report(const char *what, void *ptr, const char *op)
+{
+	struct os_print_buffer buffer = { .fd = STDERR_FILENO };
+
+	fctprintf(os_print_char, &buffer, "osmem: %s in %s(0x%lx)\n", what, op, (unsigned long)ptr);
+	os_print_flush(&buffer);
+	abort();
+}
+
+static uint64_t mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdUL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53UL;
+	x ^= x >> 33;
+	return x;
+}
+
+static uint64_t checksum(struct block_meta *block, size_t size)
+{
+	uint64_t hash = mix(secret ^ (uintptr_t)block ^ ((uint64_t)block->status << 60));
+
+	return mix(hash ^ block->size ^ (size * 0x9E3779B97F4A7C15UL));
+}
+
+static struct harden_trailer *trailer_of(void *payload, struct block_meta *block)
+{
+	return (struct harden_trailer *)((char *)payload + block->size - HARDEN_TRAILER_SIZE);
+}
+
+/* pad() is out of line and these run on every hardened call */
+static size_t canary_end(size_t size)
+{
+	return ((size + 7) & ~(size_t)7) + HARDEN_CANARY_SIZE;
+}
+
+/* The canary is the secret repeated on every 8-byte boundary. */
+static void write_canary(unsigned char *payload, size_t size)
+{
+	size_t end = canary_end(size), i;
+
+	for (i = size; i & 7; ++i)
+		payload[i] = secret >> (8 * (i & 7));
+	for (; i < end; i += 8)
+		*(uint64_t *)(payload + i) = secret;
+}
+
+static int canary_intact(unsigned char *payload, size_t size)
+{
+	size_t end = canary_end(size), i;
+
+	for (i = size; i & 7; ++i)
+		if (payload[i] != (unsigned char)(secret >> (8 * (i & 7))))
+			return 0;
+	for (; i < end; i += 8)
+		if (*(uint64_t *)(payload + i) != secret)
+			return 0;
+	return 1;
+}
+
+static long next_interval(void)
+{
+	jitter_seed = jitter_seed * 1103515245 + 12345;
+	return guard_rate / 2 + (jitter_seed >> 8) % guard_rate + 1;
+}
+
+/* Tell an overflow from a use after free before the fault kills us. */
+static void guard_fault(int signum, siginfo_t *info, void *context)
+{
+	char *address = info->si_addr;
+
+	(void)signum;
+	(void)context;
+	if (os_guard_owns(address)) {
+		struct os_print_buffer buffer = { .fd = STDERR_FILENO };
+		size_t index = (address - guard_pool) / page;
+		struct guard_slot *slot = NULL;
+		const char *what = "heap buffer overflow";
+
+		if (index % 2) {
+			slot = &guard_slots[index / 2];
+			what = "use after free";
+		} else if (index > 0 && guard_slots[index / 2 - 1].live) {
+			slot = &guard_slots[index / 2 - 1];
+		} else if (index / 2 < GUARD_SLOTS) {
+			slot = &guard_slots[index / 2];
+			what = "heap buffer underflow";
+		}
+		fctprintf(os_print_char, &buffer, "osmem: %s at 0x%lx", what, (unsigned long)address);
+		if (slot) {
+			char *data = guard_pool + (2 * (slot - guard_slots) + 1) * page;
+
+			fctprintf(os_print_char, &buffer, ", %zu-byte object at 0x%lx",
+					  slot->size, (unsigned long)(data + page - pad(slot->size)));
+		}
+		fctprintf(os_print_char, &buffer, "\n");
+		os_print_flush(&buffer);
+	}
+	/* the access faults again and gets whatever was installed before */
+	sigaction(SIGSEGV, &previous_action, NULL);
+}
+
+static void guard_init(void)
+{
+	struct sigaction action;
+
+	guard_pool_size = (2 * GUARD_SLOTS + 1) * page;
+	guard_pool = mmap(0, guard_pool_size, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+	DIE(guard_pool == MAP_FAILED, "Error mapping guard pool");
+
+	for (uint32_t slot = 0; slot < GUARD_SLOTS; ++slot)
+		guard_fifo[slot] = slot;
+	guard_count = GUARD_SLOTS;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = guard_fault;
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, &previous_action);
+}
+
+#ifdef OSMEM_THREAD_SAFE
+static void fork_prepare(void)
+{
+	harden_lock();
+}
+
+static void fork_done(void)
+{
+	harden_unlock();
+}
+#endif
+
+/* Read on first use: the heap may be used before any constructor ran. */
+int os_harden_init(void)
+{
+	int enabled = 0;
+
+	if (__builtin_expect(__atomic_load_n(&os_hardened, __ATOMIC_ACQUIRE) >= 0, 1))
+		return os_hardened;
+
+	harden_lock();
+	if (os_hardened < 0) {
+		char *mode = getenv("OSMEM_HARDEN");
+		char *rate = getenv("OSMEM_GUARD_RATE");
+		char *limit = getenv("OSMEM_QUARANTINE");
+		uint64_t *random = (uint64_t *)getauxval(AT_RANDOM);
+
+		if (mode && strtol(mode, NULL, 10) > 0) {
+			page = getpagesize();
+			secret = random ? *random : mix((uintptr_t)&mode ^ getpid());
+			jitter_seed = getpid();
+			if (rate)
+				guard_rate = strtol(rate, NULL, 10);
+			if (limit)
+				quarantine_limit = strtoul(limit, NULL, 10);
+			if (guard_rate > 0)
+				guard_init();
+			enabled = 1;
+		}
+		__atomic_store_n(&os_hardened, enabled, __ATOMIC_RELEASE);
+	}
+	harden_unlock();
+
+	/* pthread_atfork may allocate, which must find the mode set */
+#ifdef OSMEM_THREAD_SAFE
+	if (enabled)
+		pthread_atfork(fork_prepare, fork_done, fork_done);
+#endif
+	return os_hardened;
+}
+
+void os_harden_seal(void *payload, size_t size)
+{
+	struct block_meta *block = os_memlist_getblockstart(payload);
+	struct harden_trailer *trailer = trailer_of(payload, block);
+
+	write_canary(payload, size);
+	trailer->size = size;
+	trailer->checksum = checksum(block, size);
+}
+
+size_t os_harden_check(void *payload, const char *op)
+{
+	struct block_meta *block = os_memlist_getblockstart(payload);
+
+	if ((block->status != STATUS_ALLOC && block->status != STATUS_MAPPED)
+		|| block->size < HARDEN_EXTRA)
+		report("invalid pointer or corrupted header", payload, op);
+	if (block->flags & FLAG_QUARANTINED)
+		report("double free", payload, op);
+
+	struct harden_trailer *trailer = trailer_of(payload, block);
+	size_t size = trailer->size;
+
+	if (size > block->size - HARDEN_EXTRA || trailer->checksum != checksum(block, size))
+		report("corrupted header or trailer", payload, op);
+
+	if (!canary_intact(payload, size))
+		report("heap buffer overflow", payload, op);
+	return size;
+}
+
+static int still_poisoned(void *payload, size_t size)
+{
+	const uint64_t word = 0x0101010101010101UL * QUARANTINE_POISON;
+	const uint64_t *words = payload;
+	const unsigned char *bytes = payload;
+	size_t i;
+
+	for (i = 0; i < size / 8; ++i)
+		if (words[i] != word)
+			return 0;
+	for (i *= 8; i < size; ++i)
+		if (bytes[i] != QUARANTINE_POISON)
+			return 0;
+	return 1;
+}
+
+/* Quarantine lock held. */
+static void *quarantine_evict(void)
+{
+	void *payload = quarantine[quarantine_head];
+	struct block_meta *block = os_memlist_getblockstart(payload);
+	size_t size = trailer_of(payload, block)->size;
+
+	quarantine_head = (quarantine_head + 1) % QUARANTINE_SLOTS;
+	quarantine_count--;
+	quarantine_bytes -= size;
+
+	if (!still_poisoned(payload, size))
+		report("write after free", payload, "free");
+	os_block_clear_flags(block, FLAG_QUARANTINED);
+	os_harden_check(payload, "free");
+	return payload;
+}
+
+size_t os_harden_quarantine(void *payload, void **evicted)
+{
+	struct block_meta *block = os_memlist_getblockstart(payload);
+	size_t size = trailer_of(payload, block)->size;
+	size_t count = 0;
+
+	if (size > quarantine_limit / 4) {
+		evicted[0] = payload;
+		return 1;
+	}
+	memset(payload, QUARANTINE_POISON, size);
+
+	harden_lock();
+	while (quarantine_count > 0 && count < QUARANTINE_BATCH
+		   && (quarantine_count == QUARANTINE_SLOTS || quarantine_bytes + size > quarantine_limit))
+		evicted[count++] = quarantine_evict();
+
+	os_block_set_flags(block, FLAG_QUARANTINED);
+	quarantine[(quarantine_head + quarantine_count) % QUARANTINE_SLOTS] = payload;
+	quarantine_count++;
+	quarantine_bytes += size;
+	harden_unlock();
+	return count;
+}
+
+void *os_guard_alloc(size_t size)
+{
+	if (--guard_countdown > 0)
+		return NULL;
+
+	/* a thread's first allocation only arms its countdown */
+	int armed = guard_countdown == 0;
+
+	guard_countdown = guard_rate > 0 ? next_interval() : LONG_MAX;
+	if (!armed || guard_rate <= 0 || size == 0 || size > page)
+		return NULL;
+
+	harden_lock();
+	if (guard_count == 0) {
+		harden_unlock();
+		return NULL;
+	}
+
+	uint32_t slot = guard_fifo[guard_head];
+	char *data = guard_pool + (2 * slot + 1) * page;
+
+	guard_head = (guard_head + 1) % GUARD_SLOTS;
+	guard_count--;
+	DIE(mprotect(data, page, PROT_READ | PROT_WRITE) != 0, "Error unprotecting guarded slot");
+	guard_slots[slot].size = size;
+	guard_slots[slot].live = 1;
+	harden_unlock();
+
+	return data + page - pad(size);
+}
+
+int os_guard_owns(void *ptr)
+{
+	return (char *)ptr >= guard_pool && (char *)ptr < guard_pool + guard_pool_size;
+}
+
+void os_guard_free(void *ptr)
+{
+	size_t index = ((char *)ptr - guard_pool) / page;
+	struct guard_slot *slot = &guard_slots[index / 2];
+	char *data = guard_pool + index * page;
+
+	if (index % 2 == 0 || (char *)ptr != data + page - pad(slot->size))
+		report("invalid pointer", ptr, "free");
+
+	harden_lock();
+	if (!slot->live)
+		report("double free", ptr, "free");
+
+	DIE(mprotect(data, page, PROT_NONE) != 0, "Error protecting guarded slot");
+	slot->live = 0;
+	/* the slot goes to the back, to catch uses after free for longer */
+	guard_fifo[(guard_head + guard_count) % GUARD_SLOTS] = index / 2;
+	guard_count++;
+	harden_unlock();
+}
+
+size_t os_guard_size(void *ptr)
+{
+	size_t index = ((char *)ptr - guard_pool) / page;
+
+	return guard_slots[index / 2].size;
+}
+
+#endif
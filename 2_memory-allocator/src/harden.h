@@ -0,0 +1,117 @@
+#pragma once
+// SPDX-License-Identifier: BSD-3-Clause
+#include <stddef.h>
+#include "block_meta.h"
+
+/*
+ * Hardened mode (built with -DOSMEM_HARDEN, off unless OSMEM_HARDEN=1 is
+ * set in the environment). The mode is read on the first allocation and
+ * fixed for the life of the process; until then and while it is off the
+ * allocation paths only test os_hardened.
+ *
+ * A hardened heap block is asked for HARDEN_EXTRA bytes more than the
+ * request. The last HARDEN_TRAILER_SIZE bytes of its payload hold the
+ * requested size and a checksum of the header, keyed with a per-process
+ * secret, and a canary runs from the end of the requested bytes to
+ * HARDEN_CANARY_SIZE bytes past the next multiple of 8. Both are checked
+ * whenever the block comes back, so a corrupted header, an overflow past
+ * the requested size or freeing a pointer the allocator never handed out
+ * aborts the process.
+ *
+ * A freed block is poisoned and parked in a FIFO quarantine of at most
+ * QUARANTINE_SLOTS blocks and OSMEM_QUARANTINE bytes (QUARANTINE_BYTES by
+ * default) before it is really freed; the poison is checked on the way
+ * out, which catches writes after free, and freeing a parked block again
+ * is a double free. Blocks bigger than a quarter of the limit skip it.
+ *
+ * One in OSMEM_GUARD_RATE allocations of up to a page (GUARD_RATE by
+ * default, 0 turns sampling off) lands in a guarded slot instead: a page
+ * of its own between two PROT_NONE pages, with the object right-aligned
+ * against the one after it. A freed slot is made PROT_NONE as well and is
+ * the last to be reused. An access that faults in the guard pool is
+ * reported as an overflow or a use after free before the process dies.
+ */
+#define HARDEN_CANARY_SIZE	8
+#define HARDEN_TRAILER_SIZE	16
+#define HARDEN_EXTRA		(HARDEN_CANARY_SIZE + HARDEN_TRAILER_SIZE)
+#define QUARANTINE_SLOTS	1024
+#define QUARANTINE_BYTES	(256 * 1024)
+#define QUARANTINE_BATCH	8
+#define QUARANTINE_POISON	0xdf
+#define GUARD_SLOTS		256
+#define GUARD_RATE		1000
+
+#ifdef OSMEM_HARDEN
+
+/* -1 until the environment is read, then 0 or 1 */
+extern int os_hardened;
+
+#define OS_HARDENED()	(__builtin_expect(os_hardened != 0, 0) && (os_hardened > 0 || os_harden_init()))
+
+/**
+ * @brief Read the mode from the environment on first use
+ *
+ * @return int whether hardened mode is on
+ */
+int os_harden_init(void);
+
+/**
+ * @brief Write the canary and the trailer of a freshly allocated block
+ *
+ * @param payload allocated for at least size + HARDEN_EXTRA bytes
+ * @param size requested size
+ */
+void os_harden_seal(void *payload, size_t size);
+
+/**
+ * @brief Verify the header, the trailer and the canary of a block that
+ * comes back to the allocator. Aborts the process if any is off
+ *
+ * @param payload
+ * @param op name of the call, for the report
+ * @return size_t the size it was requested with
+ */
+size_t os_harden_check(void *payload, const char *op);
+
+/**
+ * @brief Park a checked block in the quarantine
+ *
+ * @param payload
+ * @param evicted gets up to QUARANTINE_BATCH blocks that leave the
+ * quarantine and are to be freed for real
+ * @return size_t how many blocks were evicted
+ */
+size_t os_harden_quarantine(void *payload, void **evicted);
+
+/**
+ * @brief Take a guarded slot if this allocation is sampled
+ *
+ * @param size
+ * @return void* NULL if it is not sampled, too big or no slot is free
+ */
+void *os_guard_alloc(size_t size);
+
+/**
+ * @brief Check whether a pointer falls inside the guard pool
+ *
+ * @param ptr
+ * @return int
+ */
+int os_guard_owns(void *ptr);
+
+/**
+ * @brief Release a guarded slot. Aborts on a double or invalid free
+ *
+ * @param ptr
+ */
+void os_guard_free(void *ptr);
+
+/**
+ * @brief Requested size of a live guarded object
+ *
+ * @param ptr
+ * @return size_t
+ */
+size_t os_guard_size(void *ptr);
+
+#endif
@@ -1,13 +1,13 @@
 // SPDX-License-Identifier: BSD-3-Clause
 #include "linked_list.h"
+#include "free_bins.h"
+#include "segments.h"
 #include "printf.h"
 struct linked_list mem_list;
 
 size_t pad(size_t data)
 {
-	if (data % 8 == 0)
-		return data;
-	return ((data >> 3) + 1) << 3;
+	return (data + OS_ALIGNMENT - 1) & ~(size_t)(OS_ALIGNMENT - 1);
 }
 
 void *getpayload(void *chunk)
@@ -26,6 +26,8 @@ struct block_meta *os_memlist_wrap(void *chunk, size_t size, size_t limit)
 		block->status = STATUS_ALLOC;
 
 	block->size = pad(size);
+	block->flags = 0;
+	block->bin_slot = BIN_SLOT_NONE;
 	return block;
 }
 
@@ -55,6 +57,9 @@ void mem_list_init(void)
 	mem_list.tail = NULL;
 	mem_list.heap_allocations = 0;
 	mem_list.mmaps = 0;
+	mem_list.heap_start = NULL;
+	mem_list.heap_last = NULL;
+	mem_list.heap_end = NULL;
 }
 
 size_t os_memlist_get(size_t flag)
@@ -145,51 +150,61 @@ struct block_meta *os_memlist_binsert(struct block_meta *block, int *out_pos)
 	return block;
 }
 
-struct block_meta *os_memlist_insertafter(struct block_meta *block, struct block_meta *before)
+struct block_meta *os_memlist_insert(struct block_meta *block, int *out_pos)
 {
-	if (mem_list.size == 0 || before == NULL) {
-		mem_list.head = block;
-		block->prev = NULL;
-		block->next = NULL;
-		mem_list.tail = block;
-		mem_list.size++;
-		if (mem_list.tail)
-			mem_list.tail->next = NULL;
-		if (mem_list.head)
-			mem_list.head->prev = NULL;
-		return block;
+	if (block->status == STATUS_MAPPED) {
+		mem_list.mmaps++;
+		return __os_memlist_insert(0, block);
 	}
 
-	struct block_meta *found = before;
-	struct block_meta *nxt = found->next;
+	mem_list.heap_allocations++;
+	*out_pos = mem_list.heap_allocations - 1;
+	if (mem_list.heap_start == NULL)
+		mem_list.heap_start = block;
+
+	block->flags = 0;
+	if (mem_list.heap_last && mem_list.heap_last->status == STATUS_FREE) {
+		os_block_set_flags(block, FLAG_PREV_FREE);
+		block->prev = mem_list.heap_last;
+	}
+	mem_list.heap_last = block;
+	mem_list.heap_end = (void *)block + fullsize(block);
+	return block;
+}
 
-	found->next = block;
-	block->prev = found;
-	if (nxt)
-		nxt->prev = block;
-	else
-		mem_list.tail = block;
+struct block_meta *os_memlist_next(struct block_meta *block)
+{
+	struct block_meta *next = (void *)block + fullsize(block);
 
-	block->next = nxt;
-	mem_list.size++;
-	if (mem_list.tail)
-		mem_list.tail->next = NULL;
+#ifndef OSMEM_SEGMENTS
+	/* segments end with a fence block instead */
+	if ((void *)next >= mem_list.heap_end)
+		return NULL;
+#endif
+	return next;
+}
 
-	if (mem_list.head)
-		mem_list.head->prev = NULL;
-	return block;
+struct block_meta *os_memlist_prev(struct block_meta *block)
+{
+	if (!(block->flags & FLAG_PREV_FREE))
+		return NULL;
+	return block->prev;
 }
 
-struct block_meta *os_memlist_insert(struct block_meta *block, int *out_pos)
+void os_memlist_mark(struct block_meta *block, int status)
 {
-	if (block->status == STATUS_MAPPED) {
-		mem_list.mmaps++;
-		return __os_memlist_insert(0, block);
-	}
+	struct block_meta *next = os_memlist_next(block);
 
-	mem_list.heap_allocations++;
-	*out_pos = mem_list.size;
-	return  __os_memlist_insert(mem_list.size, block);
+	block->status = status;
+	if (!next)
+		return;
+
+	if (status == STATUS_FREE) {
+		next->prev = block;
+		os_block_set_flags(next, FLAG_PREV_FREE);
+	} else {
+		os_block_clear_flags(next, FLAG_PREV_FREE);
+	}
 }
 
 
@@ -251,63 +266,60 @@ void *os_memlist_bremove(void *start, int *out_pos, int offset, int flag)
 	return (void *)found;
 }
 
-void showlist(void)
+void os_memlist_walk(void (*visit)(struct block_meta *block, void *arg), void *arg)
 {
-	printf_("List\n");
-}
+	struct block_meta *iter = mem_list.head;
 
+	for (size_t i = 0; i < mem_list.size; ++i, iter = iter->next)
+		visit(iter, arg);
+#ifdef OSMEM_SEGMENTS
+	os_segment_walk(visit, arg);
+#else
+	for (iter = mem_list.heap_start; iter; iter = os_memlist_next(iter))
+		visit(iter, arg);
+#endif
+}
 
-struct block_meta *os_memlist_get_first(int flag, size_t extra_payload_len)
+static void show_block(struct block_meta *block, void *arg)
 {
-	struct block_meta *iter = mem_list.head;
-	size_t min_size = 1e9;
-	struct block_meta *best_block = NULL;
+	static const char * const names[] = {"free", "alloc", "mapped", "cached"};
 
-	for (size_t i = 0; i < mem_list.size; ++i) {
-		if (flag == FREE_BLOCK) {
-			if (iter && iter->status == STATUS_FREE && pad(iter->size) >= pad(extra_payload_len))
-				return iter;
-		}
-
-		if (flag == BEST_FREE_BLOCK) {
-			if (iter && iter->status == STATUS_FREE && pad(iter->size) >= pad(extra_payload_len)) {
-				if (min_size > pad(iter->size)) {
-					min_size = pad(iter->size);
-					best_block = iter;
-				}
-			}
-		}
+	(void)arg;
+	printf_("%p %8zu %s\n", (void *)block, block->size, names[block->status & 3]);
+}
 
-		iter = iter->next;
-	}
-	if (flag == BEST_FREE_BLOCK)
-		return best_block;
-	return NULL;
+void showlist(void)
+{
+	printf_("List\n");
+	os_memlist_walk(show_block, NULL);
 }
 
+
 struct block_meta *__os_memlist_split_nocheck(struct block_meta *block_addr, size_t new_size)
 {
 	if (block_addr->status != STATUS_FREE)
 		return NULL;
 	if (fullsize(block_addr) < predicted(8) + predicted(new_size))
 		return NULL;
+	os_bins_remove(block_addr);
 	void *new_chunk = (void *)(block_addr) + predicted(new_size);
 	struct block_meta *new_block = (struct block_meta *)new_chunk;
 
 	new_block->size = fullsize(block_addr) - METADATA_SIZE - predicted(new_size);
-	new_block->status = STATUS_FREE;
+	new_block->flags = 0;
+	new_block->bin_slot = BIN_SLOT_NONE;
 	block_addr->status = STATUS_ALLOC;
 	block_addr->size = pad(new_size);
-	os_memlist_insertafter(new_block, block_addr);
-	new_block->status = STATUS_FREE;
+	if (mem_list.heap_last == block_addr)
+		mem_list.heap_last = new_block;
+	os_memlist_mark(new_block, STATUS_FREE);
+	os_bins_insert(new_block);
 	return new_block;
 }
 
 struct block_meta *os_memlist_fit(size_t size)
 {
-	if (mem_list.size == 0)
-		return NULL;
-	struct block_meta *fit = os_memlist_get_first(BEST_FREE_BLOCK, size);
+	struct block_meta *fit = os_bins_take(pad(size));
 
 	if (fit == NULL)
 		return NULL;
@@ -315,21 +327,25 @@ struct block_meta *os_memlist_fit(size_t size)
 
 	if (splittedright)
 		os_memlist_coalesce(splittedright, 1, -1);
-	fit->status = STATUS_ALLOC;
+	os_memlist_mark(fit, STATUS_ALLOC);
 	return fit;
 }
 
 void *os_memlist_tryexpand(size_t size)
 {
-	if (mem_list.tail->status != STATUS_FREE
-		|| pad(mem_list.tail->size) >= pad(size))
+	struct block_meta *last = mem_list.heap_last;
+
+	if (last == NULL || last->status != STATUS_FREE
+		|| pad(last->size) >= pad(size))
 		return NULL;
-	void *extra_chunk = sbrk(pad(size) - pad(mem_list.tail->size));
+	void *extra_chunk = sbrk(pad(size) - pad(last->size));
 
 	DIE(extra_chunk == NULL, "Error expanding block on heap");
-	mem_list.tail->status = STATUS_ALLOC;
-	mem_list.tail->size = pad(size);
-	return (void *)mem_list.tail;
+	os_bins_remove(last);
+	last->status = STATUS_ALLOC;
+	last->size = pad(size);
+	mem_list.heap_end = (void *)last + fullsize(last);
+	return (void *)last;
 }
 
 void os_memlist_prealloc(void *chunk)
@@ -338,10 +354,13 @@ void os_memlist_prealloc(void *chunk)
 
 	block->status = STATUS_FREE;
 	block->size = MMAP_THRESHOLD - METADATA_SIZE;
+	block->flags = 0;
+	block->bin_slot = BIN_SLOT_NONE;
 
 	int position;
 
 	os_memlist_insert(block, &position);
+	os_bins_insert(block);
 }
 
 
@@ -416,46 +435,81 @@ struct block_meta *os_memlist_coalesce(struct block_meta *block, int direction,
 		direction = 1;
 
 	if (direction != 1) {
-		while (iter && iter->prev && iter->prev->status == STATUS_FREE)
-			iter = iter->prev;
-	}
+		struct block_meta *prev = os_memlist_prev(iter);
 
-	if (!iter)
-		iter = mem_list.head;
+		while (prev && prev->status == STATUS_FREE) {
+			iter = prev;
+			prev = os_memlist_prev(iter);
+		}
+	}
 
-	struct block_meta *nxt = iter->next;
-	size_t coalesced = 0;
+	struct block_meta *nxt = os_memlist_next(iter);
 
+	os_bins_remove(iter);
 	while (1) {
-		if (iter && target_size > 0 && pad(iter->size) >= pad(target_size))
-			return iter;
+		if (target_size > 0 && pad(iter->size) >= pad(target_size))
+			break;
 		if (!nxt)
-			return iter;
+			break;
 		if (nxt->status != STATUS_FREE)
-			return iter;
+			break;
 
+		os_bins_remove(nxt);
 		iter->size = pad(iter->size) + fullsize(nxt);
-		int removed_position;
-
-		os_memlist_bremove((void *)nxt, &removed_position, 0, OS_MEM_FIND_NOCHECK);
-		coalesced++;
-		nxt = iter->next;
+		if (mem_list.heap_last == nxt)
+			mem_list.heap_last = iter;
+		nxt = os_memlist_next(iter);
 	}
+	os_memlist_mark(iter, STATUS_FREE);
+	os_bins_insert(iter);
+	return iter;
 }
 
 void *os_memlist_refit(struct block_meta *block, size_t new_size)
 {
-	if (block->next == NULL) {
+	if (block == mem_list.heap_last) {
 		block->status = STATUS_FREE;
-		block = os_memlist_tryexpand(new_size);
-		if (!block)
+		if (!os_memlist_tryexpand(new_size)) {
+			block->status = STATUS_ALLOC;
 			return NULL;
+		}
 		block->status = STATUS_ALLOC;
 		return block;
 	}
 	return NULL;
 }
 
+void os_memlist_absorb(struct block_meta *block, size_t size)
+{
+	struct block_meta *nxt = os_memlist_next(block);
+
+	while (block->size < size && nxt && nxt->status == STATUS_FREE) {
+		os_bins_remove(nxt);
+		block->size += fullsize(nxt);
+		if (mem_list.heap_last == nxt)
+			mem_list.heap_last = block;
+		nxt = os_memlist_next(block);
+	}
+	os_memlist_mark(block, block->status);
+}
+
+void os_memlist_shrink(struct block_meta *block, size_t size)
+{
+	if (fullsize(block) < predicted(8) + predicted(size))
+		return;
+
+	struct block_meta *rest = (void *)block + predicted(size);
+
+	rest->size = fullsize(block) - METADATA_SIZE - predicted(size);
+	rest->flags = 0;
+	rest->bin_slot = BIN_SLOT_NONE;
+	rest->status = STATUS_FREE;
+	block->size = pad(size);
+	if (mem_list.heap_last == block)
+		mem_list.heap_last = rest;
+	os_memlist_coalesce(rest, 1, -1);
+}
+
 void *os_memlist_do_the_monster_mash(size_t size)
 {
 	void *chunk = NULL;
@@ -1,9 +1,20 @@
 #pragma once
 // SPDX-License-Identifier: BSD-3-Clause
+#include <stddef.h>
 #include <unistd.h>
 #include "block_meta.h"
 #include "osmem.h"
 
+/*
+ * Payloads are aligned to OS_ALIGNMENT. The base build keeps the 8 bytes
+ * its reference traces were taken with; the variants (-DOSMEM_MAX_ALIGN)
+ * stand in for the libc malloc and so owe alignof(max_align_t).
+ */
+#ifdef OSMEM_MAX_ALIGN
+#define OS_ALIGNMENT		(_Alignof(max_align_t))
+#else
+#define OS_ALIGNMENT		8
+#endif
 #define METADATA_SIZE		(pad(sizeof(struct block_meta)))
 #define MMAP_THRESHOLD		(128 * 1024)
 #define OS_MEM_FIND_NOCHECK 1
@@ -22,13 +33,42 @@ struct linked_list {
 	struct block_meta* tail;
 	size_t heap_allocations;
 	size_t mmaps;
+	struct block_meta* heap_start;
+	struct block_meta* heap_last;
+	void *heap_end;
 };
 typedef struct linked_list linked_list;
 
+/*
+ * The flag bits of a live block are not all guarded by the same lock:
+ * FLAG_PREV_FREE and the owner bits change under the heap lock, the
+ * others under the profiler's or the quarantine's lock, or under none at
+ * all by the thread that holds the block. In the thread-safe build every
+ * change to them is thus one atomic read-modify-write, so that none of
+ * them undoes another.
+ */
+static inline void os_block_set_flags(struct block_meta *block, int bits)
+{
+#ifdef OSMEM_THREAD_SAFE
+	__atomic_fetch_or(&block->flags, bits, __ATOMIC_RELAXED);
+#else
+	block->flags |= bits;
+#endif
+}
+
+static inline void os_block_clear_flags(struct block_meta *block, int bits)
+{
+#ifdef OSMEM_THREAD_SAFE
+	__atomic_fetch_and(&block->flags, ~bits, __ATOMIC_RELAXED);
+#else
+	block->flags &= ~bits;
+#endif
+}
+
 /**
  * @brief Insert a pre-allocated block in the memory list.
  * If the block in STATUS_MAPPED, it is inserted at the front
- * else it is inserted in the back. Speify SEPARATE_MAPPINGS
+ * else it is appended to the heap, right after heap_last. Speify SEPARATE_MAPPINGS
  * to keep blocks separated and unordered (in the case of MAPPED
  * blocks), or #undef it to keep them ordered by their start
  * 
@@ -142,7 +182,33 @@ void *os_memlist_do_the_monster_mash(size_t size);
 struct block_meta* __os_memlist_insert(size_t position, struct block_meta* block);
 
 /**
- * @brief Coalesce list of blocks starting from the given block
+ * @brief Physical successor of a heap block, NULL for the last block
+ *
+ * @param block
+ * @return struct block_meta*
+ */
+struct block_meta *os_memlist_next(struct block_meta *block);
+
+/**
+ * @brief Physical predecessor of a heap block, read from its boundary
+ * tag. Only free predecessors are tagged, NULL is returned otherwise
+ *
+ * @param block
+ * @return struct block_meta*
+ */
+struct block_meta *os_memlist_prev(struct block_meta *block);
+
+/**
+ * @brief Set the status of a heap block and keep the boundary tag of
+ * its successor in sync
+ *
+ * @param block
+ * @param status STATUS_FREE | STATUS_ALLOC
+ */
+void os_memlist_mark(struct block_meta *block, int status);
+
+/**
+ * @brief Coalesce the free heap blocks physically adjacent to the given block
  * If direction == 1, only coalesce the next consecutive free blocks
  * starting from block, including it.
  * If direction == 0, coalesce both left and right and return the block
@@ -174,6 +240,26 @@ struct block_meta* os_memlist_getblockstart(void *payload);
  */
 void *os_memlist_refit(struct block_meta *block, size_t new_size);
 
+/**
+ * @brief Grow an allocated heap block over the free blocks that follow
+ * it, one whole block at a time, until its payload reaches size bytes
+ * or no free neighbour is left. The caller checks the resulting size
+ *
+ * @param block
+ * @param size padded payload size
+ */
+void os_memlist_absorb(struct block_meta *block, size_t size);
+
+/**
+ * @brief Cut an allocated heap block down to size bytes. The tail goes
+ * back to the free bins, merged with a free block that follows, unless
+ * it is too small to hold a block of its own
+ *
+ * @param block
+ * @param size padded payload size
+ */
+void os_memlist_shrink(struct block_meta *block, size_t size);
+
 /**
  * @brief Split block if its size allows it to fit a block of
  * size = new_size
@@ -183,4 +269,17 @@ void *os_memlist_refit(struct block_meta *block, size_t new_size);
  * @return struct block_meta* 
  */
 struct block_meta *__os_memlist_split_nocheck(struct block_meta* block_addr, size_t new_size);
+
+/**
+ * @brief Call visit on every block: the mapped ones first, then the heap
+ * blocks in address order
+ *
+ * @param visit
+ * @param arg passed through to visit
+ */
+void os_memlist_walk(void (*visit)(struct block_meta *block, void *arg), void *arg);
+
+/**
+ * @brief Print every block with its size and status, for debugging
+ */
 void showlist(void);
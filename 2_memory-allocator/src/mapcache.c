@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include "mapcache.h"
+
+#ifdef OSMEM_MAP_CACHE
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "memops.h"
+
+struct cached_map {
+	void *start;
+	size_t length;
+	unsigned long stamp;
+};
+
+static struct cached_map cache[MAP_CACHE_SLOTS];
+static size_t cached_bytes;
+static size_t cache_limit = MAP_CACHE_LIMIT;
+static unsigned long releases;
+
+__attribute__((constructor))
+static void map_cache_init(void)
+{
+	char *limit = getenv("OSMEM_MAP_CACHE_LIMIT");
+
+	if (limit)
+		cache_limit = strtoul(limit, NULL, 10);
+}
+
+static size_t page_round_up(size_t size)
+{
+	size_t page = getpagesize();
+
+	return (size + page - 1) & ~(page - 1);
+}
+
+/* Over-map by one huge page and cut the mapping down to an aligned one. */
+static void *map_huge(size_t length)
+{
+	char *raw = mmap(0, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_ANON, -1, 0);
+
+	if (raw == MAP_FAILED)
+		return NULL;
+
+	char *start = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+
+	if (start > raw)
+		munmap(raw, start - raw);
+	if (start < raw + HUGE_PAGE_SIZE)
+		munmap(start + length, raw + HUGE_PAGE_SIZE - start);
+	madvise(start, length, MADV_HUGEPAGE);
+	return start;
+}
+
+static void evict(size_t slot)
+{
+	munmap(cache[slot].start, cache[slot].length);
+	cached_bytes -= cache[slot].length;
+	cache[slot].start = NULL;
+}
+
+void *os_map_acquire(size_t block_size, size_t *length, int *recycled)
+{
+	size_t wanted = page_round_up(block_size);
+	long best = -1;
+
+	for (size_t slot = 0; slot < MAP_CACHE_SLOTS; ++slot) {
+		size_t cached = cache[slot].length;
+
+		if (cache[slot].start == NULL || cached < wanted || cached - wanted > wanted / 4)
+			continue;
+		if (best < 0 || cached < cache[best].length)
+			best = slot;
+	}
+
+	if (best >= 0) {
+		void *start = cache[best].start;
+
+		*length = cache[best].length;
+		*recycled = 1;
+		cached_bytes -= *length;
+		cache[best].start = NULL;
+		return start;
+	}
+
+	*length = wanted;
+	*recycled = 0;
+	if (wanted >= HUGE_PAGE_SIZE)
+		return map_huge(wanted);
+
+	void *start = mmap(0, wanted, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+
+	return start == MAP_FAILED ? NULL : start;
+}
+
+void os_map_release(void *chunk, size_t length)
+{
+	long slot = -1;
+
+	length = page_round_up(length);
+	if (length > cache_limit) {
+		DIE(munmap(chunk, length) != 0, "Error occured during the munmap syscall");
+		return;
+	}
+
+	/* make room, oldest first */
+	for (;;) {
+		long oldest = -1;
+
+		slot = -1;
+		for (size_t i = 0; i < MAP_CACHE_SLOTS; ++i) {
+			if (cache[i].start == NULL) {
+				slot = i;
+				continue;
+			}
+			if (oldest < 0 || cache[i].stamp < cache[oldest].stamp)
+				oldest = i;
+		}
+		if (slot >= 0 && cached_bytes + length <= cache_limit)
+			break;
+		evict(oldest);
+	}
+
+	cache[slot].start = chunk;
+	cache[slot].length = length;
+	cache[slot].stamp = ++releases;
+	cached_bytes += length;
+}
+
+void os_map_zero(void *payload, size_t size)
+{
+	char *start = payload;
+	char *from = (char *)page_round_up((uintptr_t)start);
+	char *to = (char *)((uintptr_t)(start + size) & ~(uintptr_t)(getpagesize() - 1));
+
+	if (size < HUGE_PAGE_SIZE) {
+		os_memzero(start, size);
+		return;
+	}
+	os_memzero(start, from - start);
+	madvise(from, to - from, MADV_DONTNEED);
+	os_memzero(to, start + size - to);
+}
+
+size_t os_map_cached(void)
+{
+	return cached_bytes;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+// SPDX-License-Identifier: BSD-3-Clause
+#include "block_meta.h"
+
+/*
+ * Large mappings (built with -DOSMEM_MAP_CACHE).
+ *
+ * Mappings of at least HUGE_PAGE_SIZE bytes start on a huge page boundary
+ * and are advised MADV_HUGEPAGE, so their aligned extents can be backed by
+ * transparent huge pages instead of faulting in 4 KiB at a time.
+ *
+ * An unmapped block's mapping is parked in a small cache instead of going
+ * back to the kernel, and a later mapping request that it covers with at
+ * most a quarter to spare takes it over without any syscall. The cache
+ * holds at most MAP_CACHE_SLOTS mappings and MAP_CACHE_LIMIT bytes, or the
+ * byte limit set in OSMEM_MAP_CACHE_LIMIT (0 turns it off); the oldest
+ * mappings are unmapped first to make room.
+ *
+ * A reused mapping is dirty, so the block carved from it is flagged
+ * FLAG_RECYCLED for calloc to zero it. Huge ranges are not written but
+ * dropped with MADV_DONTNEED, so they fault in zeroed like a fresh
+ * mapping would.
+ */
+#define HUGE_PAGE_SIZE		(2 * 1024 * 1024)
+#define MAP_CACHE_SLOTS		16
+#define MAP_CACHE_LIMIT		(64 * 1024 * 1024)
+
+#ifdef OSMEM_MAP_CACHE
+
+/**
+ * @brief Map memory for a block of block_size bytes, reusing a cached
+ * mapping if one fits. Returns NULL if the kernel refuses the mapping
+ *
+ * @param block_size block size including metadata
+ * @param length gets the length of the mapping
+ * @param recycled set if the mapping came from the cache
+ * @return void*
+ */
+void *os_map_acquire(size_t block_size, size_t *length, int *recycled);
+
+/**
+ * @brief Cache a mapping or unmap it, if it does not fit in the cache
+ *
+ * @param chunk
+ * @param length length of the mapping
+ */
+void os_map_release(void *chunk, size_t length);
+
+/**
+ * @brief Zero a payload carved from a recycled mapping
+ *
+ * @param payload
+ * @param size
+ */
+void os_map_zero(void *payload, size_t size);
+
+/**
+ * @brief Bytes currently parked in the cache
+ *
+ * @return size_t
+ */
+size_t os_map_cached(void);
+
+#endif
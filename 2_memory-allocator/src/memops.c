@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <stdint.h>
+#include "memops.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+typedef uint64_t __attribute__((may_alias)) word_t;
+
+static void copy_words(char *dest, const char *src, size_t size)
+{
+	for (; size >= sizeof(word_t); size -= sizeof(word_t)) {
+		*(word_t *)dest = *(const word_t *)src;
+		dest += sizeof(word_t);
+		src += sizeof(word_t);
+	}
+	while (size--)
+		*dest++ = *src++;
+}
+
+static void zero_words(char *dest, size_t size)
+{
+	for (; size >= sizeof(word_t); size -= sizeof(word_t)) {
+		*(word_t *)dest = 0;
+		dest += sizeof(word_t);
+	}
+	while (size--)
+		*dest++ = 0;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse2")))
+static void copy_sse2(char *dest, const char *src, size_t size)
+{
+	for (; size >= 64; size -= 64, dest += 64, src += 64) {
+		__m128i a = _mm_loadu_si128((const __m128i *)src);
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *)(src + 48));
+
+		_mm_storeu_si128((__m128i *)dest, a);
+		_mm_storeu_si128((__m128i *)(dest + 16), b);
+		_mm_storeu_si128((__m128i *)(dest + 32), c);
+		_mm_storeu_si128((__m128i *)(dest + 48), d);
+	}
+	copy_words(dest, src, size);
+}
+
+__attribute__((target("sse2")))
+static void zero_sse2(char *dest, size_t size)
+{
+	__m128i zero = _mm_setzero_si128();
+
+	for (; size >= 64; size -= 64, dest += 64) {
+		_mm_storeu_si128((__m128i *)dest, zero);
+		_mm_storeu_si128((__m128i *)(dest + 16), zero);
+		_mm_storeu_si128((__m128i *)(dest + 32), zero);
+		_mm_storeu_si128((__m128i *)(dest + 48), zero);
+	}
+	zero_words(dest, size);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2(char *dest, const char *src, size_t size)
+{
+	for (; size >= 128; size -= 128, dest += 128, src += 128) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)src);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+		__m256i c = _mm256_loadu_si256((const __m256i *)(src + 64));
+		__m256i d = _mm256_loadu_si256((const __m256i *)(src + 96));
+
+		_mm256_storeu_si256((__m256i *)dest, a);
+		_mm256_storeu_si256((__m256i *)(dest + 32), b);
+		_mm256_storeu_si256((__m256i *)(dest + 64), c);
+		_mm256_storeu_si256((__m256i *)(dest + 96), d);
+	}
+	_mm256_zeroupper();
+	copy_words(dest, src, size);
+}
+
+__attribute__((target("avx2")))
+static void zero_avx2(char *dest, size_t size)
+{
+	__m256i zero = _mm256_setzero_si256();
+
+	for (; size >= 128; size -= 128, dest += 128) {
+		_mm256_storeu_si256((__m256i *)dest, zero);
+		_mm256_storeu_si256((__m256i *)(dest + 32), zero);
+		_mm256_storeu_si256((__m256i *)(dest + 64), zero);
+		_mm256_storeu_si256((__m256i *)(dest + 96), zero);
+	}
+	_mm256_zeroupper();
+	zero_words(dest, size);
+}
+
+#endif
+
+static void copy_select(char *dest, const char *src, size_t size);
+static void zero_select(char *dest, size_t size);
+
+static void (*copy_kernel)(char *dest, const char *src, size_t size) = copy_select;
+static void (*zero_kernel)(char *dest, size_t size) = zero_select;
+
+static void select_kernels(void)
+{
+	void (*copy)(char *dest, const char *src, size_t size) = copy_words;
+	void (*zero)(char *dest, size_t size) = zero_words;
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		copy = copy_avx2;
+		zero = zero_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		copy = copy_sse2;
+		zero = zero_sse2;
+	}
+#endif
+	__atomic_store_n(&copy_kernel, copy, __ATOMIC_RELAXED);
+	__atomic_store_n(&zero_kernel, zero, __ATOMIC_RELAXED);
+}
+
+static void copy_select(char *dest, const char *src, size_t size)
+{
+	select_kernels();
+	copy_kernel(dest, src, size);
+}
+
+static void zero_select(char *dest, size_t size)
+{
+	select_kernels();
+	zero_kernel(dest, size);
+}
+
+void *os_memcpy(void *dest, const void *src, size_t size)
+{
+	__atomic_load_n(&copy_kernel, __ATOMIC_RELAXED)(dest, src, size);
+	return dest;
+}
+
+void *os_memzero(void *dest, size_t size)
+{
+	__atomic_load_n(&zero_kernel, __ATOMIC_RELAXED)(dest, size);
+	return dest;
+}
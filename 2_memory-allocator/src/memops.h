@@ -0,0 +1,28 @@
+#pragma once
+// SPDX-License-Identifier: BSD-3-Clause
+#include <stddef.h>
+
+/*
+ * Copy and zero kernels for payloads. On x86-64 the AVX2 or SSE2 variant
+ * is picked the first time a kernel runs, according to what the CPU
+ * supports. Everywhere else a word-at-a-time loop is used.
+ */
+
+/**
+ * @brief Copy size bytes from src to dest. The ranges must not overlap
+ *
+ * @param dest
+ * @param src
+ * @param size
+ * @return void* dest
+ */
+void *os_memcpy(void *dest, const void *src, size_t size);
+
+/**
+ * @brief Zero size bytes starting at dest
+ *
+ * @param dest
+ * @param size
+ * @return void* dest
+ */
+void *os_memzero(void *dest, size_t size);
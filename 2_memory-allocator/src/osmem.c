@@ -1,10 +1,19 @@
 // SPDX-License-Identifier: BSD-3-Clause
+#define _GNU_SOURCE
 #include <sys/mman.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "osmem.h"
 #include "linked_list.h"
+#include "free_bins.h"
+#include "tcache.h"
+#include "segments.h"
+#include "memops.h"
+#include "profile.h"
+#include "slab.h"
+#include "mapcache.h"
+#include "harden.h"
 #include "printf.h"
 
 void *__os_malloc(size_t size, size_t limit)
@@ -13,13 +22,36 @@ void *__os_malloc(size_t size, size_t limit)
 		return NULL;
 	void *chunk;
 	size_t block_size = METADATA_SIZE + pad(size);
+#ifdef OSMEM_MAP_CACHE
+	size_t map_length = 0;
+	int recycled = 0;
+#endif
 
 	if (block_size >= limit) {
+#ifdef OSMEM_MAP_CACHE
+		/* out of memory is the caller's to handle, as for any malloc */
+		chunk = os_map_acquire(block_size, &map_length, &recycled);
+		if (chunk == NULL)
+			return NULL;
+#else
 		chunk = mmap(0, block_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
 
-		DIE(chunk == NULL, "Error mapping block");
+		DIE(chunk == MAP_FAILED, "Error mapping block");
+#endif
 	} else {
+#ifdef OSMEM_SEGMENTS
+		chunk = os_memlist_do_the_monster_mash(size);
+		if (chunk == NULL) {
+			os_segment_grow(block_size);
+			chunk = os_memlist_do_the_monster_mash(size);
+		}
+		return getpayload(chunk);
+#else
 		if (os_isfirst(OS_HEAP_ALLOCATIONS)) {
+#ifdef OSMEM_MAX_ALIGN
+			/* nothing promises the break starts OS_ALIGNMENT-aligned */
+			sbrk(-(uintptr_t)sbrk(0) & (OS_ALIGNMENT - 1));
+#endif
 			chunk = sbrk(MMAP_THRESHOLD);
 			os_memlist_prealloc(chunk);
 		}
@@ -28,131 +60,521 @@ void *__os_malloc(size_t size, size_t limit)
 		if (chunk == NULL) {
 			chunk = sbrk(block_size);
 		} else {
-			showlist();
 			return getpayload(chunk);
 		}
 		DIE(chunk == NULL, "Error allocating block on heap");
+#endif
 	}
 
 	struct block_meta *block = os_memlist_wrap(chunk, size, limit);
 	int position;
 
+#ifdef OSMEM_MAP_CACHE
+	/* the block spans its whole mapping, which may be a bigger cached one */
+	if (block->status == STATUS_MAPPED) {
+		block->size = map_length - METADATA_SIZE;
+		if (recycled)
+			os_block_set_flags(block, FLAG_RECYCLED);
+	}
+#endif
+
 	os_memlist_insert(block, &position);
 	return getpayload(chunk);
 }
 
-void *os_malloc(size_t size)
+static void *heap_payload(size_t size, size_t limit)
 {
-	if (size == 0)
-		return NULL;
-	return __os_malloc(size, MMAP_THRESHOLD);
+#ifdef OSMEM_THREAD_SAFE
+	void *payload = os_tcache_get(size);
+
+	if (payload)
+		return payload;
+
+	os_heap_lock();
+	payload = __os_malloc(size, limit);
+	os_tcache_own(payload);
+	os_heap_unlock();
+	return payload;
+#else
+	return __os_malloc(size, limit);
+#endif
 }
 
-void os_free(void *ptr)
+static void *malloc_payload(size_t size, size_t limit)
+{
+#ifdef OSMEM_SLAB
+	if (size <= SLAB_MAX_SIZE) {
+		void *object = os_slab_alloc(size);
+
+		if (object)
+			return object;
+	}
+#endif
+	return heap_payload(size, limit);
+}
+
+static void __os_free(void *ptr)
 {
-	if (ptr == NULL)
-		return;
 	void *chunk = ptr - METADATA_SIZE;
 	struct block_meta *block = (struct block_meta *)chunk;
 
-	if (block->status == STATUS_FREE)
+	if (block->status == STATUS_FREE || block->status == STATUS_CACHED)
 		return;
 
+	size_t block_size = METADATA_SIZE + pad(block->size);
+
 	if (block->status == STATUS_MAPPED) {
 		int removed_position;
 		void *removed = os_memlist_bremove(chunk, &removed_position,
 							0, OS_MEM_FIND_NOCHECK);
 
 		DIE((long)removed != (long)chunk, "Tried to free block that was not in the memlist.");
-		long success = munmap(chunk, METADATA_SIZE + pad(block->size));
+#ifdef OSMEM_MAP_CACHE
+		os_map_release(chunk, block_size);
+#else
+		long success = munmap(chunk, block_size);
 
 		DIE(success != 0, "Error occured during the munmap syscall");
+#endif
+#ifdef OSMEM_SEGMENTS
+		os_segment_unmapped(block_size);
+#endif
 	} else {
 		block->status = STATUS_FREE;
+#ifdef OSMEM_SEGMENTS
+		os_segment_release(os_memlist_coalesce(block, 0, -1), block_size);
+#else
 		os_memlist_coalesce(block, 0, -1);
+#endif
 	}
 }
 
-void *os_calloc(size_t nmemb, size_t size)
+/* Payload of the block an aligned pointer was carved from. */
+static void *unalign(void *ptr)
+{
+	struct block_meta *block = os_memlist_getblockstart(ptr);
+
+	if (block->status == STATUS_ALIGNED)
+		return getpayload(block->prev);
+	return ptr;
+}
+
+static void free_payload(void *ptr)
+{
+	OS_PROFILE_FREE(ptr);
+#ifdef OSMEM_REALLOC_GROWTH
+	os_block_clear_flags(os_memlist_getblockstart(ptr), FLAG_GROWN);
+#endif
+#ifdef OSMEM_THREAD_SAFE
+	if (os_tcache_put(ptr))
+		return;
+	os_heap_lock();
+	__os_free(ptr);
+	os_heap_unlock();
+#else
+	__os_free(ptr);
+#endif
+}
+
+#ifdef OSMEM_HARDEN
+/* Guarded slots have no header, so memalign, which writes one, never asks for them. */
+static void *hardened_malloc(size_t size, size_t limit, int guarded)
+{
+	void *payload = guarded ? os_guard_alloc(size) : NULL;
+
+	if (payload == NULL) {
+		payload = heap_payload(size + HARDEN_EXTRA, limit);
+		if (payload == NULL)
+			return NULL;
+		os_harden_seal(payload, size);
+	}
+	return payload;
+}
+
+static void hardened_free(void *ptr)
+{
+	void *evicted[QUARANTINE_BATCH];
+	size_t count;
+
+	if (os_guard_owns(ptr)) {
+		os_guard_free(ptr);
+		return;
+	}
+	ptr = unalign(ptr);
+	os_harden_check(ptr, "free");
+	OS_PROFILE_FREE(ptr);
+	count = os_harden_quarantine(ptr, evicted);
+	for (size_t i = 0; i < count; ++i)
+		free_payload(evicted[i]);
+}
+
+/* What the caller asked for, not what the block holds. */
+static size_t hardened_size(void *ptr, const char *op)
+{
+	void *payload;
+
+	if (os_guard_owns(ptr))
+		return os_guard_size(ptr);
+	payload = unalign(ptr);
+	return os_harden_check(payload, op) - (ptr - payload);
+}
+
+/* Always moves, so a stale pointer to the old block hits the quarantine. */
+static void *hardened_realloc(void *ptr, size_t size)
+{
+	size_t old_size = hardened_size(ptr, "realloc");
+	void *new_ptr = hardened_malloc(size, OS_MMAP_THRESHOLD, 1);
+
+	if (new_ptr == NULL)
+		return NULL;
+	os_memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+	hardened_free(ptr);
+	return new_ptr;
+}
+#endif
+
+void *__os_malloc_at(size_t size, void *site)
+{
+	if (size == 0)
+		return NULL;
+
+	void *payload;
+
+#ifdef OSMEM_HARDEN
+	if (OS_HARDENED())
+		payload = hardened_malloc(size, OS_MMAP_THRESHOLD, 1);
+	else
+#endif
+	payload = malloc_payload(size, OS_MMAP_THRESHOLD);
+	OS_PROFILE_ALLOC(payload, size, site);
+	return payload;
+}
+
+void *os_malloc(size_t size)
+{
+	return __os_malloc_at(size, __builtin_return_address(0));
+}
+
+void os_free(void *ptr)
+{
+	if (ptr == NULL)
+		return;
+#ifdef OSMEM_HARDEN
+	if (OS_HARDENED()) {
+		hardened_free(ptr);
+		return;
+	}
+#endif
+#ifdef OSMEM_SLAB
+	if (os_slab_owns(ptr)) {
+		os_slab_free(ptr);
+		return;
+	}
+#endif
+	free_payload(unalign(ptr));
+}
+
+void *__os_calloc_at(size_t nmemb, size_t size, void *site)
 {
 	if (nmemb * size == 0)
 		return NULL;
-	void *payload = __os_malloc(nmemb * size, getpagesize());
+	void *payload;
+
+#ifdef OSMEM_HARDEN
+	if (OS_HARDENED())
+		payload = hardened_malloc(nmemb * size, getpagesize(), 1);
+	else
+#endif
+	payload = malloc_payload(nmemb * size, getpagesize());
+	if (payload == NULL)
+		return NULL;
 
-	for (size_t i = 0 ; i < nmemb * size; ++i)
-		*(char *)(payload + i) = (char)0;
+	/* a block that was just mapped is made of fresh, zeroed pages */
+#ifdef OSMEM_HARDEN
+	if (os_guard_owns(payload))
+		os_memzero(payload, nmemb * size);
+	else
+#endif
+#ifdef OSMEM_SLAB
+	if (os_slab_owns(payload))
+		os_memzero(payload, nmemb * size);
+	else
+#endif
+#ifdef OSMEM_MAP_CACHE
+	if (os_memlist_getblockstart(payload)->flags & FLAG_RECYCLED)
+		os_map_zero(payload, nmemb * size);
+	else
+#endif
+	if (os_memlist_getblockstart(payload)->status != STATUS_MAPPED)
+		os_memzero(payload, nmemb * size);
+	OS_PROFILE_ALLOC(payload, nmemb * size, site);
 	return payload;
 }
 
-void *os_memcpy(void *dest, void *src, size_t size)
+void *os_calloc(size_t nmemb, size_t size)
 {
-	for (size_t i = 0; i < size; ++i)
-		*((char *)(dest) + i) = *((char *)(src) + i);
-	return dest;
+	return __os_calloc_at(nmemb, size, __builtin_return_address(0));
 }
 
-void *os_realloc(void *ptr, size_t size)
+#ifdef OSMEM_MREMAP
+/* Resize a mapped block that stays mapped, moving it only if the kernel must. */
+static void *mremap_block(struct block_meta *block, size_t size)
 {
-	printf_("Realloc %p %d\n => ", ptr, size);
-	if (size == 0 && ptr != NULL) {
-		os_free(ptr);
+	size_t old_size = METADATA_SIZE + pad(block->size);
+	size_t new_size = METADATA_SIZE + pad(size);
+	int position;
+
+	os_memlist_bremove(block, &position, 0, OS_MEM_FIND_NOCHECK);
+	struct block_meta *moved = mremap(block, old_size, new_size, MREMAP_MAYMOVE);
+
+	if (moved == MAP_FAILED) {
+		os_memlist_insert(block, &position);
 		return NULL;
 	}
+	moved->size = pad(size);
+	os_memlist_insert(moved, &position);
+	return getpayload(moved);
+}
+#endif
+
+#ifdef OSMEM_REALLOC_GROWTH
+/*
+ * A block that realloc already grew once is likely being appended to, so
+ * the next growth reserves half as much again, which keeps append loops
+ * amortized O(1). Such a block also keeps its slack when it shrinks by
+ * less than half, instead of splitting it off and asking for it again.
+ */
+static size_t growth_target(struct block_meta *block, size_t size)
+{
+	size_t geometric = pad(block->size + block->size / 2);
+	int grown = block->flags & FLAG_GROWN;
+
+	if (size <= block->size)
+		return size;
+	os_block_set_flags(block, FLAG_GROWN);
+	if (!grown || geometric <= size)
+		return size;
+	if (METADATA_SIZE + geometric >= OS_MMAP_THRESHOLD)
+		return size;
+	return geometric;
+}
 
-	if (ptr == NULL)
-		return os_malloc(size);
+static int keep_slack(struct block_meta *block, size_t size)
+{
+	return (block->flags & FLAG_GROWN) && size >= block->size / 2;
+}
+#endif
 
+static void *__os_realloc(void *ptr, size_t size)
+{
 	struct block_meta *block = ptr - METADATA_SIZE;
 
 	DIE(!block, "Tried to realloc unallocated start-value");
 
-	if (block->status == STATUS_FREE)
+	if (block->status == STATUS_FREE || block->status == STATUS_CACHED)
 		return NULL;
 
 	if (block->status == STATUS_MAPPED) {
-		void *new_ptr = os_malloc(size);
-
+#ifdef OSMEM_MREMAP
+		if (METADATA_SIZE + pad(size) >= OS_MMAP_THRESHOLD)
+			return mremap_block(block, size);
+#endif
+		void *new_ptr = __os_malloc(size, OS_MMAP_THRESHOLD);
+
+		if (new_ptr == NULL)
+			return NULL;
 		os_memcpy(new_ptr, ptr, pad(block->size) > pad(size) ? pad(size) : pad(block->size));
-		os_free(getpayload(block));
+		__os_free(getpayload(block));
 		return new_ptr;
 	}
 
-	if ((METADATA_SIZE + pad(size) >= MMAP_THRESHOLD)) {
-		void *new_ptr = os_malloc(size);
+	if ((METADATA_SIZE + pad(size) >= OS_MMAP_THRESHOLD)) {
+		void *new_ptr = __os_malloc(size, OS_MMAP_THRESHOLD);
 
+		if (new_ptr == NULL)
+			return NULL;
 		os_memcpy(new_ptr, ptr, pad(block->size) > pad(size) ? pad(size) : pad(block->size));
 		block->status = STATUS_ALLOC;
-		os_free(getpayload(block));
+		__os_free(getpayload(block));
 		return new_ptr;
 	}
 
-	struct block_meta *refit_block = os_memlist_refit(block, pad(size));
+	size_t target = pad(size);
+
+#ifdef OSMEM_REALLOC_GROWTH
+	if (target <= block->size && keep_slack(block, target))
+		return ptr;
+	target = growth_target(block, target);
+#endif
+	if (target > block->size && !os_memlist_refit(block, target)) {
+		os_memlist_absorb(block, target);
+#ifdef OSMEM_REALLOC_GROWTH
+		/* absorbing the free tail made it the last block */
+		os_memlist_refit(block, target);
+#endif
+	}
 
-	if (refit_block) {
-		refit_block->status = STATUS_ALLOC;
-		return getpayload(refit_block);
+	if (block->size >= target) {
+		os_memlist_shrink(block, target);
+		return ptr;
 	}
 
-	block->status = STATUS_FREE;
-	block = os_memlist_coalesce(block, 1, pad(size));
-	if (pad(block->size) >= pad(size)) {
-		block->status = STATUS_FREE;
-		struct block_meta *splitter = __os_memlist_split_nocheck(block, pad(size));
+	void *new_ptr = __os_malloc(target, OS_MMAP_THRESHOLD);
 
-		block->status = STATUS_ALLOC;
-		if (splitter)
-			os_memlist_coalesce(splitter, 1, -1);
-		block->status = STATUS_ALLOC;
-		showlist();
+	if (new_ptr == NULL)
+		return NULL;
+	os_memcpy(new_ptr, ptr, block->size > target ? target : block->size);
+#ifdef OSMEM_REALLOC_GROWTH
+	os_block_clear_flags(block, FLAG_GROWN);
+#endif
+	__os_free(getpayload(block));
+#ifdef OSMEM_REALLOC_GROWTH
+	os_block_set_flags(os_memlist_getblockstart(new_ptr), FLAG_GROWN);
+#endif
+	return new_ptr;
+}
 
-		return getpayload(block);
+void *__os_realloc_at(void *ptr, size_t size, void *site)
+{
+	void *new_ptr;
+
+	if (size == 0 && ptr != NULL) {
+		os_free(ptr);
+		return NULL;
 	}
 
-	block->status = STATUS_ALLOC;
-	void *new_ptr = os_malloc(size);
+	if (ptr == NULL) {
+		if (size == 0)
+			return NULL;
+#ifdef OSMEM_HARDEN
+		if (OS_HARDENED())
+			new_ptr = hardened_malloc(size, OS_MMAP_THRESHOLD, 1);
+		else
+#endif
+		new_ptr = malloc_payload(size, OS_MMAP_THRESHOLD);
+		OS_PROFILE_ALLOC(new_ptr, size, site);
+		return new_ptr;
+	}
 
-	os_memcpy(new_ptr, ptr, pad(block->size) > pad(size) ? pad(size) : pad(block->size));
-	os_free(getpayload(block));
+#ifdef OSMEM_HARDEN
+	if (OS_HARDENED()) {
+		new_ptr = hardened_realloc(ptr, size);
+		OS_PROFILE_ALLOC(new_ptr, size, site);
+		return new_ptr;
+	}
+#endif
+
+#ifdef OSMEM_SLAB
+	if (os_slab_owns(ptr)) {
+		size_t old_size = os_slab_size(ptr);
+
+		if (size <= old_size)
+			return ptr;
+		new_ptr = __os_malloc_at(size, site);
+		if (new_ptr == NULL)
+			return NULL;
+		os_memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+		os_slab_free(ptr);
+		return new_ptr;
+	}
+#endif
+	if (unalign(ptr) != ptr) {
+		size_t old_size = os_usable_size(ptr);
+
+		new_ptr = __os_malloc_at(size, site);
+		if (new_ptr == NULL)
+			return NULL;
+		os_memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+		os_free(ptr);
+		return new_ptr;
+	}
 
+	/*
+	 * The block may move and its header be reused, so it goes without
+	 * FLAG_SAMPLED; the sample itself stays until the resize has worked.
+	 */
+	struct block_meta *block = os_memlist_getblockstart(ptr);
+	int sampled = block->flags & FLAG_SAMPLED;
+
+	if (sampled)
+		os_block_clear_flags(block, FLAG_SAMPLED);
+#ifdef OSMEM_THREAD_SAFE
+	os_heap_lock();
+#endif
+	new_ptr = __os_realloc(ptr, size);
+#ifdef OSMEM_THREAD_SAFE
+	if (new_ptr != NULL && new_ptr != ptr)
+		os_tcache_own(new_ptr);
+#endif
+	/* before the old address can be handed out and sampled again */
+	if (sampled && new_ptr != NULL)
+		os_profile_forget(ptr);
+#ifdef OSMEM_THREAD_SAFE
+	os_heap_unlock();
+#endif
+	if (new_ptr == NULL) {
+		if (sampled)
+			os_block_set_flags(block, FLAG_SAMPLED);
+		return NULL;
+	}
+	OS_PROFILE_ALLOC(new_ptr, size, site);
 	return new_ptr;
 }
+
+void *os_realloc(void *ptr, size_t size)
+{
+	return __os_realloc_at(ptr, size, __builtin_return_address(0));
+}
+
+void *__os_memalign_at(size_t alignment, size_t size, void *site)
+{
+	if (size == 0 || alignment == 0 || (alignment & (alignment - 1)))
+		return NULL;
+	if (alignment <= OS_ALIGNMENT)
+		return __os_malloc_at(size, site);
+
+	/* room for the aligned payload and for the header in front of it */
+	void *payload;
+
+#ifdef OSMEM_HARDEN
+	if (OS_HARDENED())
+		payload = hardened_malloc(size + alignment + METADATA_SIZE, OS_MMAP_THRESHOLD, 0);
+	else
+#endif
+	payload = malloc_payload(size + alignment + METADATA_SIZE, OS_MMAP_THRESHOLD);
+
+	OS_PROFILE_ALLOC(payload, size, site);
+	if (payload == NULL)
+		return NULL;
+	if (((size_t)payload & (alignment - 1)) == 0)
+		return payload;
+
+	void *aligned = (void *)(((size_t)payload + METADATA_SIZE + alignment - 1) & ~(alignment - 1));
+	struct block_meta *header = os_memlist_getblockstart(aligned);
+
+	header->status = STATUS_ALIGNED;
+	header->prev = os_memlist_getblockstart(payload);
+	header->size = header->prev->size - (aligned - payload);
+	header->flags = 0;
+	return aligned;
+}
+
+void *os_memalign(size_t alignment, size_t size)
+{
+	return __os_memalign_at(alignment, size, __builtin_return_address(0));
+}
+
+size_t os_usable_size(void *ptr)
+{
+	if (ptr == NULL)
+		return 0;
+#ifdef OSMEM_HARDEN
+	if (OS_HARDENED())
+		return hardened_size(ptr, "malloc_usable_size");
+#endif
+#ifdef OSMEM_SLAB
+	if (os_slab_owns(ptr))
+		return os_slab_size(ptr);
+#endif
+	return os_memlist_getblockstart(ptr)->size;
+}
@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Standard allocation entry points for libosmem_preload.so, so that any
+ * program can run on osmem with LD_PRELOAD. Built on the thread-safe
+ * variant: real programs have threads and fork.
+ *
+ * Nothing here may end up in libc's allocator, not even while the thread
+ * cache of a new thread is being set up, so every entry point goes
+ * straight to the os_* functions and there is no dlsym lookup of the
+ * symbols being replaced. The profiler is handed the return address of
+ * each entry point, so that samples name the program's call sites and
+ * not this file.
+ *
+ * With OSMEM_TRACE_FILE set in the environment every call is also logged
+ * to that file, one "op size ptr arg" line per call in the format
+ * bench/bench-suite.c replays. Calls are serialized while
+ * tracing so the lines come out in an order the replay can follow.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "osmem.h"
+#include "block_meta.h"
+#include "harden.h"
+#include "mapcache.h"
+#include "profile.h"
+#include "stats.h"
+#include "printf.h"
+
+/*
+ * Anything bigger would wrap around once osmem adds its headers, the
+ * hardened trailer and the huge page a large mapping is aligned with,
+ * and could never be mapped anyway.
+ */
+#define REQUEST_MAX	(PTRDIFF_MAX - (2 * sizeof(struct block_meta) + HARDEN_EXTRA + HUGE_PAGE_SIZE))
+
+static int trace_fd = -1;
+static struct os_print_buffer trace_buffer;
+/* recursive: os_* may reach back into malloc while a thread cache is set up */
+static pthread_mutex_t trace_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+static int trace_begin(void)
+{
+	if (trace_fd < 0)
+		return 0;
+	pthread_mutex_lock(&trace_lock);
+	return 1;
+}
+
+static void trace_end(int tracing, char op, size_t size, void *ptr, uintptr_t arg)
+{
+	if (!tracing)
+		return;
+	if (trace_fd >= 0)
+		fctprintf(os_print_char, &trace_buffer, "%c %zu %lx %lx\n", op, size, (uintptr_t)ptr, arg);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static void trace_fork_prepare(void)
+{
+	pthread_mutex_lock(&trace_lock);
+	os_print_flush(&trace_buffer);
+}
+
+static void trace_fork_parent(void)
+{
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/*
+ * The trace follows the process that was started, not its children. The
+ * lock is reinitialized: a recursive mutex can only be unlocked by the
+ * thread id that took it, and the child runs under a new one.
+ */
+static void trace_fork_child(void)
+{
+	pthread_mutex_t unlocked = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+	close(trace_fd);
+	trace_fd = -1;
+	trace_buffer.used = 0;
+	trace_lock = unlocked;
+}
+
+/* Refuse size + extra bytes the way malloc does when out of memory. */
+static int too_big(size_t size, size_t extra)
+{
+	if (extra <= REQUEST_MAX && size <= REQUEST_MAX - extra)
+		return 0;
+	errno = ENOMEM;
+	return 1;
+}
+
+/* What the os_* functions return, with errno set if it is NULL. */
+static void *checked(void *ptr)
+{
+	if (ptr == NULL)
+		errno = ENOMEM;
+	return ptr;
+}
+
+__attribute__((constructor))
+static void trace_init(void)
+{
+	char *path = getenv("OSMEM_TRACE_FILE");
+
+	if (path == NULL)
+		return;
+	trace_buffer.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (trace_buffer.fd < 0)
+		return;
+	pthread_atfork(trace_fork_prepare, trace_fork_parent, trace_fork_child);
+	trace_fd = trace_buffer.fd;
+}
+
+__attribute__((destructor))
+static void trace_fini(void)
+{
+	if (!trace_begin())
+		return;
+	os_print_flush(&trace_buffer);
+	close(trace_fd);
+	trace_fd = -1;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void *malloc(size_t size)
+{
+	if (too_big(size, 0))
+		return NULL;
+
+	int tracing = trace_begin();
+	/* programs take NULL for an error, even from malloc(0) */
+	void *ptr = checked(__os_malloc_at(size ? size : 1, __builtin_return_address(0)));
+
+	trace_end(tracing, 'm', size, ptr, 0);
+	return ptr;
+}
+
+void free(void *ptr)
+{
+	int tracing = ptr ? trace_begin() : 0;
+
+	os_free(ptr);
+	trace_end(tracing, 'f', 0, ptr, 0);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	size_t total;
+
+	if (__builtin_mul_overflow(nmemb, size, &total)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (too_big(total, 0))
+		return NULL;
+
+	int tracing = trace_begin();
+	void *ptr = checked(__os_calloc_at(1, total ? total : 1, __builtin_return_address(0)));
+
+	trace_end(tracing, 'c', total, ptr, 0);
+	return ptr;
+}
+
+static void *realloc_at(void *ptr, size_t size, void *site)
+{
+	if (too_big(size, 0))
+		return NULL;
+
+	int tracing = trace_begin();
+	void *new_ptr = __os_realloc_at(ptr, ptr == NULL && size == 0 ? 1 : size, site);
+
+	/* realloc(ptr, 0) frees ptr and returns NULL without an error */
+	if (new_ptr == NULL && size != 0)
+		errno = ENOMEM;
+
+	trace_end(tracing, 'r', size, new_ptr, (uintptr_t)ptr);
+	return new_ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	return realloc_at(ptr, size, __builtin_return_address(0));
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+	size_t total;
+
+	if (__builtin_mul_overflow(nmemb, size, &total)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return realloc_at(ptr, total, __builtin_return_address(0));
+}
+
+static void *memalign_at(size_t alignment, size_t size, void *site)
+{
+	if (alignment == 0 || (alignment & (alignment - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (too_big(size, alignment))
+		return NULL;
+
+	int tracing = trace_begin();
+	void *ptr = checked(__os_memalign_at(alignment, size ? size : 1, site));
+
+	trace_end(tracing, 'a', size, ptr, alignment);
+	return ptr;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	return memalign_at(alignment, size, __builtin_return_address(0));
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	if (alignment < sizeof(void *) || (alignment & (alignment - 1)))
+		return EINVAL;
+	if (alignment > REQUEST_MAX || size > REQUEST_MAX - alignment)
+		return ENOMEM;
+
+	int tracing = trace_begin();
+	void *ptr = __os_memalign_at(alignment, size ? size : 1, __builtin_return_address(0));
+
+	trace_end(tracing, 'a', size, ptr, alignment);
+
+	if (ptr == NULL)
+		return ENOMEM;
+	*memptr = ptr;
+	return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign_at(alignment, size, __builtin_return_address(0));
+}
+
+void *valloc(size_t size)
+{
+	return memalign_at(getpagesize(), size, __builtin_return_address(0));
+}
+
+void *pvalloc(size_t size)
+{
+	size_t page = getpagesize();
+
+	if (too_big(size, page))
+		return NULL;
+	return memalign_at(page, (size + page - 1) & ~(page - 1), __builtin_return_address(0));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+	return os_usable_size(ptr);
+}
@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "osmem.h"
+#include "linked_list.h"
+#include "profile.h"
+#include "stats.h"
+#include "slab.h"
+#include "harden.h"
+#include "printf.h"
+
+#ifdef OSMEM_THREAD_SAFE
+#include <pthread.h>
+
+__thread long os_profile_countdown;
+static __thread unsigned int jitter_seed;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+#define profile_lock()		pthread_mutex_lock(&profile_lock)
+#define profile_unlock()	pthread_mutex_unlock(&profile_lock)
+
+/* A child of fork must not inherit the lock another thread was holding. */
+static void fork_prepare(void)
+{
+	profile_lock();
+}
+
+static void fork_done(void)
+{
+	profile_unlock();
+}
+#else
+long os_profile_countdown;
+static unsigned int jitter_seed;
+#define profile_lock()
+#define profile_unlock()
+#endif
+
+struct profile_sample {
+	void *payload;
+	size_t size;
+	uint32_t site;
+};
+
+struct profile_site {
+	void *address;
+	size_t live_count;
+	size_t live_bytes;
+	size_t total_count;
+	size_t total_bytes;
+};
+
+static long sample_rate;
+static char dump_path[256];
+static struct profile_sample *samples;
+static struct profile_site *sites;
+static size_t samples_count;
+static size_t sites_count;
+
+static size_t hash(void *key, size_t capacity)
+{
+	return ((uintptr_t)key * 0x9E3779B97F4A7C15UL) >> (64 - __builtin_ctzl(capacity));
+}
+
+static long next_interval(void)
+{
+	jitter_seed = jitter_seed * 1103515245 + 12345;
+	return sample_rate / 2 + (jitter_seed >> 8) % sample_rate;
+}
+
+static long find_site(void *address)
+{
+	size_t slot = hash(address, PROFILE_SITES_MAX);
+
+	for (; sites[slot].address; slot = (slot + 1) % PROFILE_SITES_MAX)
+		if (sites[slot].address == address)
+			return slot;
+	if (sites_count * 4 >= PROFILE_SITES_MAX * 3)
+		return -1;
+	sites_count++;
+	sites[slot].address = address;
+	return slot;
+}
+
+static long find_sample(void *payload)
+{
+	size_t slot = hash(payload, PROFILE_SAMPLES_MAX);
+
+	for (; samples[slot].payload; slot = (slot + 1) % PROFILE_SAMPLES_MAX)
+		if (samples[slot].payload == payload)
+			return slot;
+	return -1;
+}
+
+/* Linear probing without tombstones: pull later entries of the cluster
+ * back into the hole. */
+static void erase_sample(size_t hole)
+{
+	size_t slot = hole;
+
+	samples[hole].payload = NULL;
+	while (1) {
+		slot = (slot + 1) % PROFILE_SAMPLES_MAX;
+		if (samples[slot].payload == NULL)
+			return;
+
+		size_t home = hash(samples[slot].payload, PROFILE_SAMPLES_MAX);
+
+		if ((slot > hole && (home <= hole || home > slot))
+			|| (slot < hole && home <= hole && home > slot)) {
+			samples[hole] = samples[slot];
+			samples[slot].payload = NULL;
+			hole = slot;
+		}
+	}
+}
+
+void os_profile_sample(void *payload, size_t size, void *site)
+{
+	if (sample_rate == 0) {
+		os_profile_countdown = LONG_MAX;
+		return;
+	}
+	os_profile_countdown = next_interval();
+	if (payload == NULL)
+		return;
+#ifdef OSMEM_SLAB
+	/* slab objects have no header to carry FLAG_SAMPLED */
+	if (os_slab_owns(payload))
+		return;
+#endif
+#ifdef OSMEM_HARDEN
+	/* neither have guarded ones */
+	if (os_guard_owns(payload))
+		return;
+#endif
+
+	profile_lock();
+	long index = find_site(site);
+
+	if (index >= 0 && samples_count * 4 < PROFILE_SAMPLES_MAX * 3) {
+		size_t slot = hash(payload, PROFILE_SAMPLES_MAX);
+
+		while (samples[slot].payload)
+			slot = (slot + 1) % PROFILE_SAMPLES_MAX;
+		samples[slot].payload = payload;
+		samples[slot].size = size;
+		samples[slot].site = index;
+		samples_count++;
+
+		sites[index].live_count++;
+		sites[index].live_bytes += size;
+		sites[index].total_count++;
+		sites[index].total_bytes += size;
+		os_block_set_flags(os_memlist_getblockstart(payload), FLAG_SAMPLED);
+	}
+	profile_unlock();
+}
+
+/* Drop the sample of payload from its site, under profile_lock. */
+static void forget_sample(void *payload)
+{
+	long slot = find_sample(payload);
+
+	if (slot >= 0) {
+		struct profile_site *site = &sites[samples[slot].site];
+
+		site->live_count--;
+		site->live_bytes -= samples[slot].size;
+		erase_sample(slot);
+		samples_count--;
+	}
+}
+
+void os_profile_unsample(void *payload)
+{
+	profile_lock();
+	forget_sample(payload);
+	os_block_clear_flags(os_memlist_getblockstart(payload), FLAG_SAMPLED);
+	profile_unlock();
+}
+
+void os_profile_forget(void *payload)
+{
+	profile_lock();
+	forget_sample(payload);
+	profile_unlock();
+}
+
+static void copy_maps(int fd)
+{
+	char buffer[1024];
+	ssize_t size;
+	int maps = open("/proc/self/maps", O_RDONLY);
+
+	if (maps < 0)
+		return;
+	while ((size = read(maps, buffer, sizeof(buffer))) > 0)
+		if (write(fd, buffer, size) != size)
+			break;
+	close(maps);
+}
+
+/*
+ * Takes no lock, so it can run from the signal handler; a sample taken
+ * concurrently may or may not show up.
+ */
+void os_profile_dump(int fd)
+{
+	struct os_print_buffer buffer = { .fd = fd };
+	size_t live_count = 0, live_bytes = 0, total_count = 0, total_bytes = 0;
+
+	for (size_t i = 0; sites && i < PROFILE_SITES_MAX; ++i) {
+		live_count += sites[i].live_count;
+		live_bytes += sites[i].live_bytes;
+		total_count += sites[i].total_count;
+		total_bytes += sites[i].total_bytes;
+	}
+	fctprintf(os_print_char, &buffer, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%ld\n",
+			  live_count, live_bytes, total_count, total_bytes, sample_rate);
+
+	for (size_t i = 0; sites && i < PROFILE_SITES_MAX; ++i) {
+		struct profile_site *site = &sites[i];
+
+		if (site->address == NULL)
+			continue;
+		fctprintf(os_print_char, &buffer, "%zu: %zu [%zu: %zu] @ 0x%lx\n",
+				  site->live_count, site->live_bytes, site->total_count, site->total_bytes,
+				  (unsigned long)site->address);
+	}
+	fctprintf(os_print_char, &buffer, "\nMAPPED_LIBRARIES:\n");
+	os_print_flush(&buffer);
+	copy_maps(fd);
+}
+
+static void dump_on_signal(int signum)
+{
+	char path[sizeof(dump_path) + 32];
+	int saved_errno = errno;
+
+	(void)signum;
+	if (dump_path[0])
+		snprintf_(path, sizeof(path), "%s", dump_path);
+	else
+		snprintf_(path, sizeof(path), "osmem.%d.heap", (int)getpid());
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd >= 0) {
+		os_profile_dump(fd);
+		close(fd);
+	}
+	errno = saved_errno;
+}
+
+__attribute__((constructor))
+static void profile_init(void)
+{
+	char *rate = getenv("OSMEM_PROFILE_RATE");
+	char *signal_name = getenv("OSMEM_PROFILE_SIGNAL");
+	char *path = getenv("OSMEM_PROFILE_FILE");
+	struct sigaction action;
+
+	if (rate == NULL || strtol(rate, NULL, 10) <= 0)
+		return;
+
+	samples = mmap(0, PROFILE_SAMPLES_MAX * sizeof(*samples), PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANON, -1, 0);
+	sites = mmap(0, PROFILE_SITES_MAX * sizeof(*sites), PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANON, -1, 0);
+	DIE(samples == MAP_FAILED || sites == MAP_FAILED, "Error mapping heap profile");
+
+	if (path)
+		snprintf_(dump_path, sizeof(dump_path), "%s", path);
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = dump_on_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(signal_name ? atoi(signal_name) : SIGUSR2, &action, NULL);
+#ifdef OSMEM_THREAD_SAFE
+	pthread_atfork(fork_prepare, fork_done, fork_done);
+#endif
+
+	jitter_seed = getpid();
+	sample_rate = strtol(rate, NULL, 10);
+}
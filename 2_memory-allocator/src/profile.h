@@ -0,0 +1,71 @@
+#pragma once
+// SPDX-License-Identifier: BSD-3-Clause
+#include "block_meta.h"
+
+/*
+ * Sampling heap profiler (see os_profile_dump in osmem.h).
+ *
+ * The allocation paths only subtract the request size from a countdown;
+ * when it runs out the block is sampled and the countdown is rearmed with
+ * a jittered interval around the configured rate. The countdown starts
+ * at zero, so the first allocation of every thread arms it; while the
+ * profiler is off it is armed with LONG_MAX. A sampled block is flagged
+ * FLAG_SAMPLED, so frees of all other blocks only test a bit in a header
+ * they read anyway.
+ */
+#define PROFILE_SAMPLES_MAX	(1 << 16)
+#define PROFILE_SITES_MAX	4096
+
+#ifdef OSMEM_THREAD_SAFE
+extern __thread long os_profile_countdown;
+#else
+extern long os_profile_countdown;
+#endif
+
+#define OS_PROFILE_ALLOC(payload, size, site)						\
+	do {										\
+		os_profile_countdown -= (long)(size);					\
+		if (__builtin_expect(os_profile_countdown < 0, 0))			\
+			os_profile_sample(payload, size, site);				\
+	} while (0)
+
+#define OS_PROFILE_FREE(payload)							\
+	do {										\
+		if (os_memlist_getblockstart(payload)->flags & FLAG_SAMPLED)		\
+			os_profile_unsample(payload);					\
+	} while (0)
+
+/*
+ * The allocation functions behind os_malloc, os_calloc, os_realloc and
+ * os_memalign, taking the call site to charge a sample to. The os_*
+ * functions pass their own return address; wrappers such as the preload
+ * entry points pass the one of their caller instead.
+ */
+void *__os_malloc_at(size_t size, void *site);
+void *__os_calloc_at(size_t nmemb, size_t size, void *site);
+void *__os_realloc_at(void *ptr, size_t size, void *site);
+void *__os_memalign_at(size_t alignment, size_t size, void *site);
+
+/**
+ * @brief Record a sampled allocation and rearm the countdown
+ *
+ * @param payload may be NULL, then only the countdown is rearmed
+ * @param size requested size
+ * @param site return address of the allocation call
+ */
+void os_profile_sample(void *payload, size_t size, void *site);
+
+/**
+ * @brief Forget the sample of a block that is being freed or resized
+ *
+ * @param payload
+ */
+void os_profile_unsample(void *payload);
+
+/**
+ * @brief Forget the sample of a block that has been resized, without
+ * touching its header, which may be gone by now
+ *
+ * @param payload
+ */
+void os_profile_forget(void *payload);
@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include "segments.h"
+
+#ifdef OSMEM_SEGMENTS
+#include <sys/mman.h>
+#include <unistd.h>
+#include "linked_list.h"
+#include "free_bins.h"
+
+#define SEGMENT_HEADER_SIZE	(pad(sizeof(struct heap_segment)))
+
+size_t os_mmap_threshold = MMAP_THRESHOLD;
+static size_t trim_threshold = TRIM_THRESHOLD;
+static size_t freed_since_purge;
+static struct heap_segment *segments;
+
+static size_t page_round_up(size_t size)
+{
+	size_t page = getpagesize();
+
+	return (size + page - 1) & ~(page - 1);
+}
+
+static struct block_meta *segment_first(struct heap_segment *segment)
+{
+	return (void *)segment + SEGMENT_HEADER_SIZE;
+}
+
+static struct heap_segment *block_segment(struct block_meta *block)
+{
+	return (void *)block - SEGMENT_HEADER_SIZE;
+}
+
+static int is_fence(struct block_meta *block)
+{
+	return block->size == 0 && block->status == STATUS_ALLOC;
+}
+
+static int segment_empty(struct heap_segment *segment)
+{
+	struct block_meta *first = segment_first(segment);
+
+	return first->status == STATUS_FREE && is_fence(os_memlist_next(first));
+}
+
+void os_segment_grow(size_t block_size)
+{
+	size_t size = page_round_up(SEGMENT_HEADER_SIZE + block_size + METADATA_SIZE);
+
+	if (size < SEGMENT_SIZE)
+		size = SEGMENT_SIZE;
+
+	struct heap_segment *segment = mmap(0, size, PROT_READ | PROT_WRITE,
+										MAP_PRIVATE | MAP_ANON, -1, 0);
+
+	DIE(segment == MAP_FAILED, "Error mapping heap segment");
+	segment->size = size;
+	segment->prev = NULL;
+	segment->next = segments;
+	if (segments)
+		segments->prev = segment;
+	segments = segment;
+
+	struct block_meta *first = segment_first(segment);
+	struct block_meta *fence = (void *)segment + size - METADATA_SIZE;
+
+	fence->size = 0;
+	fence->status = STATUS_ALLOC;
+	fence->flags = 0;
+	fence->bin_slot = BIN_SLOT_NONE;
+
+	first->size = size - SEGMENT_HEADER_SIZE - 2 * METADATA_SIZE;
+	first->flags = FLAG_SEG_FIRST;
+	first->bin_slot = BIN_SLOT_NONE;
+	os_memlist_mark(first, STATUS_FREE);
+	os_bins_insert(first);
+	/* fresh pages, nothing to give back yet */
+	os_block_set_flags(first, FLAG_PURGED);
+}
+
+static void segment_unmap(struct heap_segment *segment)
+{
+	os_bins_remove(segment_first(segment));
+	if (segment->prev)
+		segment->prev->next = segment->next;
+	else
+		segments = segment->next;
+	if (segment->next)
+		segment->next->prev = segment->prev;
+
+	int success = munmap(segment, segment->size);
+
+	DIE(success != 0, "Error unmapping heap segment");
+}
+
+/*
+ * Give the whole pages inside a free block back, its header stays. The
+ * block stays FLAG_PURGED until it leaves the bins, so later passes only
+ * pay for the blocks freed since.
+ */
+static void purge_block(struct block_meta *block)
+{
+	size_t page = getpagesize();
+	size_t start = page_round_up((size_t)getpayload(block));
+	size_t end = ((size_t)block + METADATA_SIZE + block->size) & ~(page - 1);
+
+	if (block->flags & FLAG_PURGED)
+		return;
+	if (start < end)
+		madvise((void *)start, end - start, MADV_DONTNEED);
+	os_block_set_flags(block, FLAG_PURGED);
+}
+
+void os_segment_release(struct block_meta *block, size_t freed)
+{
+	if ((block->flags & FLAG_SEG_FIRST) && is_fence(os_memlist_next(block))) {
+		struct heap_segment *empty = block_segment(block);
+
+		for (struct heap_segment *iter = segments; iter; iter = iter->next) {
+			if (iter != empty && segment_empty(iter)) {
+				segment_unmap(empty);
+				return;
+			}
+		}
+	}
+
+	freed_since_purge += freed;
+	if (freed_since_purge < trim_threshold)
+		return;
+	freed_since_purge = 0;
+	os_bins_walk(trim_threshold, purge_block);
+}
+
+void os_segment_walk(void (*visit)(struct block_meta *block, void *arg), void *arg)
+{
+	for (struct heap_segment *segment = segments; segment; segment = segment->next) {
+		struct block_meta *block = segment_first(segment);
+
+		for (; !is_fence(block); block = os_memlist_next(block))
+			visit(block, arg);
+	}
+}
+
+void os_segment_unmapped(size_t block_size)
+{
+	if (block_size <= os_mmap_threshold || block_size > MMAP_THRESHOLD_MAX)
+		return;
+	/* blocks of the size just unmapped now stay on the heap */
+	os_mmap_threshold = page_round_up(block_size + 1);
+	trim_threshold = 2 * os_mmap_threshold;
+}
+
+#endif
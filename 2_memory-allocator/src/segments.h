@@ -0,0 +1,78 @@
+#pragma once
+// SPDX-License-Identifier: BSD-3-Clause
+#include "block_meta.h"
+
+/*
+ * Segmented heap (built with -DOSMEM_SEGMENTS, see libosmem_seg.so).
+ *
+ * Instead of one sbrk'd heap the heap blocks live in mmap'd segments of at
+ * least SEGMENT_SIZE bytes. Each segment starts with a struct heap_segment,
+ * then its blocks back to back, and ends with a fence: a zero-sized
+ * allocated block_meta that stops coalescing at the segment border. The
+ * first block of a segment is flagged FLAG_SEG_FIRST, so a free block that
+ * is both first and followed by the fence spans its whole segment.
+ *
+ * Memory goes back to the kernel two ways. A segment that empties is
+ * unmapped, except for one spare kept against map/unmap ping-pong. Free
+ * runs of at least the trim threshold are purged with MADV_DONTNEED once
+ * that many bytes have been freed since the last purge.
+ *
+ * The mmap threshold adapts like glibc's: freeing a mapped block bigger
+ * than the current threshold (up to MMAP_THRESHOLD_MAX) raises it to that
+ * size, and the trim threshold to twice that.
+ */
+#define SEGMENT_SIZE		(1024 * 1024)
+#define MMAP_THRESHOLD_MAX	(32 * 1024 * 1024)
+#define TRIM_THRESHOLD		(128 * 1024)
+
+struct heap_segment {
+	struct heap_segment *prev;
+	struct heap_segment *next;
+	size_t size;
+	size_t reserved;
+};
+
+#ifdef OSMEM_SEGMENTS
+
+extern size_t os_mmap_threshold;
+#define OS_MMAP_THRESHOLD	(os_mmap_threshold)
+
+/**
+ * @brief Map a new segment big enough for a block of block_size bytes
+ * and put its single free block in the bins
+ *
+ * @param block_size block size including metadata
+ */
+void os_segment_grow(size_t block_size);
+
+/**
+ * @brief Called on every heap block freed to the central heap, after
+ * coalescing. Unmaps the block's segment if it is now empty, purges
+ * large free runs once enough memory has been freed
+ *
+ * @param block the coalesced free block
+ * @param freed bytes the free released
+ */
+void os_segment_release(struct block_meta *block, size_t freed);
+
+/**
+ * @brief Adapt the mmap and trim thresholds to a mapped block that is
+ * being unmapped
+ *
+ * @param block_size block size including metadata
+ */
+void os_segment_unmapped(size_t block_size);
+
+/**
+ * @brief Call visit on the blocks of every segment, fences excluded
+ *
+ * @param visit
+ * @param arg passed through to visit
+ */
+void os_segment_walk(void (*visit)(struct block_meta *block, void *arg), void *arg);
+
+#else
+
+#define OS_MMAP_THRESHOLD	MMAP_THRESHOLD
+
+#endif
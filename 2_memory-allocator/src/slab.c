@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include "slab.h"
+
+#ifdef OSMEM_SLAB
+#include <sys/mman.h>
+#include "block_meta.h"
+#include "linked_list.h"
+
+#define SLAB_HEADER_SIZE	((sizeof(struct slab) + SLAB_STEP - 1) & ~(size_t)(SLAB_STEP - 1))
+
+#ifdef OSMEM_THREAD_SAFE
+#include <pthread.h>
+
+static pthread_mutex_t class_locks[SLAB_CLASSES] = {
+	[0 ... SLAB_CLASSES - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+static pthread_mutex_t region_lock = PTHREAD_MUTEX_INITIALIZER;
+#define class_lock(class)	pthread_mutex_lock(&class_locks[class])
+#define class_unlock(class)	pthread_mutex_unlock(&class_locks[class])
+#define region_lock()		pthread_mutex_lock(&region_lock)
+#define region_unlock()		pthread_mutex_unlock(&region_lock)
+
+/*
+ * A child of fork must not inherit a lock another thread was holding.
+ * A class lock is taken before the region lock, never the other way.
+ */
+static void fork_prepare(void)
+{
+	for (size_t class = 0; class < SLAB_CLASSES; ++class)
+		class_lock(class);
+	region_lock();
+}
+
+static void fork_done(void)
+{
+	region_unlock();
+	for (size_t class = 0; class < SLAB_CLASSES; ++class)
+		class_unlock(class);
+}
+
+__attribute__((constructor))
+static void slab_init(void)
+{
+	pthread_atfork(fork_prepare, fork_done, fork_done);
+}
+#else
+#define class_lock(class)
+#define class_unlock(class)
+#define region_lock()
+#define region_unlock()
+#endif
+
+static char *region_start;
+static char *region_end;
+static char *region_top;
+static struct slab *pool;
+static struct slab *partial[SLAB_CLASSES];
+static size_t slabs_in_use;
+
+static struct slab *slab_of(void *ptr)
+{
+	return (struct slab *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static char *slot(struct slab *slab, size_t index)
+{
+	return (char *)slab + SLAB_HEADER_SIZE + index * slab->object_size;
+}
+
+static void list_push(struct slab **head, struct slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = *head;
+	if (*head)
+		(*head)->prev = slab;
+	*head = slab;
+}
+
+static void list_unlink(struct slab **head, struct slab *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		*head = slab->next;
+	if (slab->next)
+		slab->next->prev = slab->prev;
+}
+
+/* Take a slab from the pool or from the untouched part of the region. */
+static struct slab *slab_new(size_t class)
+{
+	struct slab *slab = NULL;
+
+	region_lock();
+	if (region_start == NULL) {
+		region_start = mmap(0, SLAB_REGION_SIZE, PROT_READ | PROT_WRITE,
+							MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+		DIE(region_start == MAP_FAILED, "Error reserving slab region");
+		region_top = region_start;
+		region_end = region_start + SLAB_REGION_SIZE;
+	}
+	if (pool) {
+		slab = pool;
+		pool = slab->next;
+	} else if (region_top < region_end) {
+		slab = (struct slab *)region_top;
+		region_top += SLAB_SIZE;
+	}
+	if (slab)
+		slabs_in_use++;
+	region_unlock();
+
+	if (slab == NULL)
+		return NULL;
+
+	slab->object_size = (class + 1) * SLAB_STEP;
+	slab->capacity = (SLAB_SIZE - SLAB_HEADER_SIZE) / slab->object_size;
+	slab->free_count = slab->capacity;
+	slab->class = class;
+	for (size_t word = 0; word < SLAB_MAP_WORDS; ++word) {
+		size_t first = word * 64;
+
+		if (first + 64 <= slab->capacity)
+			slab->free_map[word] = ~0UL;
+		else if (first < slab->capacity)
+			slab->free_map[word] = (1UL << (slab->capacity - first)) - 1;
+		else
+			slab->free_map[word] = 0;
+	}
+	return slab;
+}
+
+static void slab_release(struct slab *slab)
+{
+	region_lock();
+	slab->next = pool;
+	pool = slab;
+	slabs_in_use--;
+	region_unlock();
+}
+
+void *os_slab_alloc(size_t size)
+{
+	size_t class = (size - 1) / SLAB_STEP;
+	struct slab *slab;
+	void *object;
+
+	class_lock(class);
+	slab = partial[class];
+	if (slab == NULL) {
+		slab = slab_new(class);
+		if (slab == NULL) {
+			class_unlock(class);
+			return NULL;
+		}
+		list_push(&partial[class], slab);
+	}
+
+	size_t word = 0;
+
+	while (slab->free_map[word] == 0)
+		word++;
+
+	size_t bit = __builtin_ctzl(slab->free_map[word]);
+
+	slab->free_map[word] &= ~(1UL << bit);
+	object = slot(slab, word * 64 + bit);
+	if (--slab->free_count == 0)
+		list_unlink(&partial[class], slab);
+	class_unlock(class);
+	return object;
+}
+
+void os_slab_free(void *ptr)
+{
+	struct slab *slab = slab_of(ptr);
+	size_t class = slab->class;
+
+	class_lock(class);
+	size_t index = ((char *)ptr - slot(slab, 0)) / slab->object_size;
+	uint64_t mask = 1UL << (index & 63);
+
+	if (slab->free_map[index >> 6] & mask) {
+		class_unlock(class);
+		return;
+	}
+	slab->free_map[index >> 6] |= mask;
+	if (slab->free_count++ == 0)
+		list_push(&partial[class], slab);
+
+	if (slab->free_count == slab->capacity
+		&& (partial[class] != slab || slab->next != NULL)) {
+		list_unlink(&partial[class], slab);
+		class_unlock(class);
+		slab_release(slab);
+		return;
+	}
+	class_unlock(class);
+}
+
+int os_slab_owns(void *ptr)
+{
+	return (char *)ptr >= region_start && (char *)ptr < region_end;
+}
+
+size_t os_slab_size(void *ptr)
+{
+	return slab_of(ptr)->object_size;
+}
+
+void os_slab_usage(size_t *slabs, size_t *objects)
+{
+	size_t used = 0;
+
+	region_lock();
+	*slabs = slabs_in_use;
+	for (char *iter = region_start; iter && iter < region_top; iter += SLAB_SIZE) {
+		struct slab *slab = (struct slab *)iter;
+
+		used += slab->capacity - slab->free_count;
+	}
+	region_unlock();
+	*objects = used;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+// SPDX-License-Identifier: BSD-3-Clause
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Slab tier for small objects (built with -DOSMEM_SLAB).
+ *
+ * Requests of up to SLAB_MAX_SIZE bytes are served from SLAB_SIZE slabs,
+ * one size class per multiple of SLAB_STEP bytes, so that every slot is
+ * aligned to alignof(max_align_t). A slab is a struct slab header
+ * followed by equal slots without any block_meta; the header keeps a
+ * bitmap of the free slots. All slabs are carved from one reserved
+ * region, so a pointer belongs to the slab tier iff it falls inside that
+ * region, and its slab is found by rounding it down to SLAB_SIZE.
+ *
+ * Every class keeps a list of the slabs with free slots. A slab that
+ * empties goes back to a common pool, unless it is the last one of its
+ * class.
+ */
+#define SLAB_SIZE		4096
+#define SLAB_MAX_SIZE		64
+#define SLAB_STEP		16
+#define SLAB_CLASSES		(SLAB_MAX_SIZE / SLAB_STEP)
+#define SLAB_MAP_WORDS		8
+#define SLAB_REGION_SIZE	(1UL << 30)
+
+struct slab {
+	struct slab *prev;
+	struct slab *next;
+	uint32_t object_size;
+	uint32_t capacity;
+	uint32_t free_count;
+	uint32_t class;
+	uint64_t free_map[SLAB_MAP_WORDS];
+};
+
+#ifdef OSMEM_SLAB
+
+/**
+ * @brief Allocate a slot for an object of up to SLAB_MAX_SIZE bytes.
+ * Returns NULL if the slab region is exhausted
+ *
+ * @param size
+ * @return void*
+ */
+void *os_slab_alloc(size_t size);
+
+/**
+ * @brief Release a slot. Freeing a slot twice is ignored
+ *
+ * @param ptr
+ */
+void os_slab_free(void *ptr);
+
+/**
+ * @brief Check whether a pointer was handed out by the slab tier
+ *
+ * @param ptr
+ * @return int
+ */
+int os_slab_owns(void *ptr);
+
+/**
+ * @brief Slot size of the slab holding ptr
+ *
+ * @param ptr
+ * @return size_t
+ */
+size_t os_slab_size(void *ptr);
+
+/**
+ * @brief Count the slabs in use and the objects they hold
+ *
+ * @param slabs
+ * @param objects
+ */
+void os_slab_usage(size_t *slabs, size_t *objects);
+
+#endif
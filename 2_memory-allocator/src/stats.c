@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <string.h>
+#include <unistd.h>
+#include "osmem.h"
+#include "linked_list.h"
+#include "free_bins.h"
+#include "tcache.h"
+#include "slab.h"
+#include "mapcache.h"
+#include "stats.h"
+#include "printf.h"
+
+static size_t size_class(size_t size)
+{
+	size_t class = size < 8 ? 0 : 63 - __builtin_clzl(size) - 3;
+
+	return class < OS_STATS_CLASSES ? class : OS_STATS_CLASSES - 1;
+}
+
+static void count_block(struct block_meta *block, void *arg)
+{
+	struct os_stats *stats = arg;
+
+	switch (block->status) {
+	case STATUS_MAPPED:
+		stats->mapped_blocks++;
+		stats->mapped_bytes += METADATA_SIZE + block->size;
+		stats->size_classes[size_class(block->size)]++;
+		return;
+	case STATUS_FREE:
+		stats->free_blocks++;
+		stats->heap_free += block->size;
+		if (block->size > stats->largest_free)
+			stats->largest_free = block->size;
+		break;
+	case STATUS_CACHED:
+		stats->cached_blocks++;
+		stats->heap_cached += block->size;
+		break;
+	default:
+		stats->used_blocks++;
+		stats->heap_in_use += block->size;
+		stats->size_classes[size_class(block->size)]++;
+		break;
+	}
+	stats->heap_size += METADATA_SIZE + block->size;
+}
+
+void os_stats_get(struct os_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+#ifdef OSMEM_THREAD_SAFE
+	os_heap_lock();
+#endif
+	os_memlist_walk(count_block, stats);
+	stats->heap_allocations = os_memlist_get(OS_HEAP_ALLOCATIONS);
+	stats->mmaps = os_memlist_get(OS_MMAPS);
+	os_bins_searches(stats->fit_searches);
+#ifdef OSMEM_MAP_CACHE
+	stats->map_cache_bytes = os_map_cached();
+#endif
+#ifdef OSMEM_THREAD_SAFE
+	os_heap_unlock();
+#endif
+#ifdef OSMEM_SLAB
+	os_slab_usage(&stats->slab_pages, &stats->slab_objects);
+#endif
+	if (stats->heap_free)
+		stats->fragmentation = 1.0 - (double)stats->largest_free / stats->heap_free;
+}
+
+void os_print_flush(struct os_print_buffer *buffer)
+{
+	size_t done = 0;
+
+	while (done < buffer->used) {
+		ssize_t written = write(buffer->fd, buffer->data + done, buffer->used - done);
+
+		if (written <= 0)
+			break;
+		done += written;
+	}
+	buffer->used = 0;
+}
+
+void os_print_char(char character, void *arg)
+{
+	struct os_print_buffer *buffer = arg;
+
+	if (buffer->used == sizeof(buffer->data))
+		os_print_flush(buffer);
+	buffer->data[buffer->used++] = character;
+}
+
+void os_stats_print(int fd)
+{
+	struct os_print_buffer buffer = { .fd = fd };
+	struct os_stats stats;
+
+	os_stats_get(&stats);
+	fctprintf(os_print_char, &buffer, "heap         %zu bytes\n", stats.heap_size);
+	fctprintf(os_print_char, &buffer, "  in use     %zu bytes in %zu blocks\n", stats.heap_in_use, stats.used_blocks);
+	fctprintf(os_print_char, &buffer, "  free       %zu bytes in %zu blocks, largest %zu\n",
+			  stats.heap_free, stats.free_blocks, stats.largest_free);
+	fctprintf(os_print_char, &buffer, "  cached     %zu bytes in %zu blocks\n", stats.heap_cached, stats.cached_blocks);
+	fctprintf(os_print_char, &buffer, "  fragmented %.3f\n", stats.fragmentation);
+	fctprintf(os_print_char, &buffer, "mapped       %zu bytes in %zu blocks\n", stats.mapped_bytes, stats.mapped_blocks);
+	if (stats.map_cache_bytes)
+		fctprintf(os_print_char, &buffer, "  cached     %zu bytes of mappings\n", stats.map_cache_bytes);
+	fctprintf(os_print_char, &buffer, "carved       %zu heap blocks, %zu mappings\n", stats.heap_allocations, stats.mmaps);
+	if (stats.slab_pages)
+		fctprintf(os_print_char, &buffer, "slabs        %zu pages, %zu objects\n", stats.slab_pages, stats.slab_objects);
+
+	fctprintf(os_print_char, &buffer, "live blocks by size\n");
+	for (size_t class = 0; class < OS_STATS_CLASSES; ++class)
+		if (stats.size_classes[class])
+			fctprintf(os_print_char, &buffer, "  %10zu+ %zu\n", (size_t)8 << class, stats.size_classes[class]);
+
+	fctprintf(os_print_char, &buffer, "fit searches by blocks inspected\n");
+	for (size_t bucket = 0; bucket < OS_STATS_FIT_BUCKETS; ++bucket)
+		if (stats.fit_searches[bucket])
+			fctprintf(os_print_char, &buffer, "  %10zu+ %zu\n",
+					  bucket ? (size_t)1 << (bucket - 1) : 0, stats.fit_searches[bucket]);
+	os_print_flush(&buffer);
+}
@@ -0,0 +1,28 @@
+#pragma once
+// SPDX-License-Identifier: BSD-3-Clause
+#include <stddef.h>
+
+/*
+ * Buffered output for fctprintf: printf_ issues one write per character.
+ * Only write(2) is used, so the dumps stay usable from a signal handler.
+ */
+struct os_print_buffer {
+	int fd;
+	size_t used;
+	char data[512];
+};
+
+/**
+ * @brief fctprintf output callback, arg is a struct os_print_buffer
+ *
+ * @param character
+ * @param arg
+ */
+void os_print_char(char character, void *arg);
+
+/**
+ * @brief Write out whatever is buffered
+ *
+ * @param buffer
+ */
+void os_print_flush(struct os_print_buffer *buffer);
@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include "tcache.h"
+
+#ifdef OSMEM_THREAD_SAFE
+#include <pthread.h>
+#include <sys/mman.h>
+#include "linked_list.h"
+#include "free_bins.h"
+
+struct tcache {
+	struct block_meta *bins[TCACHE_CLASSES];
+	unsigned int counts[TCACHE_CLASSES];
+	struct block_meta *remote;
+	int id;
+	int in_use;
+};
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+static struct tcache *tcaches[TCACHE_MAX_THREADS];
+static int tcaches_count;
+
+static __thread struct tcache *self;
+static __thread int self_disabled;
+
+void os_heap_lock(void)
+{
+	pthread_mutex_lock(&heap_lock);
+}
+
+void os_heap_unlock(void)
+{
+	pthread_mutex_unlock(&heap_lock);
+}
+
+static struct block_meta *payload_block(void *payload)
+{
+	return os_memlist_getblockstart(payload);
+}
+
+static size_t tcache_class(size_t size)
+{
+	return (pad(size) >> 3) - 1;
+}
+
+static int block_owner(struct block_meta *block)
+{
+	return __atomic_load_n(&block->flags, __ATOMIC_RELAXED) >> TCACHE_OWNER_SHIFT;
+}
+
+static void set_status(struct block_meta *block, int status)
+{
+	__atomic_store_n(&block->status, status, __ATOMIC_RELAXED);
+}
+
+/* Give a cached block back to the central heap. Heap lock held. */
+static void release_block(struct block_meta *block)
+{
+	block->bin_slot = BIN_SLOT_NONE;
+	block->status = STATUS_FREE;
+	os_memlist_coalesce(block, 0, -1);
+}
+
+static void flush_chain(struct block_meta *chain)
+{
+	if (chain == NULL)
+		return;
+
+	os_heap_lock();
+	while (chain) {
+		struct block_meta *next = chain->next;
+
+		release_block(chain);
+		chain = next;
+	}
+	os_heap_unlock();
+}
+
+static void cache_push(struct tcache *cache, struct block_meta *block)
+{
+	size_t class = tcache_class(block->size);
+
+	block->next = cache->bins[class];
+	cache->bins[class] = block;
+	cache->counts[class]++;
+}
+
+static int cache_accepts(struct tcache *cache, struct block_meta *block)
+{
+	return block->size <= TCACHE_MAX_SIZE
+		&& cache->counts[tcache_class(block->size)] < TCACHE_FILL;
+}
+
+/* Move the blocks other threads freed into the cache, spill the rest. */
+static void drain_remote(struct tcache *cache)
+{
+	struct block_meta *chain, *spill = NULL;
+
+	if (__atomic_load_n(&cache->remote, __ATOMIC_RELAXED) == NULL)
+		return;
+
+	chain = __atomic_exchange_n(&cache->remote, NULL, __ATOMIC_ACQUIRE);
+	while (chain) {
+		struct block_meta *next = chain->next;
+
+		if (cache_accepts(cache, chain)) {
+			cache_push(cache, chain);
+		} else {
+			chain->next = spill;
+			spill = chain;
+		}
+		chain = next;
+	}
+	flush_chain(spill);
+}
+
+static void tcache_exit(void *arg)
+{
+	struct tcache *cache = arg;
+	struct block_meta *chain = NULL;
+
+	drain_remote(cache);
+	for (size_t class = 0; class < TCACHE_CLASSES; ++class) {
+		while (cache->bins[class]) {
+			struct block_meta *block = cache->bins[class];
+
+			cache->bins[class] = block->next;
+			block->next = chain;
+			chain = block;
+		}
+		cache->counts[class] = 0;
+	}
+	flush_chain(chain);
+
+	pthread_mutex_lock(&registry_lock);
+	cache->in_use = 0;
+	pthread_mutex_unlock(&registry_lock);
+	self = NULL;
+}
+
+/* A child of fork must not inherit a lock another thread was holding. */
+static void fork_prepare(void)
+{
+	pthread_mutex_lock(&registry_lock);
+	os_heap_lock();
+}
+
+static void fork_done(void)
+{
+	os_heap_unlock();
+	pthread_mutex_unlock(&registry_lock);
+}
+
+static void tcache_init_key(void)
+{
+	pthread_key_create(&tcache_key, tcache_exit);
+	pthread_atfork(fork_prepare, fork_done, fork_done);
+}
+
+static struct tcache *tcache_self(void)
+{
+	struct tcache *cache = NULL;
+
+	if (self || self_disabled)
+		return self;
+
+	pthread_once(&tcache_once, tcache_init_key);
+	pthread_mutex_lock(&registry_lock);
+	for (int i = 0; i < tcaches_count; ++i) {
+		if (!tcaches[i]->in_use) {
+			cache = tcaches[i];
+			break;
+		}
+	}
+	if (cache == NULL && tcaches_count < TCACHE_MAX_THREADS) {
+		cache = mmap(0, sizeof(*cache), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+		DIE(cache == MAP_FAILED, "Error mapping thread cache");
+		cache->id = tcaches_count + 1;
+		tcaches[tcaches_count++] = cache;
+	}
+	if (cache)
+		cache->in_use = 1;
+	pthread_mutex_unlock(&registry_lock);
+
+	if (cache == NULL) {
+		self_disabled = 1;
+		return NULL;
+	}
+	/* pthread_setspecific may allocate, which must find the cache set */
+	self = cache;
+	pthread_setspecific(tcache_key, cache);
+	return self;
+}
+
+void *os_tcache_get(size_t size)
+{
+	struct tcache *cache;
+
+	if (pad(size) > TCACHE_MAX_SIZE)
+		return NULL;
+	cache = tcache_self();
+	if (cache == NULL)
+		return NULL;
+
+	size_t class = tcache_class(size);
+
+	if (cache->bins[class] == NULL)
+		drain_remote(cache);
+
+	struct block_meta *block = cache->bins[class];
+
+	if (block == NULL)
+		return NULL;
+	cache->bins[class] = block->next;
+	cache->counts[class]--;
+	block->bin_slot = BIN_SLOT_NONE;
+	set_status(block, STATUS_ALLOC);
+	return getpayload(block);
+}
+
+int os_tcache_put(void *payload)
+{
+	struct block_meta *block = payload_block(payload);
+	struct tcache *cache, *owner;
+	int owner_id;
+
+	if (block->status != STATUS_ALLOC || block->size > TCACHE_MAX_SIZE)
+		return 0;
+	owner_id = block_owner(block);
+	if (owner_id == 0)
+		return 0;
+
+	cache = tcache_self();
+	owner = tcaches[owner_id - 1];
+	set_status(block, STATUS_CACHED);
+
+	if (owner == cache) {
+		if (!cache_accepts(cache, block)) {
+			set_status(block, STATUS_ALLOC);
+			return 0;
+		}
+		cache_push(cache, block);
+		return 1;
+	}
+
+	struct block_meta *head = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+
+	do {
+		block->next = head;
+	} while (!__atomic_compare_exchange_n(&owner->remote, &head, block, 1,
+										  __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	return 1;
+}
+
+void os_tcache_own(void *payload)
+{
+	struct block_meta *block;
+	struct tcache *cache;
+
+	if (payload == NULL)
+		return;
+	block = payload_block(payload);
+	if (block->status != STATUS_ALLOC)
+		return;
+
+	cache = self;
+	os_block_clear_flags(block, ~((1 << TCACHE_OWNER_SHIFT) - 1));
+	if (cache)
+		os_block_set_flags(block, cache->id << TCACHE_OWNER_SHIFT);
+}
+
+#endif
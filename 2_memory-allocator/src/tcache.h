@@ -0,0 +1,66 @@
+#pragma once
+// SPDX-License-Identifier: BSD-3-Clause
+#include "block_meta.h"
+
+/*
+ * Thread-safe mode (built with -DOSMEM_THREAD_SAFE, see libosmem_mt.so).
+ *
+ * The heap, the free bins and the mapping list are guarded by one central
+ * lock. In front of it every thread keeps a cache of recently freed heap
+ * blocks, one LIFO per size class of 8 bytes up to TCACHE_MAX_SIZE, that it
+ * serves without locking. Cached blocks stay STATUS_CACHED for the central
+ * heap, so they are never coalesced under the owner's feet.
+ *
+ * Each heap block handed out by the central heap remembers the cache of the
+ * thread that allocated it in the upper bits of flags. A block freed by any
+ * other thread is pushed on the owner's lock-free remote-free stack, which
+ * the owner drains into its cache when it misses. Caches of exited threads
+ * are flushed and later adopted by new threads, so a remote free never
+ * lands in released memory.
+ */
+#define TCACHE_MAX_SIZE		1024
+#define TCACHE_CLASSES		(TCACHE_MAX_SIZE / 8)
+#define TCACHE_FILL		32
+#define TCACHE_MAX_THREADS	4096
+#define TCACHE_OWNER_SHIFT	8
+
+#ifdef OSMEM_THREAD_SAFE
+
+/**
+ * @brief Take the central heap lock
+ */
+void os_heap_lock(void);
+
+/**
+ * @brief Release the central heap lock
+ */
+void os_heap_unlock(void);
+
+/**
+ * @brief Pop a cached block of the given size from the calling thread's
+ * cache, without locking. Returns NULL on a miss
+ *
+ * @param size requested payload size
+ * @return void* payload
+ */
+void *os_tcache_get(size_t size);
+
+/**
+ * @brief Hand a freed payload to the cache of its owner: the calling
+ * thread's own cache or the owner's remote-free stack. Returns 0 if the
+ * block has to go back to the central heap instead
+ *
+ * @param payload
+ * @return int
+ */
+int os_tcache_put(void *payload);
+
+/**
+ * @brief Record the calling thread as the owner of a block the central
+ * heap just handed out. Must be called with the heap lock held
+ *
+ * @param payload
+ */
+void os_tcache_own(void *payload);
+
+#endif
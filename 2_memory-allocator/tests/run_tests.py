@@ -50,6 +50,11 @@ TESTS = {
     "test-all": 5,
 }
 
+# Not graded: interfaces beyond the assignment
+EXTRA_TESTS = {
+    "test-arena": 0,
+}
+
 
 class UnfinishedCall(Exception):
     def __init__(self, *args: object) -> None:
@@ -153,6 +158,10 @@ class LtraceParser:
         "os_calloc",
         "os_realloc",
         "os_free",
+        "os_arena_create",
+        "os_arena_alloc",
+        "os_arena_reset",
+        "os_arena_destroy",
         "brk",
         "mmap",
         "munmap",
@@ -473,7 +482,12 @@ def main():
         if test.grade(verbose, diff, memcheck):
             total += score
 
-    print("\nTotal:" + " " * 59 + f" {total}/100")
+    print("\nTotal:" + " " * 59 + f" {total}/100\n")
+
+    for test_name, score in EXTRA_TESTS.items():
+        test = Test(test_name, score)
+        test.run()
+        test.grade(verbose, diff, memcheck)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include "test-utils.h"
+
+#define ARENA_CHUNK		4096
+#define NUM_OBJECTS		64
+
+int main(void)
+{
+	struct os_arena *arena;
+	void *objects[NUM_OBJECTS];
+	void *first, *second, *big;
+	int i;
+
+	arena = os_arena_create(ARENA_CHUNK);
+	FAIL(arena == NULL, "DBG: os_arena_create returned NULL");
+
+	/* Test objects bumped back to back */
+	first = os_arena_alloc(arena, 10);
+	second = os_arena_alloc(arena, 100);
+	FAIL(first == NULL || second != first + 16, "DBG: os_arena_alloc did not bump the cursor");
+	taint(first, 10);
+	taint(second, 100);
+
+	/* Test filling the first chunk, which moves on to a new one */
+	for (i = 0; i < NUM_OBJECTS; i++) {
+		objects[i] = os_arena_alloc(arena, 100);
+		FAIL(objects[i] == NULL, "DBG: os_arena_alloc returned NULL on valid size");
+	}
+
+	/* Test an object bigger than a chunk */
+	big = os_arena_alloc(arena, 3 * ARENA_CHUNK);
+	FAIL(big == NULL, "DBG: os_arena_alloc returned NULL on an oversized object");
+	taint(big, 3 * ARENA_CHUNK);
+
+	/* Test sizes that would wrap around */
+	FAIL(os_arena_alloc(arena, SIZE_MAX) != NULL, "DBG: os_arena_alloc accepted SIZE_MAX bytes");
+	FAIL(os_arena_alloc(arena, SIZE_MAX - 8) != NULL, "DBG: os_arena_alloc accepted SIZE_MAX - 8 bytes");
+	FAIL(os_arena_alloc(arena, 0) != NULL, "DBG: os_arena_alloc returned memory for 0 bytes");
+
+	/* Test reset, which reuses the chunks in the same order */
+	os_arena_reset(arena);
+	FAIL(os_arena_alloc(arena, 10) != first, "DBG: os_arena_reset did not rewind the first chunk");
+	FAIL(os_arena_alloc(arena, 100) != second, "DBG: os_arena_reset did not rewind the first chunk");
+	for (i = 0; i < NUM_OBJECTS; i++)
+		FAIL(os_arena_alloc(arena, 100) != objects[i], "DBG: os_arena_reset did not reuse a chunk");
+	FAIL(os_arena_alloc(arena, 3 * ARENA_CHUNK) != big, "DBG: os_arena_reset did not reuse a chunk");
+
+	/* Cleanup */
+	os_arena_destroy(arena);
+
+	return 0;
+}
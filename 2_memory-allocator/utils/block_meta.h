@@ -15,15 +15,39 @@
 		}												\
 	} while (0)
 
-/* Structure to hold memory block metadata */
+/*
+ * Structure to hold memory block metadata.
+ * Mapped blocks are chained through prev/next. Heap blocks are laid out
+ * back to back, so their successor is found by pointer arithmetic; prev
+ * is their boundary tag (the start of the physically preceding block, only
+ * valid while FLAG_PREV_FREE is set) and a free heap block stores its
+ * position in its free bin where the next link would be.
+ * An aligned payload that does not start right after its block's header
+ * gets a STATUS_ALIGNED header of its own, whose prev points to the block.
+ */
 struct block_meta {
 	size_t size;
 	int status;
+	int flags;
 	struct block_meta *prev;
-	struct block_meta *next;
+	union {
+		struct block_meta *next;
+		long bin_slot;
+	};
 };
 
 /* Block metadata status values */
 #define STATUS_FREE   0
 #define STATUS_ALLOC  1
 #define STATUS_MAPPED 2
+#define STATUS_CACHED 3
+#define STATUS_ALIGNED 4
+
+/* Block metadata flag bits */
+#define FLAG_PREV_FREE	(1 << 0)
+#define FLAG_SEG_FIRST	(1 << 1)
+#define FLAG_SAMPLED	(1 << 2)
+#define FLAG_GROWN	(1 << 3)
+#define FLAG_RECYCLED	(1 << 4)
+#define FLAG_QUARANTINED	(1 << 5)
+#define FLAG_PURGED	(1 << 6)
@@ -11,3 +11,73 @@ void *os_malloc(size_t size);
 void os_free(void *ptr);
 void *os_calloc(size_t nmemb, size_t size);
 void *os_realloc(void *ptr, size_t size);
+void *os_memalign(size_t alignment, size_t size);
+size_t os_usable_size(void *ptr);
+
+/*
+ * Arenas: objects with a common lifetime are bump-allocated out of big
+ * chunks and released all at once. Individual objects are never freed,
+ * os_arena_reset drops all of them in O(1) and keeps the chunks for
+ * reuse, os_arena_destroy gives the chunks back to the allocator.
+ * An arena must not be shared between threads without locking.
+ */
+#define OS_ARENA_CHUNK_SIZE	(64 * 1024)
+
+struct os_arena;
+
+struct os_arena *os_arena_create(size_t chunk_size);
+void *os_arena_alloc(struct os_arena *arena, size_t size);
+void os_arena_reset(struct os_arena *arena);
+void os_arena_destroy(struct os_arena *arena);
+
+/*
+ * Statistics. os_stats_get walks the heap and the mapped blocks, so it
+ * costs O(blocks) and nothing on the allocation paths; only the fit
+ * search histogram is kept up to date as the allocator runs.
+ * Payload sizes fall in power-of-two classes: class c holds the blocks
+ * of [2^(c+3), 2^(c+4)) bytes, the first and last class are open-ended.
+ */
+#define OS_STATS_CLASSES	24
+#define OS_STATS_FIT_BUCKETS	16
+
+struct os_stats {
+	size_t heap_size;		/* heap bytes, metadata included */
+	size_t heap_in_use;		/* payload bytes of allocated heap blocks */
+	size_t heap_free;		/* payload bytes of free heap blocks */
+	size_t heap_cached;		/* payload bytes parked in thread caches */
+	size_t largest_free;		/* payload bytes of the biggest free block */
+	size_t used_blocks;
+	size_t free_blocks;
+	size_t cached_blocks;
+	size_t mapped_blocks;
+	size_t mapped_bytes;		/* metadata included */
+	size_t map_cache_bytes;		/* unmapped blocks' mappings kept for reuse */
+	size_t heap_allocations;	/* heap blocks ever carved from new memory */
+	size_t mmaps;			/* blocks ever mapped */
+	double fragmentation;		/* 1 - largest_free / heap_free */
+	size_t slab_pages;		/* slabs holding small objects */
+	size_t slab_objects;		/* live objects in them */
+	size_t size_classes[OS_STATS_CLASSES];	/* live blocks per size class */
+	/* fit searches by blocks inspected: 0, 1, 2-3, 4-7, ... */
+	size_t fit_searches[OS_STATS_FIT_BUCKETS];
+};
+
+void os_stats_get(struct os_stats *stats);
+void os_stats_print(int fd);
+
+/*
+ * Sampling heap profiler, off unless OSMEM_PROFILE_RATE is set in the
+ * environment to the mean number of allocated bytes between two samples.
+ * Each sample remembers the caller of os_malloc/os_calloc/os_realloc
+ * until the block is freed. The live samples are dumped in the legacy
+ * gperftools text format on OSMEM_PROFILE_SIGNAL (SIGUSR2 by default)
+ * to OSMEM_PROFILE_FILE (osmem.<pid>.heap by default), or on demand.
+ */
+void os_profile_dump(int fd);
+
+/*
+ * Hardened mode, off unless OSMEM_HARDEN=1 is set in the environment:
+ * header checksums, tail canaries and a quarantine of freed blocks, plus
+ * one allocation in OSMEM_GUARD_RATE placed between guard pages. Heap
+ * corruption aborts with a report on stderr. Not in the default build.
+ */
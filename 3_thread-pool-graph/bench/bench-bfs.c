@@ -0,0 +1,232 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Reachable-sum traversals of a graph on one pool:
+ *
+ *   tasks      one task per node, claimed with a CAS on visited, the way
+ *              parallel.c used to walk the graph
+ *   top-down   bfs_levels() forced top-down at every level
+ *   bottom-up  bfs_levels() forced bottom-up at every level
+ *   adaptive   bfs_levels() switching direction by frontier size
+ *
+ * on the graph files given (the tests/in inputs, or binary ones), or on an RMAT
+ * graph (a = 0.57, b = c = 0.19) of 2^scale nodes and edge_factor edges
+ * per node when there are none. Every traversal is checked against the
+ * sum the first one found; times are the best of the repeats.
+ *
+ * Usage: bench-bfs [-t threads] [-s scale] [-e edge_factor] [-r repeats] [graph...]
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "os_bfs.h"
+#include "os_graph.h"
+#include "os_threadpool.h"
+#include "log/log.h"
+#include "utils.h"
+
+static os_threadpool_t *tp;
+static os_graph_t *graph;
+static os_task_group_t group;
+static _Atomic unsigned int *levels;
+static struct {
+	long long sum;
+} __attribute__((aligned(64))) *partial_sums;
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double next_uniform(unsigned long long *seed)
+{
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (*seed >> 11) * (1.0 / (1ULL << 53));
+}
+
+static os_graph_t *generate_rmat(unsigned int scale, unsigned int edge_factor)
+{
+	unsigned long long seed = 42;
+	unsigned int num_nodes = 1u << scale;
+	unsigned int num_edges = num_nodes * edge_factor;
+	os_edge_t *edges = malloc(num_edges * sizeof(*edges));
+	int *values = malloc(num_nodes * sizeof(*values));
+	os_graph_t *rmat;
+
+	DIE(edges == NULL || values == NULL, "malloc");
+	for (unsigned int i = 0; i < num_nodes; ++i)
+		values[i] = next_uniform(&seed) * 100;
+	for (unsigned int i = 0; i < num_edges; ++i) {
+		unsigned int src = 0, dst = 0;
+
+		for (unsigned int bit = 0; bit < scale; ++bit) {
+			double p = next_uniform(&seed);
+
+			src = src << 1 | (p >= 0.57 + 0.19);
+			dst = dst << 1 | ((p >= 0.57 && p < 0.57 + 0.19) || p >= 0.57 + 0.19 + 0.19);
+		}
+		edges[i].src = src;
+		edges[i].dst = dst;
+	}
+	rmat = create_graph_from_data(num_nodes, num_edges, values, edges);
+	free(values);
+	free(edges);
+	return rmat;
+}
+
+static void task_action(void *arg)
+{
+	unsigned int idx = (unsigned long)arg;
+	unsigned int *neighbours = graph_neighbours(graph, idx);
+
+	for (unsigned int i = 0; i < graph_degree(graph, idx); ++i) {
+		os_visit_t expected = NOT_VISITED;
+		unsigned long next = neighbours[i];
+
+		if (atomic_load_explicit(&graph->visited[next], memory_order_relaxed) == NOT_VISITED
+		    && atomic_compare_exchange_strong(&graph->visited[next], &expected, PROCESSING))
+			tg_enqueue(&group, create_task(task_action, (void *)next, NULL));
+	}
+	partial_sums[threadpool_worker_id(tp)].sum += graph->info[idx];
+}
+
+static long long run_tasks(void)
+{
+	long long sum = 0;
+
+	for (unsigned int i = 0; i < graph->num_nodes; ++i)
+		atomic_init(&graph->visited[i], NOT_VISITED);
+	for (unsigned int i = 0; i < tp->num_threads; ++i)
+		partial_sums[i].sum = 0;
+	atomic_store(&graph->visited[0], PROCESSING);
+	tg_enqueue(&group, create_task(task_action, (void *)0, NULL));
+	tg_wait(&group);
+	for (unsigned int i = 0; i < tp->num_threads; ++i)
+		sum += partial_sums[i].sum;
+	return sum;
+}
+
+static void sum_reached(long begin, long end, void *acc, void *ctx)
+{
+	long long *sum = acc;
+
+	(void)ctx;
+	for (long i = begin; i < end; ++i)
+		if (atomic_load_explicit(&levels[i], memory_order_relaxed) != BFS_UNREACHED)
+			*sum += graph->info[i];
+}
+
+static void add_sums(void *acc, const void *other, void *ctx)
+{
+	(void)ctx;
+	*(long long *)acc += *(const long long *)other;
+}
+
+static long long run_bfs(os_bfs_mode_t mode)
+{
+	long long sum = 0;
+
+	bfs_levels(tp, graph, 0, levels, mode, NULL);
+	os_parallel_reduce(tp, 0, graph->num_nodes, 0, sum_reached, add_sums,
+			   &sum, sizeof(sum), NULL);
+	return sum;
+}
+
+static void bench_graph(const char *name, int repeats)
+{
+	static const char * const names[] = { "tasks", "top-down", "bottom-up", "adaptive" };
+	static const os_bfs_mode_t modes[] = { 0, BFS_TOP_DOWN, BFS_BOTTOM_UP, BFS_ADAPTIVE };
+	os_bfs_stats_t stats;
+	long long expected = 0;
+	double best[4];
+
+	levels = malloc(graph->num_nodes * sizeof(*levels));
+	DIE(graph->num_nodes && levels == NULL, "malloc");
+	for (int m = 0; m < 4; ++m) {
+		best[m] = 1e30;
+		for (int r = 0; r < repeats; ++r) {
+			double start = now_s();
+			long long sum = m == 0 ? run_tasks() : run_bfs(modes[m]);
+			double t = now_s() - start;
+
+			if (m == 0 && r == 0)
+				expected = sum;
+			DIE(sum != expected, "traversal sum mismatch");
+			if (t < best[m])
+				best[m] = t;
+		}
+	}
+	bfs_levels(tp, graph, 0, levels, BFS_ADAPTIVE, &stats);
+	free(levels);
+
+	printf("%s: %u nodes, %u edges, %u reached in %u levels (%u top-down, %u bottom-up)\n",
+	       name, graph->num_nodes, graph->num_edges, stats.reached, stats.levels,
+	       stats.top_down_steps, stats.bottom_up_steps);
+	for (int m = 0; m < 4; ++m)
+		printf("  %-10s %10.3f ms (x%6.2f)\n", names[m], best[m] * 1e3, best[0] / best[m]);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int threads = 4, scale = 20, edge_factor = 16;
+	int repeats = 5, opt;
+
+	while ((opt = getopt(argc, argv, "t:s:e:r:")) != -1) {
+		switch (opt) {
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 's':
+			scale = atoi(optarg);
+			break;
+		case 'e':
+			edge_factor = atoi(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t threads] [-s scale] [-e edge_factor] [-r repeats] [graph...]\n",
+				argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	log_set_quiet(true);
+	tp = create_threadpool(threads);
+	tg_init(&group, tp);
+	partial_sums = aligned_alloc(64, threads * sizeof(*partial_sums));
+	DIE(partial_sums == NULL, "aligned_alloc");
+	printf("%u threads, %ld online cpus\n", threads, sysconf(_SC_NPROCESSORS_ONLN));
+
+	if (optind == argc) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "rmat-%u-%u", scale, edge_factor);
+		graph = generate_rmat(scale, edge_factor);
+		bench_graph(name, repeats);
+		destroy_graph(graph);
+	}
+	for (int i = optind; i < argc; ++i) {
+		FILE *file = fopen(argv[i], "r");
+
+		DIE(file == NULL, "fopen");
+		graph = create_graph_from_file(file);
+		DIE(graph == NULL, "create_graph_from_file");
+		fclose(file);
+		bench_graph(argv[i], repeats);
+		destroy_graph(graph);
+	}
+
+	tg_destroy(&group);
+	wait_for_completion(tp);
+	destroy_threadpool(tp);
+	return 0;
+}
@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Connected components with the info sum of each, on one pool:
+ *
+ *   serial    a depth-first walk from every node not yet seen, in id order,
+ *             the way serial -c does it
+ *   afforest  cc_labels() and cc_sums(), the way parallel -c does it
+ *
+ * on the graph files given, or on an RMAT graph (a = 0.57, b = c = 0.19)
+ * of 2^scale nodes and edge_factor edges per node when there are none.
+ * The labels and sums of both are checked against each other; times are
+ * the best of the repeats.
+ *
+ * Usage: bench-cc [-t threads] [-s scale] [-e edge_factor] [-r repeats] [graph...]
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "os_cc.h"
+#include "os_graph.h"
+#include "os_threadpool.h"
+#include "log/log.h"
+#include "utils.h"
+
+static os_threadpool_t *tp;
+static os_graph_t *graph;
+static unsigned int *serial_comp, *stack;
+static long long *serial_sums;
+static _Atomic unsigned int *comp;
+static _Atomic long long *sums;
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double next_uniform(unsigned long long *seed)
+{
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (*seed >> 11) * (1.0 / (1ULL << 53));
+}
+
+static os_graph_t *generate_rmat(unsigned int scale, unsigned int edge_factor)
+{
+	unsigned long long seed = 42;
+	unsigned int num_nodes = 1u << scale;
+	unsigned int num_edges = num_nodes * edge_factor;
+	os_edge_t *edges = malloc(num_edges * sizeof(*edges));
+	int *values = malloc(num_nodes * sizeof(*values));
+	os_graph_t *rmat;
+
+	DIE(edges == NULL || values == NULL, "malloc");
+	for (unsigned int i = 0; i < num_nodes; ++i)
+		values[i] = next_uniform(&seed) * 100;
+	for (unsigned int i = 0; i < num_edges; ++i) {
+		unsigned int src = 0, dst = 0;
+
+		for (unsigned int bit = 0; bit < scale; ++bit) {
+			double p = next_uniform(&seed);
+
+			src = src << 1 | (p >= 0.57 + 0.19);
+			dst = dst << 1 | ((p >= 0.57 && p < 0.57 + 0.19) || p >= 0.57 + 0.19 + 0.19);
+		}
+		edges[i].src = src;
+		edges[i].dst = dst;
+	}
+	rmat = create_graph_from_data(num_nodes, num_edges, values, edges);
+	free(values);
+	free(edges);
+	return rmat;
+}
+
+static unsigned int run_serial(void)
+{
+	unsigned int count = 0;
+
+	for (unsigned int i = 0; i < graph->num_nodes; ++i)
+		serial_comp[i] = ~0u;
+	for (unsigned int root = 0; root < graph->num_nodes; ++root) {
+		unsigned int top = 0;
+
+		if (serial_comp[root] != ~0u)
+			continue;
+		count++;
+		serial_sums[root] = 0;
+		serial_comp[root] = root;
+		stack[top++] = root;
+		while (top > 0) {
+			unsigned int node = stack[--top];
+			unsigned int *neighbours = graph_neighbours(graph, node);
+
+			serial_sums[root] += graph->info[node];
+			for (unsigned int i = 0; i < graph_degree(graph, node); ++i) {
+				if (serial_comp[neighbours[i]] == ~0u) {
+					serial_comp[neighbours[i]] = root;
+					stack[top++] = neighbours[i];
+				}
+			}
+		}
+	}
+	return count;
+}
+
+static unsigned int run_afforest(void)
+{
+	unsigned int count = cc_labels(tp, graph, comp);
+
+	cc_sums(tp, graph, comp, sums);
+	return count;
+}
+
+static void check(void)
+{
+	for (unsigned int i = 0; i < graph->num_nodes; ++i) {
+		DIE(comp[i] != serial_comp[i], "component label mismatch");
+		DIE(comp[i] == i && sums[i] != serial_sums[i], "component sum mismatch");
+	}
+}
+
+static void bench_graph(const char *name, int repeats)
+{
+	double best[2] = { 1e30, 1e30 };
+	unsigned int count[2] = { 0, 0 }, largest = 0, *sizes;
+
+	serial_comp = malloc(graph->num_nodes * sizeof(*serial_comp));
+	stack = malloc(graph->num_nodes * sizeof(*stack));
+	serial_sums = malloc(graph->num_nodes * sizeof(*serial_sums));
+	comp = malloc(graph->num_nodes * sizeof(*comp));
+	sums = malloc(graph->num_nodes * sizeof(*sums));
+	sizes = calloc(graph->num_nodes, sizeof(*sizes));
+	DIE(graph->num_nodes && (serial_comp == NULL || stack == NULL || serial_sums == NULL ||
+				 comp == NULL || sums == NULL || sizes == NULL), "malloc");
+
+	for (int r = 0; r < repeats; ++r) {
+		for (int m = 0; m < 2; ++m) {
+			double start = now_s();
+			double t;
+
+			count[m] = m == 0 ? run_serial() : run_afforest();
+			t = now_s() - start;
+			if (t < best[m])
+				best[m] = t;
+		}
+		DIE(count[0] != count[1], "component count mismatch");
+		check();
+	}
+	for (unsigned int i = 0; i < graph->num_nodes; ++i)
+		if (++sizes[serial_comp[i]] > largest)
+			largest = sizes[serial_comp[i]];
+
+	printf("%s: %u nodes, %u edges, %u components, the largest of %u nodes\n",
+	       name, graph->num_nodes, graph->num_edges, count[0], largest);
+	printf("  %-10s %10.3f ms\n", "serial", best[0] * 1e3);
+	printf("  %-10s %10.3f ms (x%6.2f)\n", "afforest", best[1] * 1e3, best[0] / best[1]);
+
+	free(sizes);
+	free(sums);
+	free(comp);
+	free(serial_sums);
+	free(stack);
+	free(serial_comp);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int threads = 4, scale = 20, edge_factor = 16;
+	int repeats = 5, opt;
+
+	while ((opt = getopt(argc, argv, "t:s:e:r:")) != -1) {
+		switch (opt) {
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 's':
+			scale = atoi(optarg);
+			break;
+		case 'e':
+			edge_factor = atoi(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t threads] [-s scale] [-e edge_factor] [-r repeats] [graph...]\n",
+				argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	log_set_quiet(true);
+	tp = create_threadpool(threads);
+	printf("%u threads, %ld online cpus\n", threads, sysconf(_SC_NPROCESSORS_ONLN));
+
+	if (optind == argc) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "rmat-%u-%u", scale, edge_factor);
+		graph = generate_rmat(scale, edge_factor);
+		bench_graph(name, repeats);
+		destroy_graph(graph);
+	}
+	for (int i = optind; i < argc; ++i) {
+		FILE *file = fopen(argv[i], "r");
+
+		DIE(file == NULL, "fopen");
+		graph = create_graph_from_file(file);
+		DIE(graph == NULL, "create_graph_from_file");
+		fclose(file);
+		bench_graph(argv[i], repeats);
+		destroy_graph(graph);
+	}
+
+	wait_for_completion(tp);
+	destroy_threadpool(tp);
+	return 0;
+}
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * A build-graph workload: layers of nodes, each depending on a few random
+ * nodes of the layer before, each hashing its dependencies' results for a
+ * while. Run for 1, 2, 4, ... up to the given number of threads as
+ *
+ *   dag       one os_dag task per node, which runs as soon as its own
+ *             dependencies are done, all waited for as one task group;
+ *             building the graph is timed apart
+ *   layers    one os_parallel_for() per layer, a barrier between layers
+ *
+ * and checked against a serial run.
+ *
+ * Usage: bench-dag [-t max_threads] [-l layers] [-w width] [-d deps] [-s spin]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "os_dag.h"
+#include "os_threadpool.h"
+#include "log/log.h"
+#include "utils.h"
+
+static unsigned int num_layers = 64, width = 256, num_deps = 4, spin = 2000;
+/* deps[(node * num_deps) + i], indices into the previous layer */
+static unsigned int *deps;
+static unsigned long long *results;
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long mix(unsigned long long x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static void build_node(long node)
+{
+	unsigned long long acc = node;
+
+	if (node >= width)
+		for (unsigned int i = 0; i < num_deps; ++i)
+			acc += results[(node / width - 1) * width + deps[node * num_deps + i]];
+	for (unsigned int i = 0; i < spin; ++i)
+		acc = mix(acc);
+	results[node] = acc;
+}
+
+static void node_action(void *arg)
+{
+	build_node((long)arg);
+}
+
+/* Time from the first submit to the end; building the graph goes in *build. */
+static double run_dag(unsigned int threads, double *build)
+{
+	long num_nodes = (long)num_layers * width;
+	os_dag_task_t **tasks = malloc(num_nodes * sizeof(*tasks));
+	os_threadpool_t *tp;
+	os_task_group_t tg;
+	double start = now_s();
+
+	DIE(tasks == NULL, "malloc");
+	tp = create_threadpool(threads);
+	tg_init(&tg, tp);
+	for (long node = 0; node < num_nodes; ++node) {
+		tasks[node] = dag_task_create(tp, node_action, (void *)node, NULL);
+		dag_task_join(tasks[node], &tg);
+		if (node >= width)
+			for (unsigned int i = 0; i < num_deps; ++i)
+				dag_task_depend(tasks[node],
+						tasks[(node / width - 1) * width + deps[node * num_deps + i]]);
+	}
+	*build = now_s() - start;
+
+	start = now_s();
+	for (long node = 0; node < num_nodes; ++node)
+		dag_task_submit(tasks[node]);
+	tg_wait(&tg);
+	start = now_s() - start;
+
+	tg_destroy(&tg);
+	wait_for_completion(tp);
+	destroy_threadpool(tp);
+	for (long node = 0; node < num_nodes; ++node)
+		dag_task_release(tasks[node]);
+	free(tasks);
+	return start;
+}
+
+static void build_range(long begin, long end, void *ctx)
+{
+	(void)ctx;
+	for (long node = begin; node < end; ++node)
+		build_node(node);
+}
+
+static void layers_action(void *arg)
+{
+	os_threadpool_t *tp = arg;
+
+	for (unsigned int layer = 0; layer < num_layers; ++layer)
+		os_parallel_for(tp, (long)layer * width, (long)(layer + 1) * width, 1,
+				build_range, NULL);
+}
+
+static double run_layers(unsigned int threads)
+{
+	double start = now_s();
+	os_threadpool_t *tp = create_threadpool(threads);
+
+	enqueue_task(tp, create_task(layers_action, tp, NULL));
+	wait_for_completion(tp);
+	destroy_threadpool(tp);
+	return now_s() - start;
+}
+
+/* Compare with the serial run, and clear the results for the next one. */
+static int check(unsigned long long *expected, long num_nodes)
+{
+	int same = 1;
+
+	for (long node = 0; node < num_nodes; ++node) {
+		same &= results[node] == expected[node];
+		results[node] = 0;
+	}
+	return same;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int max_threads = 64;
+	unsigned long long seed = 42, *expected;
+	double start, serial;
+	long num_nodes;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:l:w:d:s:")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'l':
+			num_layers = atoi(optarg);
+			break;
+		case 'w':
+			width = atoi(optarg);
+			break;
+		case 'd':
+			num_deps = atoi(optarg);
+			break;
+		case 's':
+			spin = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t max_threads] [-l layers] [-w width] [-d deps] [-s spin]\n",
+				argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	log_set_quiet(true);
+	num_nodes = (long)num_layers * width;
+	deps = malloc(num_nodes * num_deps * sizeof(*deps));
+	results = malloc(num_nodes * sizeof(*results));
+	expected = malloc(num_nodes * sizeof(*expected));
+	DIE(deps == NULL || results == NULL || expected == NULL, "malloc");
+	for (long i = 0; i < num_nodes * num_deps; ++i) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		deps[i] = (seed >> 33) % width;
+	}
+
+	start = now_s();
+	build_range(0, num_nodes, NULL);
+	serial = now_s() - start;
+	for (long node = 0; node < num_nodes; ++node) {
+		expected[node] = results[node];
+		results[node] = 0;
+	}
+
+	printf("%u layers of %u nodes, %u deps each, %ld online cpus\n",
+	       num_layers, width, num_deps, sysconf(_SC_NPROCESSORS_ONLN));
+	printf("serial       %8.1f ms\n", serial * 1e3);
+	for (unsigned int threads = 1; threads <= max_threads; threads *= 2) {
+		double dag, build, layers;
+
+		dag = run_dag(threads, &build);
+		DIE(!check(expected, num_nodes), "dag result mismatch");
+		layers = run_layers(threads);
+		DIE(!check(expected, num_nodes), "layers result mismatch");
+		printf("%3u threads  dag %8.1f ms (x%5.2f, built in %6.1f ms)  layers %8.1f ms (x%5.2f)\n",
+		       threads, dag * 1e3, serial / dag, build * 1e3, layers * 1e3, serial / layers);
+	}
+	return 0;
+}
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Many small jobs back to back, each a tree of tasks that enqueue two
+ * children down to a fixed depth, for 1, 2, 4, ... up to the given number
+ * of threads:
+ *
+ *   fresh     a pool is created for every job and torn down after it
+ *   reused    one pool runs every job in a task group, with tg_wait()
+ *
+ * Usage: bench-jobs [-t max_threads] [-j jobs] [-d depth]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "os_threadpool.h"
+#include "log/log.h"
+#include "utils.h"
+
+static os_threadpool_t *tp;
+static os_task_group_t *group;
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fresh_action(void *arg)
+{
+	long depth = (long)arg;
+
+	if (depth == 0)
+		return;
+	enqueue_task(tp, create_task(fresh_action, (void *)(depth - 1), NULL));
+	enqueue_task(tp, create_task(fresh_action, (void *)(depth - 1), NULL));
+}
+
+static void group_action(void *arg)
+{
+	long depth = (long)arg;
+
+	if (depth == 0)
+		return;
+	tg_enqueue(group, create_task(group_action, (void *)(depth - 1), NULL));
+	tg_enqueue(group, create_task(group_action, (void *)(depth - 1), NULL));
+}
+
+static double run_fresh(unsigned int threads, int jobs, long depth)
+{
+	double start = now_s();
+
+	for (int j = 0; j < jobs; ++j) {
+		tp = create_threadpool(threads);
+		enqueue_task(tp, create_task(fresh_action, (void *)depth, NULL));
+		wait_for_completion(tp);
+		destroy_threadpool(tp);
+	}
+	return now_s() - start;
+}
+
+static double run_reused(unsigned int threads, int jobs, long depth)
+{
+	os_task_group_t tg;
+	double start = now_s();
+
+	tp = create_threadpool(threads);
+	tg_init(&tg, tp);
+	group = &tg;
+	for (int j = 0; j < jobs; ++j) {
+		tg_enqueue(&tg, create_task(group_action, (void *)depth, NULL));
+		tg_wait(&tg);
+	}
+	tg_destroy(&tg);
+	wait_for_completion(tp);
+	destroy_threadpool(tp);
+	return now_s() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int max_threads = 64;
+	int jobs = 2000, opt;
+	long depth = 8;
+
+	while ((opt = getopt(argc, argv, "t:j:d:")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'd':
+			depth = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t max_threads] [-j jobs] [-d depth]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* every fresh pool logs its per-thread task counts when done */
+	log_set_quiet(true);
+	printf("%d jobs of %ld tasks, %ld online cpus\n", jobs, (2L << depth) - 1,
+	       sysconf(_SC_NPROCESSORS_ONLN));
+	for (unsigned int threads = 1; threads <= max_threads; threads *= 2) {
+		double fresh = run_fresh(threads, jobs, depth);
+		double reused = run_reused(threads, jobs, depth);
+
+		printf("%3u threads  fresh %8.2f us/job  reused %8.2f us/job (x%5.2f)\n",
+		       threads, fresh / jobs * 1e6, reused / jobs * 1e6, fresh / reused);
+	}
+	return 0;
+}
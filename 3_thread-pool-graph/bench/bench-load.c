@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Graph loading: a random graph is written out in the text and the binary
+ * format, then loaded back
+ *
+ *   fscanf    one number per fscanf() call, the way the text format used
+ *             to be read; only parsed, the graph is not built
+ *   text      create_graph_from_file() on the text file
+ *   binary    create_graph_from_file() on the binary file, a mapping
+ *
+ * Every load is checked against the sum of the values.
+ *
+ * Usage: bench-load [-n nodes] [-e degree] [-d dir]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "os_graph.h"
+#include "log/log.h"
+#include "utils.h"
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int next_random(unsigned long long *seed)
+{
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return *seed >> 33;
+}
+
+static long long write_text(const char *path, unsigned int num_nodes, unsigned int degree)
+{
+	unsigned long long seed = 42;
+	unsigned int num_edges = num_nodes / 2 * degree;
+	long long sum = 0;
+	FILE *file = fopen(path, "w");
+
+	DIE(file == NULL, "fopen");
+	fprintf(file, "%u %u\n", num_nodes, num_edges);
+	for (unsigned int i = 0; i < num_nodes; i++) {
+		int value = next_random(&seed) % 100;
+
+		sum += value;
+		fprintf(file, "%d ", value);
+	}
+	fprintf(file, "\n");
+	for (unsigned int i = 0; i < num_edges; i++)
+		fprintf(file, "%u %u\n", next_random(&seed) % num_nodes, next_random(&seed) % num_nodes);
+	DIE(fclose(file) != 0, "fclose");
+	return sum;
+}
+
+static long long load_fscanf(const char *path)
+{
+	unsigned int num_nodes, num_edges, src, dst;
+	long long sum = 0;
+	FILE *file = fopen(path, "r");
+	int value;
+
+	DIE(file == NULL, "fopen");
+	DIE(fscanf(file, "%u %u", &num_nodes, &num_edges) != 2, "fscanf");
+	for (unsigned int i = 0; i < num_nodes; i++) {
+		DIE(fscanf(file, "%d", &value) != 1, "fscanf");
+		sum += value;
+	}
+	for (unsigned int i = 0; i < num_edges; i++)
+		DIE(fscanf(file, "%u %u", &src, &dst) != 2, "fscanf");
+	fclose(file);
+	return sum;
+}
+
+static long long load_graph(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	os_graph_t *graph;
+	long long sum = 0;
+
+	DIE(file == NULL, "fopen");
+	graph = create_graph_from_file(file);
+	DIE(graph == NULL, "create_graph_from_file");
+	fclose(file);
+	for (unsigned int i = 0; i < graph->num_nodes; i++)
+		sum += graph->info[i];
+	/* walk the edges too, so a mapping pays for its page faults */
+	for (unsigned int i = 0; i < 2 * graph->num_edges; i++)
+		sum += graph->targets[i] >= graph->num_nodes;
+	destroy_graph(graph);
+	return sum;
+}
+
+static void report(const char *name, double seconds, double base)
+{
+	printf("%-8s %8.1f ms (x%6.2f)\n", name, seconds * 1e3, base / seconds);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int num_nodes = 1000000, degree = 8;
+	const char *dir = "/tmp";
+	char text_path[4096], binary_path[4096];
+	double start, base;
+	long long expected;
+	FILE *file;
+	os_graph_t *graph;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:e:d:")) != -1) {
+		switch (opt) {
+		case 'n':
+			num_nodes = atoi(optarg);
+			break;
+		case 'e':
+			degree = atoi(optarg);
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n nodes] [-e degree] [-d dir]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	snprintf(text_path, sizeof(text_path), "%s/bench-load-%d.in", dir, getpid());
+	snprintf(binary_path, sizeof(binary_path), "%s/bench-load-%d.bin", dir, getpid());
+	expected = write_text(text_path, num_nodes, degree);
+
+	file = fopen(text_path, "r");
+	DIE(file == NULL, "fopen");
+	graph = create_graph_from_file(file);
+	DIE(graph == NULL, "create_graph_from_file");
+	fclose(file);
+	file = fopen(binary_path, "wb");
+	DIE(file == NULL, "fopen");
+	DIE(write_graph_file(graph, file) < 0, "fwrite");
+	DIE(fclose(file) != 0, "fclose");
+	printf("%u nodes, %u edges, %ld online cpus\n", graph->num_nodes, graph->num_edges,
+	       sysconf(_SC_NPROCESSORS_ONLN));
+	destroy_graph(graph);
+
+	start = now_s();
+	DIE(load_fscanf(text_path) != expected, "fscanf sum mismatch");
+	base = now_s() - start;
+	report("fscanf", base, base);
+
+	start = now_s();
+	DIE(load_graph(text_path) != expected, "text sum mismatch");
+	report("text", now_s() - start, base);
+
+	start = now_s();
+	DIE(load_graph(binary_path) != expected, "binary sum mismatch");
+	report("binary", now_s() - start, base);
+
+	unlink(text_path);
+	unlink(binary_path);
+	return 0;
+}
@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Worker placement on one graph, a pool set up each way in turn:
+ *
+ *   free        workers left to the scheduler, stealing from anyone
+ *   pinned      POOL_PIN: a CPU each, still stealing from anyone
+ *   near        POOL_DEFAULT: pinned, stealing from the same core first,
+ *               then the same package
+ *   near+local  as near, with the graph moved by topology_place_graph()
+ *
+ * each running an adaptive BFS from node 0, connected components, and a
+ * sweep adding up the info of every node's neighbours, split the way the
+ * graph is placed, on the graph files given, or on an RMAT graph
+ * (a = 0.57, b = c = 0.19) of 2^scale nodes and edge_factor edges per
+ * node when there are none. Pools have a worker per CPU unless told
+ * otherwise. Results are checked against the first setup; times are the
+ * best of the repeats. Only a machine with several cores, packages or NUMA
+ * nodes in the affinity mask tells the setups apart.
+ *
+ * Usage: bench-numa [-t threads] [-s scale] [-e edge_factor] [-r repeats] [graph...]
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "os_bfs.h"
+#include "os_cc.h"
+#include "os_graph.h"
+#include "os_threadpool.h"
+#include "os_topology.h"
+#include "log/log.h"
+#include "utils.h"
+
+static os_threadpool_t *tp;
+static os_graph_t *graph;
+static _Atomic unsigned int *levels, *comp;
+static _Atomic long long *sums;
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double next_uniform(unsigned long long *seed)
+{
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (*seed >> 11) * (1.0 / (1ULL << 53));
+}
+
+static os_graph_t *generate_rmat(unsigned int scale, unsigned int edge_factor)
+{
+	unsigned long long seed = 42;
+	unsigned int num_nodes = 1u << scale;
+	unsigned int num_edges = num_nodes * edge_factor;
+	os_edge_t *edges = malloc(num_edges * sizeof(*edges));
+	int *values = malloc(num_nodes * sizeof(*values));
+	os_graph_t *rmat;
+
+	DIE(edges == NULL || values == NULL, "malloc");
+	for (unsigned int i = 0; i < num_nodes; ++i)
+		values[i] = next_uniform(&seed) * 100;
+	for (unsigned int i = 0; i < num_edges; ++i) {
+		unsigned int src = 0, dst = 0;
+
+		for (unsigned int bit = 0; bit < scale; ++bit) {
+			double p = next_uniform(&seed);
+
+			src = src << 1 | (p >= 0.57 + 0.19);
+			dst = dst << 1 | ((p >= 0.57 && p < 0.57 + 0.19) || p >= 0.57 + 0.19 + 0.19);
+		}
+		edges[i].src = src;
+		edges[i].dst = dst;
+	}
+	rmat = create_graph_from_data(num_nodes, num_edges, values, edges);
+	free(values);
+	free(edges);
+	return rmat;
+}
+
+static void add_sums(void *acc, const void *other, void *ctx)
+{
+	(void)ctx;
+	*(long long *)acc += *(const long long *)other;
+}
+
+static void sum_reached(long begin, long end, void *acc, void *ctx)
+{
+	long long *sum = acc;
+
+	(void)ctx;
+	for (long i = begin; i < end; ++i)
+		if (atomic_load_explicit(&levels[i], memory_order_relaxed) != BFS_UNREACHED)
+			*sum += graph->info[i];
+}
+
+static long long run_bfs(void)
+{
+	long long sum = 0;
+
+	bfs_levels(tp, graph, 0, levels, BFS_ADAPTIVE, NULL);
+	os_parallel_reduce(tp, 0, graph->num_nodes, 0, sum_reached, add_sums,
+			   &sum, sizeof(sum), NULL);
+	return sum;
+}
+
+static long long run_cc(void)
+{
+	return cc_labels(tp, graph, comp);
+}
+
+static void sum_neighbours(long begin, long end, void *acc, void *ctx)
+{
+	long long *sum = acc;
+
+	(void)ctx;
+	for (long i = begin; i < end; ++i) {
+		unsigned int *neighbours = graph_neighbours(graph, i);
+
+		for (unsigned int j = 0; j < graph_degree(graph, i); ++j)
+			*sum += graph->info[neighbours[j]];
+	}
+}
+
+static long long run_sweep(void)
+{
+	long long sum = 0;
+
+	os_parallel_reduce(tp, 0, graph->num_nodes,
+			   (graph->num_nodes + tp->num_threads - 1) / tp->num_threads,
+			   sum_neighbours, add_sums, &sum, sizeof(sum), NULL);
+	return sum;
+}
+
+static void print_topology(void)
+{
+	os_cpu_t *cpus;
+	unsigned int n = topology_cpus(&cpus), cores = 0, packages = 0;
+
+	for (unsigned int i = 0; i < n; ++i) {
+		unsigned int j = 0;
+
+		cores += cpus[i].smt == 0;
+		while (j < i && cpus[j].package != cpus[i].package)
+			j++;
+		packages += j == i;
+	}
+	printf("%u cpus, %u cores, %u packages, %u numa nodes in the affinity mask\n",
+	       n, cores, packages, topology_num_nodes(cpus, n));
+	free(cpus);
+}
+
+static void bench_graph(const char *name, unsigned int threads, int repeats)
+{
+	static const char * const setups[] = { "free", "pinned", "near", "near+local" };
+	static const unsigned int flags[] = { 0, POOL_PIN, POOL_DEFAULT, POOL_DEFAULT };
+	static const char * const runs[] = { "bfs", "cc", "sweep" };
+	long long (* const run[])(void) = { run_bfs, run_cc, run_sweep };
+	long long expected[3];
+
+	levels = malloc(graph->num_nodes * sizeof(*levels));
+	comp = malloc(graph->num_nodes * sizeof(*comp));
+	sums = malloc(graph->num_nodes * sizeof(*sums));
+	DIE(graph->num_nodes && (levels == NULL || comp == NULL || sums == NULL), "malloc");
+
+	printf("%s: %u nodes, %u edges\n", name, graph->num_nodes, graph->num_edges);
+	printf("  %-11s %12s %12s %12s\n", "", runs[0], runs[1], runs[2]);
+	/* the last setup moves the graph for good, so it goes last */
+	for (int s = 0; s < 4; ++s) {
+		tp = create_threadpool_flags(threads, flags[s]);
+		if (s == 3)
+			topology_place_graph(tp, graph);
+		printf("  %-11s", setups[s]);
+		for (int w = 0; w < 3; ++w) {
+			double best = 1e30;
+
+			for (int r = 0; r < repeats; ++r) {
+				double start = now_s();
+				long long result = run[w]();
+				double t = now_s() - start;
+
+				if (s == 0 && r == 0)
+					expected[w] = result;
+				DIE(result != expected[w], "result mismatch");
+				if (t < best)
+					best = t;
+			}
+			printf(" %9.3f ms", best * 1e3);
+		}
+		printf("\n");
+		wait_for_completion(tp);
+		destroy_threadpool(tp);
+	}
+
+	free(sums);
+	free(comp);
+	free(levels);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int threads = 0, scale = 20, edge_factor = 16;
+	int repeats = 5, opt;
+
+	while ((opt = getopt(argc, argv, "t:s:e:r:")) != -1) {
+		switch (opt) {
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 's':
+			scale = atoi(optarg);
+			break;
+		case 'e':
+			edge_factor = atoi(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t threads] [-s scale] [-e edge_factor] [-r repeats] [graph...]\n",
+				argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	log_set_quiet(true);
+	print_topology();
+	if (threads != 0)
+		printf("%u threads\n", threads);
+
+	if (optind == argc) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "rmat-%u-%u", scale, edge_factor);
+		graph = generate_rmat(scale, edge_factor);
+		bench_graph(name, threads, repeats);
+		destroy_graph(graph);
+	}
+	for (int i = optind; i < argc; ++i) {
+		FILE *file = fopen(argv[i], "r");
+
+		DIE(file == NULL, "fopen");
+		graph = create_graph_from_file(file);
+		DIE(graph == NULL, "create_graph_from_file");
+		fclose(file);
+		bench_graph(argv[i], threads, repeats);
+		destroy_graph(graph);
+	}
+
+	return 0;
+}
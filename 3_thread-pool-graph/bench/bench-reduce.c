@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * os_parallel_reduce() against a plain loop: the sum of the values of a
+ * random graph's nodes, the reduction serial.c and parallel.c end with,
+ * for 1, 2, 4, ... up to the given number of threads and a few grains
+ * (0 lets the pool pick one).
+ *
+ * Usage: bench-reduce [-t max_threads] [-n nodes] [-r repeats]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "os_threadpool.h"
+#include "log/log.h"
+#include "utils.h"
+
+static int *values;
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sum_range(long begin, long end, void *acc, void *ctx)
+{
+	long long *sum = acc;
+
+	(void)ctx;
+	for (long i = begin; i < end; ++i)
+		*sum += values[i];
+}
+
+static void add_sums(void *acc, const void *other, void *ctx)
+{
+	(void)ctx;
+	*(long long *)acc += *(const long long *)other;
+}
+
+/* One pool serves every repeat. */
+static double run_reduce(unsigned int threads, long num_values, long grain, int repeats,
+			 long long *sum)
+{
+	os_threadpool_t *tp = create_threadpool(threads);
+	double start = now_s();
+
+	for (int r = 0; r < repeats; ++r) {
+		*sum = 0;
+		os_parallel_reduce(tp, 0, num_values, grain, sum_range, add_sums,
+				   sum, sizeof(*sum), NULL);
+	}
+	start = now_s() - start;
+	wait_for_completion(tp);
+	destroy_threadpool(tp);
+	return start / repeats;
+}
+
+int main(int argc, char *argv[])
+{
+	static const long grains[] = { 0, 1024, 65536 };
+	unsigned int max_threads = 64;
+	long num_values = 10000000;
+	int repeats = 20, opt;
+	unsigned long long seed = 42;
+	long long expected = 0, sum;
+	double start, serial;
+
+	while ((opt = getopt(argc, argv, "t:n:r:")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'n':
+			num_values = atol(optarg);
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t max_threads] [-n nodes] [-r repeats]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	log_set_quiet(true);
+	values = malloc(num_values * sizeof(*values));
+	DIE(values == NULL, "malloc");
+	for (long i = 0; i < num_values; ++i) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		values[i] = (seed >> 33) % 100;
+	}
+
+	start = now_s();
+	for (int r = 0; r < repeats; ++r) {
+		expected = 0;
+		sum_range(0, num_values, &expected, NULL);
+	}
+	serial = (now_s() - start) / repeats;
+
+	printf("%ld values, %ld online cpus\n", num_values, sysconf(_SC_NPROCESSORS_ONLN));
+	printf("serial       %8.2f ms\n", serial * 1e3);
+	for (unsigned int threads = 1; threads <= max_threads; threads *= 2) {
+		printf("%3u threads", threads);
+		for (unsigned int g = 0; g < sizeof(grains) / sizeof(grains[0]); ++g) {
+			double t = run_reduce(threads, num_values, grains[g], repeats, &sum);
+
+			DIE(sum != expected, "reduce sum mismatch");
+			printf("  grain %-6ld %8.2f ms (x%5.2f)", grains[g], t * 1e3, serial / t);
+		}
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Thread pool scaling on generated workloads, for 1, 2, 4, ... up to the
+ * given number of threads:
+ *
+ *   spawn     every task enqueues two children down to a fixed depth, so
+ *             all the work is pool overhead: enqueue, dequeue and steals
+ *   traverse  one task per node of a random graph, the way parallel.c
+ *             walks it: a task claims its node's neighbours with a CAS on
+ *             visited, enqueues a task for each one it claimed and adds
+ *             its node's info to the running worker's partial sum; the
+ *             tasks of one node are enqueued as a batch
+ *
+ * Usage: bench-scaling [-t max_threads] [-d spawn_depth] [-n nodes] [-e degree]
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+#include "log/log.h"
+#include "utils.h"
+
+static os_threadpool_t *tp;
+static os_graph_t *graph;
+static struct {
+	long long sum;
+} __attribute__((aligned(64))) *partial_sums;
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int next_random(unsigned long long *seed)
+{
+	*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return *seed >> 33;
+}
+
+static void spawn_action(void *arg)
+{
+	long depth = (long)arg;
+
+	if (depth == 0)
+		return;
+	enqueue_task(tp, create_task(spawn_action, (void *)(depth - 1), NULL));
+	enqueue_task(tp, create_task(spawn_action, (void *)(depth - 1), NULL));
+}
+
+static void traverse_action(void *arg)
+{
+	long idx = (long)arg;
+	unsigned int *neighbours = graph_neighbours(graph, idx);
+	os_task_t *batch[64];
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; i < graph_degree(graph, idx); ++i) {
+		os_visit_t expected = NOT_VISITED;
+		long next = neighbours[i];
+
+		if (atomic_load_explicit(&graph->visited[next], memory_order_relaxed) == NOT_VISITED
+		    && atomic_compare_exchange_strong(&graph->visited[next], &expected, PROCESSING)) {
+			batch[n++] = create_task(traverse_action, (void *)next, NULL);
+			if (n == 64) {
+				enqueue_tasks(tp, batch, n);
+				n = 0;
+			}
+		}
+	}
+	enqueue_tasks(tp, batch, n);
+	partial_sums[threadpool_worker_id(tp)].sum += graph->info[idx];
+	atomic_store_explicit(&graph->visited[idx], DONE, memory_order_relaxed);
+}
+
+/* A ring keeps the graph connected, the rest of the edges are random. */
+static os_graph_t *generate_graph(unsigned int num_nodes, unsigned int degree)
+{
+	unsigned long long seed = 42;
+	unsigned int num_edges = num_nodes / 2 * degree;
+	os_edge_t *edges = malloc(num_edges * sizeof(*edges));
+	int *values = malloc(num_nodes * sizeof(*values));
+
+	DIE(edges == NULL || values == NULL, "malloc");
+	for (unsigned int i = 0; i < num_nodes; ++i)
+		values[i] = next_random(&seed) % 100;
+	for (unsigned int i = 0; i < num_edges; ++i) {
+		edges[i].src = i < num_nodes ? i : next_random(&seed) % num_nodes;
+		edges[i].dst = i < num_nodes ? (i + 1) % num_nodes : next_random(&seed) % num_nodes;
+	}
+	graph = create_graph_from_data(num_nodes, num_edges, values, edges);
+	free(values);
+	free(edges);
+	return graph;
+}
+
+static double run_spawn(unsigned int threads, long depth)
+{
+	double start = now_s();
+
+	tp = create_threadpool(threads);
+	enqueue_task(tp, create_task(spawn_action, (void *)depth, NULL));
+	wait_for_completion(tp);
+	destroy_threadpool(tp);
+	return now_s() - start;
+}
+
+static double run_traverse(unsigned int threads, long long *sum)
+{
+	double start;
+
+	for (unsigned int i = 0; i < graph->num_nodes; ++i)
+		atomic_init(&graph->visited[i], NOT_VISITED);
+	for (unsigned int i = 0; i < threads; ++i)
+		partial_sums[i].sum = 0;
+
+	start = now_s();
+	tp = create_threadpool(threads);
+	atomic_store(&graph->visited[0], PROCESSING);
+	enqueue_task(tp, create_task(traverse_action, (void *)0, NULL));
+	wait_for_completion(tp);
+	destroy_threadpool(tp);
+
+	*sum = 0;
+	for (unsigned int i = 0; i < threads; ++i)
+		*sum += partial_sums[i].sum;
+	return now_s() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int max_threads = 64, num_nodes = 1000000, degree = 8;
+	long depth = 20;
+	double spawn_base = 0, traverse_base = 0;
+	long long expected_sum = 0, sum;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:d:n:e:")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'd':
+			depth = atol(optarg);
+			break;
+		case 'n':
+			num_nodes = atoi(optarg);
+			break;
+		case 'e':
+			degree = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t max_threads] [-d spawn_depth] [-n nodes] [-e degree]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* the pool logs its per-thread task counts on completion */
+	log_set_quiet(true);
+	generate_graph(num_nodes, degree);
+	partial_sums = aligned_alloc(64, max_threads * sizeof(*partial_sums));
+	DIE(partial_sums == NULL, "aligned_alloc");
+	for (unsigned int i = 0; i < num_nodes; ++i)
+		expected_sum += graph->info[i];
+
+	printf("spawn: %ld tasks, traverse: %u nodes, %u edges, %ld online cpus\n",
+	       (2L << depth) - 1, graph->num_nodes, graph->num_edges, sysconf(_SC_NPROCESSORS_ONLN));
+	for (unsigned int threads = 1; threads <= max_threads; threads *= 2) {
+		double spawn = run_spawn(threads, depth);
+		double traverse = run_traverse(threads, &sum);
+
+		DIE(sum != expected_sum, "traverse sum mismatch");
+		if (threads == 1) {
+			spawn_base = spawn;
+			traverse_base = traverse;
+		}
+		printf("%3u threads  spawn %7.2f Mtasks/s (x%5.2f)  traverse %8.1f ms (x%5.2f)\n",
+		       threads, ((2L << depth) - 1) / spawn / 1e6, spawn_base / spawn,
+		       traverse * 1e3, traverse_base / traverse);
+	}
+	return 0;
+}
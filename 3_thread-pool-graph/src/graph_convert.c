@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Convert a graph to the binary format, which create_graph_from_file()
+ * maps and uses without parsing anything.
+ *
+ * Usage: graph_convert <input> <output>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "os_graph.h"
+#include "log/log.h"
+#include "utils.h"
+
+int main(int argc, char *argv[])
+{
+	FILE *input_file, *output_file;
+	os_graph_t *graph;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <input> <output>\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	input_file = fopen(argv[1], "r");
+	DIE(input_file == NULL, "fopen");
+
+	graph = create_graph_from_file(input_file);
+	DIE(graph == NULL, "create_graph_from_file");
+	fclose(input_file);
+
+	output_file = fopen(argv[2], "wb");
+	DIE(output_file == NULL, "fopen");
+	DIE(write_graph_file(graph, output_file) < 0, "fwrite");
+	DIE(fclose(output_file) != 0, "fclose");
+
+	destroy_graph(graph);
+	return 0;
+}
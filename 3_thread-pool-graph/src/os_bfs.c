@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "os_bfs.h"
+#include "log/log.h"
+#include "utils.h"
+
+/* Frontier chunks smaller than this are not worth a steal. */
+#define BFS_QUEUE_GRAIN		256
+#define BFS_WORD_GRAIN		16
+
+typedef _Atomic uint64_t os_bitmap_word_t;
+
+/* What one worker found in the current step. */
+typedef struct bfs_worker {
+	unsigned int *found;
+	size_t count, capacity;
+	/* degrees of the nodes found */
+	unsigned long long edges;
+} __attribute__((aligned(64))) bfs_worker_t;
+
+typedef struct bfs_state {
+	os_threadpool_t *tp;
+	os_graph_t *graph;
+	_Atomic unsigned int *levels;
+	/* level of the nodes in the frontier */
+	unsigned int depth;
+
+	unsigned int *queue;
+	size_t queue_size;
+	os_bitmap_word_t *frontier, *next;
+	size_t num_words;
+
+	bfs_worker_t *workers;
+} bfs_state_t;
+
+static bfs_worker_t *this_worker(bfs_state_t *bfs)
+{
+	return &bfs->workers[threadpool_worker_id(bfs->tp)];
+}
+
+static void worker_push(bfs_worker_t *w, unsigned int node)
+{
+	if (w->count == w->capacity) {
+		w->capacity = w->capacity ? 2 * w->capacity : 1024;
+		w->found = realloc(w->found, w->capacity * sizeof(*w->found));
+		DIE(w->found == NULL, "realloc");
+	}
+	w->found[w->count++] = node;
+}
+
+static void reset_workers(bfs_state_t *bfs)
+{
+	for (unsigned int i = 0; i < bfs->tp->num_threads; ++i) {
+		bfs->workers[i].count = 0;
+		bfs->workers[i].edges = 0;
+	}
+}
+
+/* Gather what the workers found into the queue; the degrees it covers. */
+static unsigned long long gather_queue(bfs_state_t *bfs)
+{
+	unsigned long long edges = 0;
+
+	bfs->queue_size = 0;
+	for (unsigned int i = 0; i < bfs->tp->num_threads; ++i) {
+		bfs_worker_t *w = &bfs->workers[i];
+
+		memcpy(bfs->queue + bfs->queue_size, w->found, w->count * sizeof(*w->found));
+		bfs->queue_size += w->count;
+		edges += w->edges;
+	}
+	return edges;
+}
+
+static int claim(bfs_state_t *bfs, unsigned int node, unsigned int level)
+{
+	unsigned int expected = BFS_UNREACHED;
+
+	if (atomic_load_explicit(&bfs->levels[node], memory_order_relaxed) != BFS_UNREACHED)
+		return 0;
+	return atomic_compare_exchange_strong_explicit(&bfs->levels[node], &expected, level,
+						       memory_order_relaxed,
+						       memory_order_relaxed);
+}
+
+static void top_down_range(long begin, long end, void *ctx)
+{
+	bfs_state_t *bfs = ctx;
+	bfs_worker_t *w = this_worker(bfs);
+	os_graph_t *graph = bfs->graph;
+
+	for (long i = begin; i < end; ++i) {
+		unsigned int node = bfs->queue[i];
+		unsigned int *neighbours = graph_neighbours(graph, node);
+
+		for (unsigned int j = 0; j < graph_degree(graph, node); ++j) {
+			if (claim(bfs, neighbours[j], bfs->depth + 1)) {
+				worker_push(w, neighbours[j]);
+				w->edges += graph_degree(graph, neighbours[j]);
+			}
+		}
+	}
+}
+
+static int in_frontier(bfs_state_t *bfs, unsigned int node)
+{
+	uint64_t word = atomic_load_explicit(&bfs->frontier[node / 64], memory_order_relaxed);
+
+	return (word >> (node % 64)) & 1;
+}
+
+/* Each word of next belongs to the one worker that scans its 64 nodes. */
+static void bottom_up_range(long begin, long end, void *ctx)
+{
+	bfs_state_t *bfs = ctx;
+	bfs_worker_t *w = this_worker(bfs);
+	os_graph_t *graph = bfs->graph;
+
+	for (long word = begin; word < end; ++word) {
+		unsigned int first = word * 64;
+		unsigned int last = first + 64 < graph->num_nodes ? first + 64 : graph->num_nodes;
+		uint64_t found = 0;
+
+		for (unsigned int node = first; node < last; ++node) {
+			unsigned int *neighbours = graph_neighbours(graph, node);
+
+			if (atomic_load_explicit(&bfs->levels[node], memory_order_relaxed) != BFS_UNREACHED)
+				continue;
+			for (unsigned int j = 0; j < graph_degree(graph, node); ++j) {
+				if (in_frontier(bfs, neighbours[j])) {
+					atomic_store_explicit(&bfs->levels[node], bfs->depth + 1,
+							      memory_order_relaxed);
+					found |= 1ull << (node - first);
+					w->count++;
+					w->edges += graph_degree(graph, node);
+					break;
+				}
+			}
+		}
+		atomic_store_explicit(&bfs->next[word], found, memory_order_relaxed);
+	}
+}
+
+static void queue_to_bitmap_range(long begin, long end, void *ctx)
+{
+	bfs_state_t *bfs = ctx;
+
+	for (long i = begin; i < end; ++i)
+		atomic_fetch_or_explicit(&bfs->frontier[bfs->queue[i] / 64],
+					 1ull << (bfs->queue[i] % 64), memory_order_relaxed);
+}
+
+static void bitmap_to_queue_range(long begin, long end, void *ctx)
+{
+	bfs_state_t *bfs = ctx;
+	bfs_worker_t *w = this_worker(bfs);
+
+	for (long word = begin; word < end; ++word) {
+		uint64_t bits = atomic_load_explicit(&bfs->frontier[word], memory_order_relaxed);
+
+		while (bits != 0) {
+			unsigned int node = word * 64 + __builtin_ctzll(bits);
+
+			worker_push(w, node);
+			w->edges += graph_degree(bfs->graph, node);
+			bits &= bits - 1;
+		}
+	}
+}
+
+static void clear_bitmap_range(long begin, long end, void *ctx)
+{
+	os_bitmap_word_t *bitmap = ctx;
+
+	for (long word = begin; word < end; ++word)
+		atomic_store_explicit(&bitmap[word], 0, memory_order_relaxed);
+}
+
+static void init_levels_range(long begin, long end, void *ctx)
+{
+	_Atomic unsigned int *levels = ctx;
+
+	for (long i = begin; i < end; ++i)
+		atomic_store_explicit(&levels[i], BFS_UNREACHED, memory_order_relaxed);
+}
+
+/* One level top-down; returns the degrees of the new frontier. */
+static unsigned long long top_down_step(bfs_state_t *bfs)
+{
+	reset_workers(bfs);
+	os_parallel_for(bfs->tp, 0, bfs->queue_size, BFS_QUEUE_GRAIN, top_down_range, bfs);
+	return gather_queue(bfs);
+}
+
+/* One level bottom-up; returns the size of the new frontier. */
+static unsigned int bottom_up_step(bfs_state_t *bfs, unsigned long long *edges)
+{
+	os_bitmap_word_t *swap;
+	unsigned int awake = 0;
+
+	reset_workers(bfs);
+	os_parallel_for(bfs->tp, 0, bfs->num_words, BFS_WORD_GRAIN, bottom_up_range, bfs);
+	*edges = 0;
+	for (unsigned int i = 0; i < bfs->tp->num_threads; ++i) {
+		awake += bfs->workers[i].count;
+		*edges += bfs->workers[i].edges;
+	}
+	swap = bfs->frontier;
+	bfs->frontier = bfs->next;
+	bfs->next = swap;
+	return awake;
+}
+
+/*
+ * Takes the edges of the frontier about to be expanded off those left to
+ * explore, whichever direction the step goes.
+ */
+static void explore_edges(unsigned long long *edges_to_check, unsigned long long scout)
+{
+	*edges_to_check -= scout < *edges_to_check ? scout : *edges_to_check;
+}
+
+unsigned int bfs_levels(os_threadpool_t *tp, os_graph_t *graph, unsigned int source,
+			_Atomic unsigned int *levels, os_bfs_mode_t mode,
+			os_bfs_stats_t *stats)
+{
+	bfs_state_t bfs = {
+		.tp = tp,
+		.graph = graph,
+		.levels = levels,
+		.num_words = (graph->num_nodes + 63) / 64,
+	};
+	os_bfs_stats_t local = { 0 };
+	unsigned long long edges_to_check = 2 * (unsigned long long)graph->num_edges;
+	unsigned long long scout;
+
+	if (stats == NULL)
+		stats = &local;
+	memset(stats, 0, sizeof(*stats));
+	if (graph->num_nodes == 0)
+		return 0;
+
+	bfs.queue = malloc(graph->num_nodes * sizeof(*bfs.queue));
+	bfs.frontier = malloc(bfs.num_words * sizeof(*bfs.frontier));
+	bfs.next = malloc(bfs.num_words * sizeof(*bfs.next));
+	bfs.workers = aligned_alloc(64, tp->num_threads * sizeof(*bfs.workers));
+	DIE(bfs.queue == NULL || bfs.frontier == NULL || bfs.next == NULL || bfs.workers == NULL,
+	    "malloc");
+	memset(bfs.workers, 0, tp->num_threads * sizeof(*bfs.workers));
+	os_parallel_for(tp, 0, graph->num_nodes, 0, init_levels_range, levels);
+
+	atomic_store_explicit(&levels[source], 0, memory_order_relaxed);
+	bfs.queue[0] = source;
+	bfs.queue_size = 1;
+	scout = graph_degree(graph, source);
+	stats->reached = 1;
+
+	while (bfs.queue_size > 0) {
+		if (mode == BFS_BOTTOM_UP || (mode == BFS_ADAPTIVE && scout > edges_to_check / BFS_ALPHA)) {
+			unsigned int awake = bfs.queue_size, old_awake;
+
+			os_parallel_for(tp, 0, bfs.num_words, 0, clear_bitmap_range, bfs.frontier);
+			os_parallel_for(tp, 0, bfs.queue_size, BFS_QUEUE_GRAIN, queue_to_bitmap_range, &bfs);
+			do {
+				old_awake = awake;
+				explore_edges(&edges_to_check, scout);
+				awake = bottom_up_step(&bfs, &scout);
+				bfs.depth++;
+				stats->bottom_up_steps++;
+				stats->reached += awake;
+			} while (awake > 0 && (mode == BFS_BOTTOM_UP || awake >= old_awake ||
+					       awake > graph->num_nodes / BFS_BETA));
+
+			reset_workers(&bfs);
+			os_parallel_for(tp, 0, bfs.num_words, BFS_WORD_GRAIN, bitmap_to_queue_range, &bfs);
+			scout = gather_queue(&bfs);
+		} else {
+			explore_edges(&edges_to_check, scout);
+			scout = top_down_step(&bfs);
+			bfs.depth++;
+			stats->top_down_steps++;
+			stats->reached += bfs.queue_size;
+		}
+	}
+	stats->levels = bfs.depth;
+
+	for (unsigned int i = 0; i < tp->num_threads; ++i)
+		free(bfs.workers[i].found);
+	free(bfs.workers);
+	free(bfs.next);
+	free(bfs.frontier);
+	free(bfs.queue);
+	return stats->reached;
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Level-synchronous breadth-first search on the thread pool, direction
+ * optimizing after Beamer, Asanovic and Patterson, "Direction-Optimizing
+ * Breadth-First Search" (SC 2012).
+ *
+ * Each level is one os_parallel_for() over the frontier. Top-down, the
+ * frontier is a queue: each worker takes a chunk of it and claims its
+ * unvisited neighbours with a CAS into a buffer of its own, and the
+ * buffers make up the next queue. Bottom-up, the frontier is a bitmap:
+ * each worker takes a chunk of 64-node words and, for every unvisited node
+ * in it, looks for a neighbour in the frontier, stopping at the first one.
+ * The search goes bottom-up once the frontier's edges outnumber
+ * 1/BFS_ALPHA of those left to explore, and back to top-down once the
+ * frontier shrinks below 1/BFS_BETA of the nodes.
+ */
+
+#ifndef __OS_BFS_H__
+#define __OS_BFS_H__	1
+
+#include <stdatomic.h>
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+#define BFS_UNREACHED	(~0u)
+#define BFS_ALPHA	14
+#define BFS_BETA	24
+
+typedef enum {
+	BFS_ADAPTIVE,
+	BFS_TOP_DOWN,
+	BFS_BOTTOM_UP,
+} os_bfs_mode_t;
+
+typedef struct os_bfs_stats {
+	unsigned int reached;
+	unsigned int levels;
+	unsigned int top_down_steps;
+	unsigned int bottom_up_steps;
+} os_bfs_stats_t;
+
+/*
+ * Fill levels[] with the distance of every node from source, BFS_UNREACHED
+ * for the nodes it cannot reach. mode forces a direction, for comparison;
+ * stats may be NULL. Returns the number of nodes reached.
+ */
+unsigned int bfs_levels(os_threadpool_t *tp, os_graph_t *graph, unsigned int source,
+			_Atomic unsigned int *levels, os_bfs_mode_t mode,
+			os_bfs_stats_t *stats);
+
+#endif
@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+
+#include "os_cc.h"
+#include "log/log.h"
+#include "utils.h"
+
+typedef struct cc_state {
+	os_graph_t *graph;
+	_Atomic unsigned int *comp;
+	_Atomic long long *sums;
+	unsigned int round;
+	/* label of the giant component, whose nodes need no more links */
+	unsigned int giant;
+} cc_state_t;
+
+static inline unsigned int parent(cc_state_t *cc, unsigned int node)
+{
+	return atomic_load_explicit(&cc->comp[node], memory_order_relaxed);
+}
+
+/* Merge the trees of u and v: the root with the bigger id goes under the other. */
+static void link(cc_state_t *cc, unsigned int u, unsigned int v)
+{
+	unsigned int p1 = parent(cc, u), p2 = parent(cc, v);
+
+	while (p1 != p2) {
+		unsigned int high = p1 > p2 ? p1 : p2;
+		unsigned int low = p1 + p2 - high;
+		unsigned int p_high = parent(cc, high);
+
+		if (p_high == low)
+			break;
+		if (p_high == high &&
+		    atomic_compare_exchange_strong_explicit(&cc->comp[high], &p_high, low,
+							    memory_order_relaxed,
+							    memory_order_relaxed))
+			break;
+		p1 = parent(cc, parent(cc, high));
+		p2 = parent(cc, low);
+	}
+}
+
+static void init_range(long begin, long end, void *ctx)
+{
+	cc_state_t *cc = ctx;
+
+	for (long i = begin; i < end; ++i)
+		atomic_store_explicit(&cc->comp[i], i, memory_order_relaxed);
+}
+
+static void compress_range(long begin, long end, void *ctx)
+{
+	cc_state_t *cc = ctx;
+
+	for (long i = begin; i < end; ++i)
+		while (parent(cc, i) != parent(cc, parent(cc, i)))
+			atomic_store_explicit(&cc->comp[i], parent(cc, parent(cc, i)),
+					      memory_order_relaxed);
+}
+
+static void neighbor_round_range(long begin, long end, void *ctx)
+{
+	cc_state_t *cc = ctx;
+
+	for (long i = begin; i < end; ++i)
+		if (graph_degree(cc->graph, i) > cc->round)
+			link(cc, i, graph_neighbours(cc->graph, i)[cc->round]);
+}
+
+static void finish_range(long begin, long end, void *ctx)
+{
+	cc_state_t *cc = ctx;
+
+	for (long i = begin; i < end; ++i) {
+		unsigned int *neighbours = graph_neighbours(cc->graph, i);
+
+		if (parent(cc, i) == cc->giant)
+			continue;
+		for (unsigned int j = CC_NEIGHBOR_ROUNDS; j < graph_degree(cc->graph, i); ++j)
+			link(cc, i, neighbours[j]);
+	}
+}
+
+static int compare_labels(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The most frequent label among CC_SAMPLES random nodes. */
+static unsigned int sample_giant(cc_state_t *cc)
+{
+	unsigned int samples[CC_SAMPLES], best = 0, best_count = 0;
+	unsigned long long seed = 42;
+
+	for (unsigned int i = 0; i < CC_SAMPLES; ++i) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		samples[i] = parent(cc, (seed >> 33) % cc->graph->num_nodes);
+	}
+	qsort(samples, CC_SAMPLES, sizeof(samples[0]), compare_labels);
+	for (unsigned int i = 0, run = 1; i < CC_SAMPLES; ++i, ++run) {
+		if (i + 1 < CC_SAMPLES && samples[i + 1] == samples[i])
+			continue;
+		if (run > best_count) {
+			best = samples[i];
+			best_count = run;
+		}
+		run = 0;
+	}
+	return best;
+}
+
+static void count_roots(long begin, long end, void *acc, void *ctx)
+{
+	cc_state_t *cc = ctx;
+	unsigned int *count = acc;
+
+	for (long i = begin; i < end; ++i)
+		*count += parent(cc, i) == i;
+}
+
+static void add_counts(void *acc, const void *other, void *ctx)
+{
+	(void)ctx;
+	*(unsigned int *)acc += *(const unsigned int *)other;
+}
+
+unsigned int cc_labels(os_threadpool_t *tp, os_graph_t *graph, _Atomic unsigned int *comp)
+{
+	cc_state_t cc = {
+		.graph = graph,
+		.comp = comp,
+	};
+	unsigned int count = 0;
+
+	if (graph->num_nodes == 0)
+		return 0;
+
+	os_parallel_for(tp, 0, graph->num_nodes, 0, init_range, &cc);
+	for (cc.round = 0; cc.round < CC_NEIGHBOR_ROUNDS; ++cc.round) {
+		os_parallel_for(tp, 0, graph->num_nodes, 0, neighbor_round_range, &cc);
+		os_parallel_for(tp, 0, graph->num_nodes, 0, compress_range, &cc);
+	}
+	cc.giant = sample_giant(&cc);
+	os_parallel_for(tp, 0, graph->num_nodes, 0, finish_range, &cc);
+	os_parallel_for(tp, 0, graph->num_nodes, 0, compress_range, &cc);
+
+	os_parallel_reduce(tp, 0, graph->num_nodes, 0, count_roots, add_counts,
+			   &count, sizeof(count), &cc);
+	return count;
+}
+
+static void clear_sums_range(long begin, long end, void *ctx)
+{
+	cc_state_t *cc = ctx;
+
+	for (long i = begin; i < end; ++i)
+		if (parent(cc, i) == i)
+			atomic_store_explicit(&cc->sums[i], 0, memory_order_relaxed);
+}
+
+/*
+ * The giant component goes to the running worker's accumulator, the
+ * others straight to their sums, where atomics hardly ever collide.
+ */
+static void sum_range(long begin, long end, void *acc, void *ctx)
+{
+	cc_state_t *cc = ctx;
+	long long *giant = acc;
+
+	for (long i = begin; i < end; ++i) {
+		unsigned int root = parent(cc, i);
+
+		if (root == cc->giant)
+			*giant += cc->graph->info[i];
+		else
+			atomic_fetch_add_explicit(&cc->sums[root], cc->graph->info[i],
+						  memory_order_relaxed);
+	}
+}
+
+static void add_sums(void *acc, const void *other, void *ctx)
+{
+	(void)ctx;
+	*(long long *)acc += *(const long long *)other;
+}
+
+void cc_sums(os_threadpool_t *tp, os_graph_t *graph, _Atomic unsigned int *comp,
+	     _Atomic long long *sums)
+{
+	cc_state_t cc = {
+		.graph = graph,
+		.comp = comp,
+		.sums = sums,
+	};
+	long long giant = 0;
+
+	if (graph->num_nodes == 0)
+		return;
+
+	cc.giant = sample_giant(&cc);
+	os_parallel_for(tp, 0, graph->num_nodes, 0, clear_sums_range, &cc);
+	os_parallel_reduce(tp, 0, graph->num_nodes, 0, sum_range, add_sums,
+			   &giant, sizeof(giant), &cc);
+	atomic_fetch_add_explicit(&sums[cc.giant], giant, memory_order_relaxed);
+}
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Connected components on the thread pool: lock-free union-find over the
+ * edges, after Sutton, Ben-Nun and Barak, "Optimizing Parallel Graph
+ * Connectivity Computation via Subgraph Sampling" (Afforest, IPDPS 2018).
+ *
+ * Every node starts as its own tree. Linking two trees hooks the root
+ * with the bigger id under the other with a CAS, so a tree's root is
+ * always its smallest node. The first CC_NEIGHBOR_ROUNDS neighbours of
+ * every node are linked first, which mostly settles the giant component
+ * if there is one; its label is then guessed from CC_SAMPLES random nodes,
+ * and the rest of the edges are only linked for nodes outside of it.
+ */
+
+#ifndef __OS_CC_H__
+#define __OS_CC_H__	1
+
+#include <stdatomic.h>
+
+#include "os_graph.h"
+#include "os_threadpool.h"
+
+#define CC_NEIGHBOR_ROUNDS	2
+#define CC_SAMPLES		1024
+
+/*
+ * Set comp[i] to the smallest node in i's component. Returns the number
+ * of components.
+ */
+unsigned int cc_labels(os_threadpool_t *tp, os_graph_t *graph, _Atomic unsigned int *comp);
+
+/*
+ * Add up info over each component: sums[r] for every root r, i.e. every
+ * node with comp[r] == r, is the sum over its component. The other
+ * entries are left alone.
+ */
+void cc_sums(os_threadpool_t *tp, os_graph_t *graph, _Atomic unsigned int *comp,
+	     _Atomic long long *sums);
+
+#endif
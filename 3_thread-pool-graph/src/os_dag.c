@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+
+#include "os_dag.h"
+#include "log/log.h"
+#include "utils.h"
+
+/* Ready dependents are enqueued this many at a time. */
+#define DAG_READY_BATCH		64
+
+/* Stands for the successor list of a finished task. */
+static os_dag_edge_t sealed;
+
+os_dag_task_t *dag_task_create(os_threadpool_t *tp, void (*action)(void *),
+			       void *arg, void (*destroy_arg)(void *))
+{
+	os_dag_task_t *task = malloc(sizeof(*task));
+
+	DIE(task == NULL, "malloc");
+	task->tp = tp;
+	task->action = action;
+	task->argument = arg;
+	task->destroy_arg = destroy_arg;
+	atomic_init(&task->predecessors, 1);
+	atomic_init(&task->successors, NULL);
+	atomic_init(&task->refs, 2);
+	task->group = NULL;
+	task->num_inline = 0;
+	return task;
+}
+
+static int is_inline(os_dag_edge_t *edge)
+{
+	os_dag_edge_t *first = edge->task->inline_edges;
+
+	return edge >= first && edge < first + DAG_INLINE_EDGES;
+}
+
+static void dag_task_put(os_dag_task_t *task)
+{
+	if (atomic_fetch_sub_explicit(&task->refs, 1, memory_order_acq_rel) == 1)
+		free(task);
+}
+
+void dag_task_release(os_dag_task_t *task)
+{
+	dag_task_put(task);
+}
+
+void dag_task_join(os_dag_task_t *task, os_task_group_t *tg)
+{
+	task->group = tg;
+	tg_expect(tg);
+}
+
+int dag_task_done(os_dag_task_t *task)
+{
+	return atomic_load_explicit(&task->successors, memory_order_acquire) == &sealed;
+}
+
+void dag_task_depend(os_dag_task_t *task, os_dag_task_t *before)
+{
+	os_dag_edge_t *edge, *head;
+
+	/* counted first, so that before finishing right away cannot miss it */
+	atomic_fetch_add_explicit(&task->predecessors, 1, memory_order_relaxed);
+
+	if (task->num_inline < DAG_INLINE_EDGES) {
+		edge = &task->inline_edges[task->num_inline++];
+	} else {
+		edge = malloc(sizeof(*edge));
+		DIE(edge == NULL, "malloc");
+	}
+	edge->task = task;
+	head = atomic_load_explicit(&before->successors, memory_order_acquire);
+	do {
+		if (head == &sealed) {
+			/* before has finished already; the submit hold keeps this above 0 */
+			if (is_inline(edge))
+				task->num_inline--;
+			else
+				free(edge);
+			atomic_fetch_sub_explicit(&task->predecessors, 1, memory_order_relaxed);
+			return;
+		}
+		edge->next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&before->successors, &head, edge,
+							memory_order_release,
+							memory_order_acquire));
+}
+
+static void dag_run(void *arg);
+
+static void dag_enqueue(os_threadpool_t *tp, os_dag_task_t **ready, unsigned int n)
+{
+	os_task_t *tasks[DAG_READY_BATCH];
+
+	for (unsigned int i = 0; i < n; ++i) {
+		tasks[i] = create_task(dag_run, ready[i], NULL);
+		/* counted off by the pool once dag_run returns */
+		tasks[i]->group = ready[i]->group;
+	}
+	enqueue_tasks(tp, tasks, n);
+}
+
+/* Count down a predecessor; true if that was the last one. */
+static int dag_task_unblock(os_dag_task_t *task)
+{
+	return atomic_fetch_sub_explicit(&task->predecessors, 1, memory_order_acq_rel) == 1;
+}
+
+void dag_task_submit(os_dag_task_t *task)
+{
+	if (dag_task_unblock(task))
+		dag_enqueue(task->tp, &task, 1);
+}
+
+static void dag_run(void *arg)
+{
+	os_dag_task_t *task = arg, *ready[DAG_READY_BATCH];
+	os_dag_edge_t *edge;
+	unsigned int n = 0;
+
+	if (task->action != NULL)
+		task->action(task->argument);
+	if (task->destroy_arg != NULL)
+		task->destroy_arg(task->argument);
+
+	edge = atomic_exchange_explicit(&task->successors, &sealed, memory_order_acq_rel);
+	while (edge != NULL) {
+		/* an inline edge may be gone as soon as its task is unblocked */
+		os_dag_edge_t *next = edge->next;
+		int owned = !is_inline(edge);
+
+		if (dag_task_unblock(edge->task)) {
+			ready[n++] = edge->task;
+			if (n == DAG_READY_BATCH) {
+				dag_enqueue(task->tp, ready, n);
+				n = 0;
+			}
+		}
+		if (owned)
+			free(edge);
+		edge = next;
+	}
+	dag_enqueue(task->tp, ready, n);
+	dag_task_put(task);
+}
+
+/* An empty task after task, in a group of its own, which a worker helps with. */
+void dag_task_wait(os_dag_task_t *task)
+{
+	os_dag_task_t *after = dag_task_create(task->tp, NULL, NULL, NULL);
+	os_task_group_t tg;
+
+	tg_init(&tg, task->tp);
+	dag_task_join(after, &tg);
+	dag_task_depend(after, task);
+	dag_task_submit(after);
+	dag_task_release(after);
+	tg_destroy(&tg);
+}
+
+os_dag_task_t *task_then(os_dag_task_t *task, void (*action)(void *),
+			 void *arg, void (*destroy_arg)(void *))
+{
+	os_dag_task_t *next = dag_task_create(task->tp, action, arg, destroy_arg);
+
+	dag_task_depend(next, task);
+	dag_task_submit(next);
+	return next;
+}
+
+os_dag_task_t *task_when_all(os_threadpool_t *tp, os_dag_task_t **tasks, unsigned int n)
+{
+	os_dag_task_t *all = dag_task_create(tp, NULL, NULL, NULL);
+
+	for (unsigned int i = 0; i < n; ++i)
+		dag_task_depend(all, tasks[i]);
+	dag_task_submit(all);
+	return all;
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Task graphs on top of os_threadpool: tasks with handles, which run once
+ * every task they depend on has finished.
+ *
+ * A task counts its unfinished predecessors, plus one until it is
+ * submitted, and keeps the tasks that depend on it in a lock-free list.
+ * When a task finishes, it seals that list and counts down each
+ * dependent; the dependents that reach zero are enqueued from the
+ * finishing worker, i.e. onto its own deque, where it picks them up next.
+ *
+ * Dependencies of a task are added by one thread, before it is submitted;
+ * an edge lives in the task that waits, which outlives it. The creator
+ * owns a reference to the handle and drops it with dag_task_release();
+ * the task itself stays alive until it has run.
+ *
+ * A task may join a task group before it is submitted, so that tg_wait()
+ * covers it and a graph runs on a pool that outlives it; dag_task_wait()
+ * waits for a single task.
+ */
+
+#ifndef __OS_DAG_H__
+#define __OS_DAG_H__	1
+
+#include <stdatomic.h>
+
+#include "os_threadpool.h"
+
+#define DAG_INLINE_EDGES	4
+
+typedef struct os_dag_edge {
+	struct os_dag_task *task;
+	struct os_dag_edge *next;
+} os_dag_edge_t;
+
+typedef struct os_dag_task {
+	os_threadpool_t *tp;
+	void (*action)(void *arg);
+	void *argument;
+	void (*destroy_arg)(void *arg);
+
+	/* unfinished predecessors, plus one until submitted */
+	atomic_uint predecessors;
+	/* tasks waiting on this one, sealed once it has finished */
+	_Atomic(os_dag_edge_t *) successors;
+	/* the creator's and the run's */
+	atomic_uint refs;
+	/* counts the task until it has run, if it joined one */
+	os_task_group_t *group;
+	/* edges to this task, from its first dependencies; the rest are malloc'd */
+	unsigned int num_inline;
+	os_dag_edge_t inline_edges[DAG_INLINE_EDGES];
+} os_dag_task_t;
+
+/* A task of tp that runs action(arg) once submitted and unblocked. */
+os_dag_task_t *dag_task_create(os_threadpool_t *tp, void (*action)(void *),
+			       void *arg, void (*destroy_arg)(void *));
+
+/* Make task wait for before. Must come before task is submitted. */
+void dag_task_depend(os_dag_task_t *task, os_dag_task_t *before);
+
+/* Let task run as soon as everything it depends on has finished. */
+void dag_task_submit(os_dag_task_t *task);
+
+/* Count task in tg until it has run. Must come before task is submitted. */
+void dag_task_join(os_dag_task_t *task, os_task_group_t *tg);
+
+/* Whether task has run. */
+int dag_task_done(os_dag_task_t *task);
+
+/* Wait for a submitted task to run, the way tg_wait() does. */
+void dag_task_wait(os_dag_task_t *task);
+
+/* Drop the creator's reference. */
+void dag_task_release(os_dag_task_t *task);
+
+/* A submitted task that runs action(arg) once task has finished. */
+os_dag_task_t *task_then(os_dag_task_t *task, void (*action)(void *),
+			 void *arg, void (*destroy_arg)(void *));
+
+/* A submitted task, with no action, that finishes after all n tasks. */
+os_dag_task_t *task_when_all(os_threadpool_t *tp, os_dag_task_t **tasks, unsigned int n);
+
+#endif
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdlib.h>
+
+#include "os_deque.h"
+#include "log/log.h"
+#include "utils.h"
+
+static os_deque_ring_t *ring_create(long capacity)
+{
+	os_deque_ring_t *ring;
+
+	ring = malloc(sizeof(*ring) + capacity * sizeof(ring->slots[0]));
+	DIE(ring == NULL, "malloc");
+
+	ring->capacity = capacity;
+	ring->retired = NULL;
+	return ring;
+}
+
+/* Copy the live items [top, bottom) to a ring twice as big. */
+static os_deque_ring_t *ring_grow(os_deque_t *dq, os_deque_ring_t *ring, long top, long bottom)
+{
+	os_deque_ring_t *bigger = ring_create(2 * ring->capacity);
+
+	for (long i = top; i < bottom; i++) {
+		void *item = atomic_load_explicit(&ring->slots[i & (ring->capacity - 1)],
+						  memory_order_relaxed);
+
+		atomic_store_explicit(&bigger->slots[i & (bigger->capacity - 1)], item,
+				      memory_order_relaxed);
+	}
+	bigger->retired = ring;
+	atomic_store_explicit(&dq->ring, bigger, memory_order_release);
+	return bigger;
+}
+
+void deque_init(os_deque_t *dq)
+{
+	atomic_init(&dq->top, 0);
+	atomic_init(&dq->bottom, 0);
+	atomic_init(&dq->ring, ring_create(DEQUE_INITIAL_CAPACITY));
+}
+
+void deque_destroy(os_deque_t *dq)
+{
+	os_deque_ring_t *ring = atomic_load(&dq->ring);
+
+	while (ring != NULL) {
+		os_deque_ring_t *retired = ring->retired;
+
+		free(ring);
+		ring = retired;
+	}
+}
+
+void deque_push(os_deque_t *dq, void *item)
+{
+	long bottom = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+	long top = atomic_load_explicit(&dq->top, memory_order_acquire);
+	os_deque_ring_t *ring = atomic_load_explicit(&dq->ring, memory_order_relaxed);
+
+	if (bottom - top > ring->capacity - 1)
+		ring = ring_grow(dq, ring, top, bottom);
+
+	atomic_store_explicit(&ring->slots[bottom & (ring->capacity - 1)], item,
+			      memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&dq->bottom, bottom + 1, memory_order_relaxed);
+}
+
+void *deque_pop(os_deque_t *dq)
+{
+	long bottom = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+	os_deque_ring_t *ring = atomic_load_explicit(&dq->ring, memory_order_relaxed);
+	long top;
+	void *item = NULL;
+
+	atomic_store_explicit(&dq->bottom, bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	top = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+	if (top <= bottom) {
+		item = atomic_load_explicit(&ring->slots[bottom & (ring->capacity - 1)],
+					    memory_order_relaxed);
+		if (top == bottom) {
+			/* last item: race the thieves for it */
+			if (!atomic_compare_exchange_strong_explicit(&dq->top, &top, top + 1,
+								     memory_order_seq_cst,
+								     memory_order_relaxed))
+				item = NULL;
+			atomic_store_explicit(&dq->bottom, bottom + 1, memory_order_relaxed);
+		}
+	} else {
+		atomic_store_explicit(&dq->bottom, bottom + 1, memory_order_relaxed);
+	}
+	return item;
+}
+
+void *deque_steal(os_deque_t *dq)
+{
+	long top = atomic_load_explicit(&dq->top, memory_order_acquire);
+	long bottom;
+	void *item = NULL;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	bottom = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+
+	if (top < bottom) {
+		os_deque_ring_t *ring = atomic_load_explicit(&dq->ring, memory_order_acquire);
+
+		item = atomic_load_explicit(&ring->slots[top & (ring->capacity - 1)],
+					    memory_order_relaxed);
+		if (!atomic_compare_exchange_strong_explicit(&dq->top, &top, top + 1,
+							     memory_order_seq_cst,
+							     memory_order_relaxed))
+			return NULL;
+	}
+	return item;
+}
+
+long deque_size(os_deque_t *dq)
+{
+	long bottom = atomic_load_explicit(&dq->bottom, memory_order_seq_cst);
+	long top = atomic_load_explicit(&dq->top, memory_order_seq_cst);
+
+	return bottom > top ? bottom - top : 0;
+}
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Chase-Lev work-stealing deque, with the C11 memory orderings of
+ * Le, Pop, Cohen and Zappa Nardelli, "Correct and Efficient Work-Stealing
+ * for Weak Memory Models" (PPoPP 2013).
+ *
+ * The owner thread pushes and pops at the bottom end without taking any
+ * lock; any other thread may steal from the top end, and only a steal or
+ * a pop of the last item pays for a compare-and-swap. The ring grows by
+ * doubling when the owner pushes into a full one. Rings outgrown are kept
+ * until the deque is destroyed, as a thief may still be reading one.
+ */
+
+#ifndef __OS_DEQUE_H__
+#define __OS_DEQUE_H__	1
+
+#include <stdatomic.h>
+
+#define DEQUE_INITIAL_CAPACITY	256
+
+typedef struct os_deque_ring {
+	long capacity;
+	struct os_deque_ring *retired;
+	_Atomic(void *) slots[];
+} os_deque_ring_t;
+
+typedef struct os_deque {
+	/* stealers race on top, bottom is only written by the owner */
+	atomic_long top __attribute__((aligned(64)));
+	atomic_long bottom __attribute__((aligned(64)));
+	_Atomic(os_deque_ring_t *) ring;
+} os_deque_t;
+
+void deque_init(os_deque_t *dq);
+void deque_destroy(os_deque_t *dq);
+
+/* Owner only. */
+void deque_push(os_deque_t *dq, void *item);
+void *deque_pop(os_deque_t *dq);
+
+/* Any thread. NULL if the deque is empty or another thread won the item. */
+void *deque_steal(os_deque_t *dq);
+
+/* Any thread. A snapshot, which may be stale by the time it returns. */
+long deque_size(os_deque_t *dq);
+
+#endif
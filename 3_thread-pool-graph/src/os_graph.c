@@ -1,115 +1,391 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "os_graph.h"
 #include "log/log.h"
 #include "utils.h"
 
-/* Node functions */
-os_node_t *os_create_node(unsigned int id, int info)
-{
-	os_node_t *node;
-
-	node = malloc(sizeof(*node));
-	DIE(node == NULL, "mallloc");
-
-	node->id = id;
-	node->info = info;
-	node->num_neighbours = 0;
-	node->neighbours = NULL;
+/* Text bigger than this is parsed by more than one thread. */
+#define PARSE_CHUNK_MIN		(256 * 1024)
+#define PARSE_THREADS_MAX	16
 
-	return node;
-}
+typedef struct parse_chunk_t {
+	const char *begin, *end;
+	/* where the chunk's numbers go, NULL while counting them */
+	int *out;
+	size_t count;
+	int error;
+} parse_chunk_t;
 
 /* Graph functions */
+
+/* Count the degrees, turn them into offsets, then drop each edge in place. */
 os_graph_t *create_graph_from_data(unsigned int num_nodes, unsigned int num_edges,
 		int *values, os_edge_t *edges)
 {
 	os_graph_t *graph;
+	unsigned int *cursor;
 
 	graph = malloc(sizeof(*graph));
 	DIE(graph == NULL, "mallloc");
 
 	graph->num_nodes = num_nodes;
 	graph->num_edges = num_edges;
+	graph->mapping = NULL;
+	graph->mapping_size = 0;
 
-	graph->nodes = malloc(num_nodes * sizeof(os_node_t *));
-	DIE(graph->nodes == NULL, "malloc");
+	graph->offsets = calloc(num_nodes + 1, sizeof(*graph->offsets));
+	DIE(graph->offsets == NULL, "calloc");
+	graph->targets = malloc(2 * (size_t)num_edges * sizeof(*graph->targets));
+	DIE(num_edges && graph->targets == NULL, "malloc");
+	graph->info = malloc(num_nodes * sizeof(*graph->info));
+	DIE(num_nodes && graph->info == NULL, "malloc");
 
-	for (unsigned int i = 0; i < graph->num_nodes; i++) {
-		graph->nodes[i] = os_create_node(i, values[i]);
-		graph->nodes[i]->neighbours = malloc(graph->num_nodes * sizeof(unsigned int));
-		DIE(graph->nodes[i]->neighbours == NULL, "malloc");
-		graph->nodes[i]->num_neighbours = 0;
+	for (unsigned int i = 0; i < num_edges; i++) {
+		DIE(edges[i].src >= num_nodes || edges[i].dst >= num_nodes, "edge out of range");
+		graph->offsets[edges[i].src + 1]++;
+		graph->offsets[edges[i].dst + 1]++;
 	}
+	for (unsigned int i = 0; i < num_nodes; i++)
+		graph->offsets[i + 1] += graph->offsets[i];
 
-	for (unsigned int i = 0; i < graph->num_edges; i++) {
-		unsigned int isrc, idst;
-
-		isrc = edges[i].src;
-		idst = edges[i].dst;
-		graph->nodes[isrc]->neighbours[graph->nodes[isrc]->num_neighbours++] = idst;
-		graph->nodes[idst]->neighbours[graph->nodes[idst]->num_neighbours++] = isrc;
+	cursor = malloc(num_nodes * sizeof(*cursor));
+	DIE(num_nodes && cursor == NULL, "malloc");
+	memcpy(cursor, graph->offsets, num_nodes * sizeof(*cursor));
+	for (unsigned int i = 0; i < num_edges; i++) {
+		graph->targets[cursor[edges[i].src]++] = edges[i].dst;
+		graph->targets[cursor[edges[i].dst]++] = edges[i].src;
 	}
+	free(cursor);
+
+	memcpy(graph->info, values, num_nodes * sizeof(*graph->info));
 
 	graph->visited = malloc(graph->num_nodes * sizeof(*graph->visited));
 	DIE(graph->visited == NULL, "malloc");
 
 	for (unsigned int i = 0; i < graph->num_nodes; i++)
-		graph->visited[i] = NOT_VISITED;
+		atomic_init(&graph->visited[i], NOT_VISITED);
 
 	return graph;
 }
 
-os_graph_t *create_graph_from_file(FILE *file)
+/* Spaces, newlines and any other control character separate numbers. */
+static inline int is_blank(char c)
+{
+	return (unsigned char)c <= ' ';
+}
+
+/* A number starts wherever a blank is followed by anything else. */
+static void *count_chunk(void *arg)
+{
+	parse_chunk_t *chunk = arg;
+	size_t size = chunk->end - chunk->begin;
+	size_t count;
+
+	if (size == 0) {
+		chunk->count = 0;
+		return NULL;
+	}
+	/* chunks start at a blank or at the start of a number */
+	count = !is_blank(chunk->begin[0]);
+	for (size_t i = 1; i < size; i++)
+		count += is_blank(chunk->begin[i - 1]) & !is_blank(chunk->begin[i]);
+	chunk->count = count;
+	return NULL;
+}
+
+static void *parse_chunk(void *arg)
+{
+	parse_chunk_t *chunk = arg;
+	const char *p = chunk->begin;
+	int *out = chunk->out;
+
+	while (p < chunk->end) {
+		unsigned int value = 0;
+		int negative = 0;
+		const char *digits;
+
+		if (is_blank(*p)) {
+			p++;
+			continue;
+		}
+		if (*p == '-') {
+			negative = 1;
+			p++;
+		}
+		digits = p;
+		while (p < chunk->end && *p >= '0' && *p <= '9')
+			value = value * 10 + (*p++ - '0');
+		if (p == digits || (p < chunk->end && !is_blank(*p))) {
+			chunk->error = 1;
+			break;
+		}
+		*out++ = negative ? -(int)value : (int)value;
+	}
+	return NULL;
+}
+
+/* Run fn on every chunk, the first one on the calling thread. */
+static void run_chunks(void *(*fn)(void *), parse_chunk_t *chunks, unsigned int num_chunks)
+{
+	pthread_t threads[PARSE_THREADS_MAX];
+
+	for (unsigned int i = 1; i < num_chunks; i++)
+		DIE(pthread_create(&threads[i], NULL, fn, &chunks[i]) != 0, "pthread_create");
+	fn(&chunks[0]);
+	for (unsigned int i = 1; i < num_chunks; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/*
+ * The text is one stream of numbers: the node and edge counts, the values
+ * and the edge ends. Cut it into chunks at blanks, count the numbers in
+ * each to learn where its share of the stream starts, then parse all the
+ * chunks straight into place.
+ */
+os_graph_t *create_graph_from_text(const char *text, size_t size)
 {
+	parse_chunk_t chunks[PARSE_THREADS_MAX];
+	unsigned int num_chunks = size / PARSE_CHUNK_MIN;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
 	unsigned int num_nodes, num_edges;
-	unsigned int i;
-	int *nodes;
-	os_edge_t *edges;
+	size_t total = 0;
+	int *numbers;
 	os_graph_t *graph = NULL;
 
-	if (fscanf(file, "%d %d", &num_nodes, &num_edges) == 0) {
-		log_error("Can't read from file");
-		goto out;
+	if (num_chunks > PARSE_THREADS_MAX)
+		num_chunks = PARSE_THREADS_MAX;
+	if (cpus > 0 && num_chunks > cpus)
+		num_chunks = cpus;
+	if (num_chunks == 0)
+		num_chunks = 1;
+
+	for (unsigned int i = 0; i < num_chunks; i++) {
+		size_t begin = i * (size / num_chunks);
+
+		while (begin > 0 && begin < size && !is_blank(text[begin - 1]))
+			begin++;
+		chunks[i].begin = text + begin;
+		chunks[i].error = 0;
+		if (i > 0)
+			chunks[i - 1].end = chunks[i].begin;
 	}
+	chunks[num_chunks - 1].end = text + size;
+
+	run_chunks(count_chunk, chunks, num_chunks);
+	for (unsigned int i = 0; i < num_chunks; i++)
+		total += chunks[i].count;
+
+	numbers = malloc((total + 1) * sizeof(*numbers));
+	DIE(numbers == NULL, "malloc");
+	chunks[0].out = numbers;
+	for (unsigned int i = 1; i < num_chunks; i++)
+		chunks[i].out = chunks[i - 1].out + chunks[i - 1].count;
+	run_chunks(parse_chunk, chunks, num_chunks);
 
-	nodes = malloc(num_nodes * sizeof(int));
-	DIE(nodes == NULL, "malloc");
-	for (i = 0; i < num_nodes; i++) {
-		if (fscanf(file, "%d", &nodes[i]) == 0) {
+	for (unsigned int i = 0; i < num_chunks; i++) {
+		if (chunks[i].error) {
 			log_error("Can't read from file");
-			goto free_nodes;
+			goto out;
 		}
 	}
+	if (total < 2) {
+		log_error("Can't read from file");
+		goto out;
+	}
+	num_nodes = numbers[0];
+	num_edges = numbers[1];
+	if (total < 2 + (size_t)num_nodes + 2 * (size_t)num_edges) {
+		log_error("Can't read from file");
+		goto out;
+	}
 
-	edges = malloc(num_edges * sizeof(os_edge_t));
-	DIE(edges == NULL, "malloc");
-	for (i = 0; i < num_edges; ++i) {
-		if (fscanf(file, "%d %d", &edges[i].src, &edges[i].dst) == 0) {
-			log_error("Can't read from file");
-			goto free_edges;
+	graph = create_graph_from_data(num_nodes, num_edges, numbers + 2,
+				       (os_edge_t *)(numbers + 2 + num_nodes));
+
+out:
+	free(numbers);
+	return graph;
+}
+
+/*
+ * A mapped file is used as it is, so check once that every neighbour list
+ * lies inside the targets and names a node that exists.
+ */
+static int graph_well_formed(os_graph_t *graph)
+{
+	size_t entries = 2 * (size_t)graph->num_edges;
+
+	if (graph->offsets[0] != 0 || graph->offsets[graph->num_nodes] != entries)
+		return 0;
+	for (unsigned int i = 0; i < graph->num_nodes; i++)
+		if (graph->offsets[i] > graph->offsets[i + 1])
+			return 0;
+	for (size_t i = 0; i < entries; i++)
+		if (graph->targets[i] >= graph->num_nodes)
+			return 0;
+	return 1;
+}
+
+/*
+ * Point the graph straight into a read-only mapping of a binary file; only
+ * the visited array is allocated. The file is checked before it is used.
+ */
+os_graph_t *map_graph_file(int fd, size_t size)
+{
+	os_graph_header_t *header;
+	size_t expected;
+	os_graph_t *graph;
+
+	if (size < sizeof(*header)) {
+		log_error("Bad graph file");
+		return NULL;
+	}
+	header = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	DIE(header == MAP_FAILED, "mmap");
+
+	expected = sizeof(*header) + sizeof(uint32_t) *
+		   (2 * (size_t)header->num_nodes + 1 + 2 * (size_t)header->num_edges);
+	if (memcmp(header->magic, GRAPH_MAGIC, sizeof(header->magic))
+	    || header->version != GRAPH_VERSION || size != expected) {
+		log_error("Bad graph file");
+		munmap(header, size);
+		return NULL;
+	}
+	/* every page is about to be walked, start reading them in */
+	madvise(header, size, MADV_WILLNEED);
+
+	graph = malloc(sizeof(*graph));
+	DIE(graph == NULL, "malloc");
+
+	graph->num_nodes = header->num_nodes;
+	graph->num_edges = header->num_edges;
+	graph->mapping = header;
+	graph->mapping_size = size;
+	graph->info = (int *)(header + 1);
+	graph->offsets = (unsigned int *)(graph->info + graph->num_nodes);
+	graph->targets = graph->offsets + graph->num_nodes + 1;
+
+	if (!graph_well_formed(graph)) {
+		log_error("Bad graph file");
+		munmap(header, size);
+		free(graph);
+		return NULL;
+	}
+
+	graph->visited = malloc(graph->num_nodes * sizeof(*graph->visited));
+	DIE(graph->num_nodes && graph->visited == NULL, "malloc");
+
+	for (unsigned int i = 0; i < graph->num_nodes; i++)
+		atomic_init(&graph->visited[i], NOT_VISITED);
+
+	return graph;
+}
+
+/* Read what is left of a file that cannot be mapped, such as a pipe. */
+static char *read_whole_file(FILE *file, size_t *size)
+{
+	size_t capacity = 64 * 1024, n;
+	char *text = malloc(capacity);
+
+	DIE(text == NULL, "malloc");
+	*size = 0;
+	while ((n = fread(text + *size, 1, capacity - *size, file)) > 0) {
+		*size += n;
+		if (*size == capacity) {
+			capacity *= 2;
+			text = realloc(text, capacity);
+			DIE(text == NULL, "realloc");
 		}
 	}
+	return text;
+}
+
+os_graph_t *create_graph_from_file(FILE *file)
+{
+	int fd = fileno(file);
+	struct stat st;
+	os_graph_t *graph;
+	size_t size;
+	char *text;
 
-	graph = create_graph_from_data(num_nodes, num_edges, nodes, edges);
+	DIE(fstat(fd, &st) < 0, "fstat");
 
-free_edges:
-	free(edges);
-free_nodes:
-	free(nodes);
-out:
+	if (!S_ISREG(st.st_mode)) {
+		text = read_whole_file(file, &size);
+		graph = create_graph_from_text(text, size);
+		free(text);
+		return graph;
+	}
+
+	size = st.st_size;
+	if (size == 0) {
+		log_error("Can't read from file");
+		return NULL;
+	}
+	if (size >= sizeof(os_graph_header_t)) {
+		os_graph_header_t header;
+
+		if (pread(fd, &header, sizeof(header), 0) == sizeof(header)
+		    && memcmp(header.magic, GRAPH_MAGIC, sizeof(header.magic)) == 0)
+			return map_graph_file(fd, size);
+	}
+
+	text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	DIE(text == MAP_FAILED, "mmap");
+	madvise(text, size, MADV_SEQUENTIAL);
+	graph = create_graph_from_text(text, size);
+	munmap(text, size);
 	return graph;
 }
 
+int write_graph_file(os_graph_t *graph, FILE *file)
+{
+	os_graph_header_t header = {
+		.magic = GRAPH_MAGIC,
+		.version = GRAPH_VERSION,
+		.num_nodes = graph->num_nodes,
+		.num_edges = graph->num_edges,
+	};
+	size_t num_targets = 2 * (size_t)graph->num_edges;
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1
+	    || fwrite(graph->info, sizeof(*graph->info), graph->num_nodes, file) != graph->num_nodes
+	    || fwrite(graph->offsets, sizeof(*graph->offsets), graph->num_nodes + 1, file)
+	       != graph->num_nodes + 1
+	    || fwrite(graph->targets, sizeof(*graph->targets), num_targets, file) != num_targets)
+		return -1;
+	return 0;
+}
+
+void destroy_graph(os_graph_t *graph)
+{
+	if (graph->mapping != NULL) {
+		munmap(graph->mapping, graph->mapping_size);
+	} else {
+		free(graph->offsets);
+		free(graph->targets);
+		free(graph->info);
+	}
+	free(graph->visited);
+	free(graph);
+}
+
 void print_graph(os_graph_t *graph)
 {
 	for (unsigned int i = 0; i < graph->num_nodes; i++) {
+		unsigned int *neighbours = graph_neighbours(graph, i);
+
 		printf("[%d]: ", i);
-		for (unsigned int j = 0; j < graph->nodes[i]->num_neighbours; j++)
-			printf("%d ", graph->nodes[i]->neighbours[j]);
+		for (unsigned int j = 0; j < graph_degree(graph, i); j++)
+			printf("%d ", neighbours[j]);
 		printf("\n");
 	}
 }
@@ -3,36 +3,77 @@
 #ifndef __OS_GRAPH_H__
 #define __OS_GRAPH_H__	1
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdatomic.h>
 
-typedef struct os_node_t {
-	unsigned int id;
-	int info;
-
-	unsigned int num_neighbours;
-	unsigned int *neighbours;
-} os_node_t;
+typedef enum {
+	NOT_VISITED = 0,
+	PROCESSING = 1,
+	DONE = 2
+} os_visit_t;
 
+/*
+ * Undirected graph in compressed sparse row form: the neighbours of node
+ * i are targets[offsets[i]] up to targets[offsets[i + 1] - 1], in the
+ * order their edges were given, so every edge shows up once at each of
+ * its ends. offsets has num_nodes + 1 entries, targets 2 * num_edges.
+ */
 typedef struct os_graph_t {
 	unsigned int num_nodes;
 	unsigned int num_edges;
 
-	os_node_t **nodes;
-	enum {
-		NOT_VISITED = 0,
-		PROCESSING = 1,
-		DONE = 2
-	} *visited;
+	unsigned int *offsets;
+	unsigned int *targets;
+	int *info;
+	/* parallel walkers claim a node by moving it out of NOT_VISITED */
+	_Atomic os_visit_t *visited;
+
+	/* a binary graph file the arrays above point into, or NULL */
+	void *mapping;
+	size_t mapping_size;
 } os_graph_t;
 
+/*
+ * Binary graph file: this header, then info[num_nodes],
+ * offsets[num_nodes + 1] and targets[2 * num_edges], all 32 bit and in
+ * the byte order of the machine that wrote it. The arrays are laid out
+ * the way os_graph_t holds them, so a loaded file is used in place.
+ */
+#define GRAPH_MAGIC		"OSGRAPH"
+#define GRAPH_VERSION		1
+
+typedef struct os_graph_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_nodes;
+	uint32_t num_edges;
+	uint32_t reserved;
+} os_graph_header_t;
+
 typedef struct os_edge_t {
 	unsigned int src, dst;
 } os_edge_t;
 
-os_node_t *os_create_node(unsigned int id, int info);
+static inline unsigned int graph_degree(os_graph_t *graph, unsigned int node)
+{
+	return graph->offsets[node + 1] - graph->offsets[node];
+}
+
+static inline unsigned int *graph_neighbours(os_graph_t *graph, unsigned int node)
+{
+	return graph->targets + graph->offsets[node];
+}
+
 os_graph_t *create_graph_from_data(unsigned int num_nodes, unsigned int num_edges,
 		int *values, os_edge_t *edges);
+/* Either format, told apart by the magic. */
 os_graph_t *create_graph_from_file(FILE *file);
+os_graph_t *create_graph_from_text(const char *text, size_t size);
+os_graph_t *map_graph_file(int fd, size_t size);
+int write_graph_file(os_graph_t *graph, FILE *file);
+void destroy_graph(os_graph_t *graph);
 void print_graph(os_graph_t *graph);
 
 #endif
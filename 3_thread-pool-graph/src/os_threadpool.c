@@ -1,68 +1,142 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
 #include <unistd.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
 
 #include "os_threadpool.h"
 #include "log/log.h"
 #include "utils.h"
 
-#ifdef DEBUG_WORKLOAD
-static unsigned long long thread_work[4] = {0};
-static unsigned long long thread_id[4] = {0};
-static int thread_maped;
+#define STEAL_ROUNDS	64
+/* how long a worker waiting for a job naps between looking for tasks */
+#define HELP_NAP_NS	1000000
+
+/* The worker the calling thread is, NULL outside of any pool. */
+static __thread os_worker_t *current_worker;
 
-void addwork(unsigned long long task_id)
+#ifdef DEBUG_WORKLOAD
+static void printwork(os_threadpool_t *tp)
 {
-	unsigned long long i = 0;
-	unsigned long long fnd = 0;
+	for (unsigned int i = 0; i < tp->num_threads; ++i)
+		log_error("Thread: %u --> tasks# %llu (%llu stolen)\n", i,
+			  tp->workers[i].tasks_run, tp->workers[i].tasks_stolen);
+}
+#endif
+/*
+ * Task descriptors are recycled through a cache per thread, so creating
+ * and destroying a task is a couple of pointer moves. A task usually dies
+ * on another thread than the one that created it, so caches that grow
+ * past TASK_CACHE_MAX hand TASK_CACHE_BATCH tasks over to a shared depot,
+ * and empty ones take a batch back from it before they fall back to
+ * malloc(). Cached tasks are chained through list.next, batches in the
+ * depot through the list.prev of their first task.
+ */
+#define TASK_CACHE_MAX		512
+#define TASK_CACHE_BATCH	256
 
-	for (i = 0 ; i < 4; ++i) {
-		if (thread_id[i] == task_id) {
-			fnd = 1;
-			break;
-		}
-	}
+static __thread struct {
+	os_task_t *free;
+	unsigned int count;
+} task_cache;
 
-	if (!fnd || i >= 4) {
-		i = thread_maped;
-		thread_id[i] = task_id;
-		thread_maped++;
-	}
+static pthread_mutex_t depot_lock = PTHREAD_MUTEX_INITIALIZER;
+static os_task_t *depot;
 
-	thread_work[i]++;
+#define task_next(t)	((os_task_t *)(t)->list.next)
+#define batch_next(t)	((os_task_t *)(t)->list.prev)
+
+static void depot_put(os_task_t *batch)
+{
+	pthread_mutex_lock(&depot_lock);
+	batch->list.prev = (os_list_node_t *)depot;
+	depot = batch;
+	pthread_mutex_unlock(&depot_lock);
 }
 
-int getwork(unsigned long long task_id)
+static os_task_t *depot_get(void)
 {
-	int i = 0;
+	os_task_t *batch;
+
+	pthread_mutex_lock(&depot_lock);
+	batch = depot;
+	if (batch != NULL)
+		depot = batch_next(batch);
+	pthread_mutex_unlock(&depot_lock);
+	return batch;
+}
 
-	for (i = 0 ; i < 4; ++i) {
-		if (thread_id[i] == task_id)
-			return thread_work[i];
+/* Hand the calling thread's whole cache to the depot, as its thread exits. */
+static void task_cache_flush(void)
+{
+	while (task_cache.free != NULL) {
+		os_task_t *batch = task_cache.free, *last = batch;
+		unsigned int n = 1;
+
+		while (n < TASK_CACHE_BATCH && task_next(last) != NULL) {
+			last = task_next(last);
+			n++;
+		}
+		task_cache.free = task_next(last);
+		last->list.next = NULL;
+		depot_put(batch);
 	}
-	return -1;
+	task_cache.count = 0;
 }
 
-int printwork(void)
+static os_task_t *task_alloc(void)
 {
-	for (int i = 0 ; i < 4; ++i)
-		log_error("Thread: %lu --> tasks# %lu\n", thread_id[i], thread_work[i]);
+	os_task_t *t = task_cache.free;
+
+	if (t == NULL) {
+		t = depot_get();
+		if (t == NULL) {
+			t = malloc(sizeof(*t));
+			DIE(t == NULL, "malloc");
+			return t;
+		}
+		/* the last batch a thread flushes may be short */
+		task_cache.count = 0;
+		for (os_task_t *c = t; c != NULL; c = task_next(c))
+			task_cache.count++;
+	}
+	task_cache.free = task_next(t);
+	task_cache.count--;
+	return t;
 }
-#endif
+
+static void task_release(os_task_t *t)
+{
+	if (task_cache.count == TASK_CACHE_MAX) {
+		/* the newest TASK_CACHE_BATCH go, the rest stays */
+		os_task_t *last = task_cache.free;
+
+		for (unsigned int i = 1; i < TASK_CACHE_BATCH; ++i)
+			last = task_next(last);
+		depot_put(task_cache.free);
+		task_cache.free = task_next(last);
+		last->list.next = NULL;
+		task_cache.count -= TASK_CACHE_BATCH;
+	}
+	t->list.next = (os_list_node_t *)task_cache.free;
+	task_cache.free = t;
+	task_cache.count++;
+}
+
 /* Create a task that would be executed by a thread. */
 os_task_t *create_task(void (*action)(void *), void *arg, void (*destroy_arg)(void *))
 {
-	os_task_t *t;
-
-	t = malloc(sizeof(*t));
-	DIE(t == NULL, "malloc");
+	os_task_t *t = task_alloc();
 
 	t->action = action;		// the function
 	t->argument = arg;		// arguments for the function
 	t->destroy_arg = destroy_arg;	// destroy argument function
+	t->group = NULL;
 	return t;
 }
 
@@ -71,19 +145,60 @@ void destroy_task(os_task_t *t)
 {
 	if (t->destroy_arg != NULL)
 		t->destroy_arg(t->argument);
-	free(t);
+	task_release(t);
 }
 
-/* Put a new task to threadpool task queue. */
-void enqueue_task(os_threadpool_t *tp, os_task_t *t)
+/* Wake up to n sleeping workers after new work was published. */
+static void wake_workers(os_threadpool_t *tp, unsigned int n)
 {
-	assert(tp != NULL);
-	assert(t != NULL);
+	int sleepers;
+
+	/* pairs with the fence in sleep_until_work() */
+	atomic_thread_fence(memory_order_seq_cst);
+	sleepers = atomic_load_explicit(&tp->sleepers, memory_order_relaxed);
+	if (sleepers == 0)
+		return;
 	pthread_mutex_lock(&tp->lock);
-	list_add_tail(&tp->head, &t->list);
+	if (n >= (unsigned int)sleepers) {
+		pthread_cond_broadcast(&tp->cond);
+	} else {
+		while (n-- > 0)
+			pthread_cond_signal(&tp->cond);
+	}
 	pthread_mutex_unlock(&tp->lock);
-	tp->begin = 1;
-	pthread_cond_signal(&tp->cond);
+}
+
+/*
+ * Put a new task to threadpool task queue: the deque of the worker that
+ * calls it, or the shared queue if called from outside the pool.
+ */
+void enqueue_task(os_threadpool_t *tp, os_task_t *t)
+{
+	enqueue_tasks(tp, &t, 1);
+}
+
+/*
+ * Put n tasks at once: the shared queue is locked once for all of them,
+ * and at most n sleeping workers are woken up.
+ */
+void enqueue_tasks(os_threadpool_t *tp, os_task_t **tasks, unsigned int n)
+{
+	os_worker_t *self = current_worker;
+
+	assert(tp != NULL);
+	if (n == 0)
+		return;
+	atomic_fetch_add_explicit(&tp->pending, n, memory_order_relaxed);
+	if (self != NULL && self->tp == tp) {
+		for (unsigned int i = 0; i < n; ++i)
+			deque_push(&self->deque, tasks[i]);
+	} else {
+		pthread_mutex_lock(&tp->lock);
+		for (unsigned int i = 0; i < n; ++i)
+			list_add_tail(&tp->head, &tasks[i]->list);
+		pthread_mutex_unlock(&tp->lock);
+	}
+	wake_workers(tp, n);
 }
 
 /*
@@ -95,53 +210,198 @@ static int queue_is_empty(os_threadpool_t *tp)
 	return list_empty(&tp->head);
 }
 
+/* Whether any task is queued anywhere. Called with tp->lock held. */
+static int work_visible(os_threadpool_t *tp)
+{
+	if (!queue_is_empty(tp))
+		return 1;
+	for (unsigned int i = 0; i < tp->num_threads; ++i)
+		if (deque_size(&tp->workers[i].deque) > 0)
+			return 1;
+	return 0;
+}
+
+static os_task_t *take_shared(os_threadpool_t *tp)
+{
+	os_task_t *t = NULL;
+
+	pthread_mutex_lock(&tp->lock);
+	if (!queue_is_empty(tp)) {
+		t = list_entry(tp->head.next, os_task_t, list);
+		list_del(tp->head.next);
+	}
+	pthread_mutex_unlock(&tp->lock);
+	return t;
+}
+
+/* Try every other worker once, nearest tier first, each from a random one on. */
+static os_task_t *steal_task(os_worker_t *self)
+{
+	os_threadpool_t *tp = self->tp;
+	unsigned int from = 0;
+
+	self->seed ^= self->seed << 13;
+	self->seed ^= self->seed >> 17;
+	self->seed ^= self->seed << 5;
+
+	for (unsigned int tier = 0; tier < TOPO_DISTANCES; from = self->tier_end[tier++]) {
+		unsigned int n = self->tier_end[tier] - from;
+
+		for (unsigned int i = 0; i < n; ++i) {
+			unsigned int victim = self->victims[from + (self->seed + i) % n];
+			os_task_t *t = deque_steal(&tp->workers[victim].deque);
+
+			if (t != NULL) {
+				self->tasks_stolen++;
+				return t;
+			}
+		}
+	}
+	return NULL;
+}
+
+static os_task_t *find_task(os_worker_t *self)
+{
+	os_task_t *t;
+
+	t = deque_pop(&self->deque);
+	if (t == NULL)
+		t = take_shared(self->tp);
+	if (t == NULL)
+		t = steal_task(self);
+	return t;
+}
+
+/* Block until some task is visible or the pool terminates. */
+static void sleep_until_work(os_threadpool_t *tp)
+{
+	pthread_mutex_lock(&tp->lock);
+	atomic_fetch_add(&tp->sleepers, 1);
+	/* pairs with the fence in wake_workers() */
+	atomic_thread_fence(memory_order_seq_cst);
+	while (!atomic_load(&tp->sig_terminate) && !work_visible(tp))
+		pthread_cond_wait(&tp->cond, &tp->lock);
+	atomic_fetch_sub(&tp->sleepers, 1);
+	pthread_mutex_unlock(&tp->lock);
+}
+
 /*
- * Get a task from threadpool task queue.
- * Block if no task is available.
- * Return NULL if work is complete, i.e. no task will become available,
- * i.e. all threads are going to block.
+ * Get a task for the calling worker: from its own deque, the shared queue
+ * or another worker's deque. Block if no task is available.
+ * Return NULL once the pool is shutting down.
  */
-
 os_task_t *dequeue_task(os_threadpool_t *tp)
 {
+	os_worker_t *self = current_worker;
 	os_task_t *t;
 
-	pthread_mutex_lock(&tp->lock);
-	while (queue_is_empty(tp)) {
-		tp->idle_threads = tp->idle_threads + 1;
-		if (tp->idle_threads >= tp->num_threads && tp->begin == 1) {
-			tp->sig_terminate = 1;
-
-			pthread_mutex_unlock(&tp->lock);
-			pthread_cond_signal(&tp->cond_term);
-			return NULL;
+	assert(self != NULL && self->tp == tp);
+	while (!atomic_load(&tp->sig_terminate)) {
+		for (int round = 0; round < STEAL_ROUNDS; ++round) {
+			t = find_task(self);
+			if (t != NULL) {
+				self->tasks_run++;
+				return t;
+			}
+			if (atomic_load(&tp->sig_terminate))
+				return NULL;
+			sched_yield();
 		}
-		pthread_cond_wait(&tp->cond, &tp->lock);
-		tp->begin = 1;
-		tp->idle_threads--;
+		sleep_until_work(tp);
 	}
+	return NULL;
+}
 
-	if (tp->sig_terminate) {
-		tp->idle_threads++;
-		pthread_mutex_unlock(&tp->lock);
-		return NULL;
+/*
+ * One task fewer left in group. The last one is only counted off under the
+ * lock, so a waiter that sees zero under it knows nobody touches the group
+ * any more.
+ */
+static void tg_task_done(os_task_group_t *tg)
+{
+	long left = atomic_load_explicit(&tg->pending, memory_order_relaxed);
+
+	while (left > 1)
+		if (atomic_compare_exchange_weak_explicit(&tg->pending, &left, left - 1,
+							  memory_order_release,
+							  memory_order_relaxed))
+			return;
+
+	pthread_mutex_lock(&tg->lock);
+	atomic_fetch_sub_explicit(&tg->pending, 1, memory_order_release);
+	pthread_cond_broadcast(&tg->cond);
+	pthread_mutex_unlock(&tg->lock);
+}
+
+static void run_task(os_threadpool_t *tp, os_task_t *t)
+{
+	os_task_group_t *group = t->group;
+
+	t->action(t->argument);
+	destroy_task(t);
+	/* the task enqueued its successors before, so zero means done */
+	if (group != NULL)
+		tg_task_done(group);
+	if (atomic_fetch_sub(&tp->pending, 1) == 1) {
+		pthread_mutex_lock(&tp->term_lock);
+		pthread_cond_broadcast(&tp->cond_term);
+		pthread_mutex_unlock(&tp->term_lock);
 	}
-	os_task_t *popped = list_entry(tp->head.next, os_task_t, list);
+}
 
-#ifdef DEBUG_WORKLOAD
-	addwork(pthread_self());
-#endif
-	list_del(tp->head.next);
-	pthread_mutex_unlock(&tp->lock);
+/*
+ * Sleep on cond while *count is above zero, for HELP_NAP_NS at most: new
+ * tasks do not signal cond, only the last of the ones waited for does.
+ */
+static void nap_while_pending(atomic_long *count, pthread_mutex_t *lock, pthread_cond_t *cond)
+{
+	struct timespec deadline;
 
-	return popped;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += HELP_NAP_NS;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	pthread_mutex_lock(lock);
+	if (atomic_load_explicit(count, memory_order_acquire) > 0)
+		pthread_cond_timedwait(cond, lock, &deadline);
+	pthread_mutex_unlock(lock);
+}
+
+/*
+ * Run queued tasks on the calling worker until *count drops to zero. When
+ * STEAL_ROUNDS rounds find nothing, what is left runs elsewhere: nap on
+ * cond, which is signalled under lock once *count is zero, then look again.
+ */
+static void help_while_pending(os_worker_t *self, atomic_long *count,
+			       pthread_mutex_t *lock, pthread_cond_t *cond)
+{
+	int idle = 0;
+
+	while (atomic_load_explicit(count, memory_order_acquire) > 0) {
+		os_task_t *t = find_task(self);
+
+		if (t != NULL) {
+			idle = 0;
+			self->tasks_run++;
+			run_task(self->tp, t);
+		} else if (++idle < STEAL_ROUNDS) {
+			sched_yield();
+		} else {
+			idle = 0;
+			nap_while_pending(count, lock, cond);
+		}
+	}
 }
 
 /* Loop function for threads */
 static void *thread_loop_function(void *arg)
 {
-	os_threadpool_t *tp = (os_threadpool_t *) arg;
+	os_worker_t *self = (os_worker_t *) arg;
+	os_threadpool_t *tp = self->tp;
 
+	current_worker = self;
 	while (1) {
 		os_task_t *t;
 
@@ -149,32 +409,341 @@ static void *thread_loop_function(void *arg)
 		if (t == NULL)
 			break;
 
-		t->action(t->argument);
-		destroy_task(t);
+		run_task(tp, t);
 	}
 
+	task_cache_flush();
 	return NULL;
 }
 
-/* Wait completion of all threads. This is to be called by the main thread. */
+/*
+ * Data-parallel loops. A range task runs its range grain iterations at a
+ * time; before each chunk, while the range is bigger than a grain and its
+ * worker's deque is close to empty, it splits off the upper half as a new
+ * task for a thief to take (lazy binary splitting). Splits thus only
+ * happen when other workers are likely to be hungry, whatever the grain.
+ */
+#define SPLIT_DEPTH	2
+#define GRAIN_SPLITS	8
+
+typedef struct os_range_job {
+	os_threadpool_t *tp;
+	long grain;
+	os_range_fn_t fn;
+	os_reduce_fn_t reduce;
+	void *ctx;
+	/* one accumulator per worker, slot_size apart, for reduce */
+	char *slots;
+	size_t slot_size;
+	/* iterations not run yet */
+	atomic_long remaining;
+	/* the caller sleeps on these until done is set */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int done;
+} os_range_job_t;
+
+typedef struct os_range {
+	os_range_job_t *job;
+	long begin, end;
+} os_range_t;
+
+static void range_action(void *arg);
+
+static void spawn_range(os_range_job_t *job, long begin, long end)
+{
+	os_range_t *r = malloc(sizeof(*r));
+
+	DIE(r == NULL, "malloc");
+	r->job = job;
+	r->begin = begin;
+	r->end = end;
+	enqueue_task(job->tp, create_task(range_action, r, free));
+}
+
+/*
+ * Account for iterations run; whoever runs the last ones ends the job. The
+ * caller may poll remaining, but only returns once done is set.
+ */
+static void range_done(os_range_job_t *job, long count)
+{
+	if (count == 0 || atomic_fetch_sub(&job->remaining, count) != count)
+		return;
+	pthread_mutex_lock(&job->lock);
+	job->done = 1;
+	pthread_cond_signal(&job->cond);
+	pthread_mutex_unlock(&job->lock);
+}
+
+static void run_range(os_range_job_t *job, long begin, long end)
+{
+	os_worker_t *self = current_worker;
+	long count = 0;
+
+	while (begin < end) {
+		long chunk_end;
+
+		if (end - begin > job->grain && deque_size(&self->deque) < SPLIT_DEPTH) {
+			long mid = begin + (end - begin) / 2;
+
+			spawn_range(job, mid, end);
+			end = mid;
+			continue;
+		}
+		chunk_end = end - begin > job->grain ? begin + job->grain : end;
+		if (job->reduce != NULL)
+			job->reduce(begin, chunk_end, job->slots + self->index * job->slot_size, job->ctx);
+		else
+			job->fn(begin, chunk_end, job->ctx);
+		count += chunk_end - begin;
+		begin = chunk_end;
+	}
+	range_done(job, count);
+}
+
+static void range_action(void *arg)
+{
+	os_range_t *r = arg;
+
+	run_range(r->job, r->begin, r->end);
+}
+
+/*
+ * A worker runs the range itself, then helps with whatever is queued until
+ * the last chunk is done; any other thread queues it and sleeps.
+ */
+static void run_job(os_range_job_t *job, long begin, long end)
+{
+	os_worker_t *self = current_worker;
+
+	atomic_init(&job->remaining, end - begin);
+	job->done = 0;
+	DIE(pthread_mutex_init(&job->lock, NULL) != 0, "mutex_init");
+	DIE(pthread_cond_init(&job->cond, NULL) != 0, "cond_init");
+	if (self != NULL && self->tp == job->tp) {
+		run_range(job, begin, end);
+		help_while_pending(self, &job->remaining, &job->lock, &job->cond);
+	} else {
+		spawn_range(job, begin, end);
+	}
+	pthread_mutex_lock(&job->lock);
+	while (!job->done)
+		pthread_cond_wait(&job->cond, &job->lock);
+	pthread_mutex_unlock(&job->lock);
+	pthread_cond_destroy(&job->cond);
+	pthread_mutex_destroy(&job->lock);
+}
+
+static long pick_grain(os_threadpool_t *tp, long begin, long end, long grain)
+{
+	if (grain > 0)
+		return grain;
+	grain = (end - begin) / (GRAIN_SPLITS * (long)tp->num_threads);
+	return grain > 0 ? grain : 1;
+}
+
+void os_parallel_for(os_threadpool_t *tp, long begin, long end, long grain,
+		     os_range_fn_t fn, void *ctx)
+{
+	os_range_job_t job = {
+		.tp = tp,
+		.grain = pick_grain(tp, begin, end, grain),
+		.fn = fn,
+		.ctx = ctx,
+	};
+
+	if (begin < end)
+		run_job(&job, begin, end);
+}
+
+void os_parallel_reduce(os_threadpool_t *tp, long begin, long end, long grain,
+			os_reduce_fn_t reduce, os_combine_fn_t combine,
+			void *result, size_t size, void *ctx)
+{
+	os_range_job_t job = {
+		.tp = tp,
+		.grain = pick_grain(tp, begin, end, grain),
+		.reduce = reduce,
+		.ctx = ctx,
+		/* accumulators on lines of their own */
+		.slot_size = (size + 63) & ~(size_t)63,
+	};
+
+	if (begin >= end)
+		return;
+	job.slots = aligned_alloc(64, tp->num_threads * job.slot_size);
+	DIE(job.slots == NULL, "aligned_alloc");
+	for (unsigned int i = 0; i < tp->num_threads; ++i)
+		memcpy(job.slots + i * job.slot_size, result, size);
+
+	run_job(&job, begin, end);
+
+	for (unsigned int i = 0; i < tp->num_threads; ++i)
+		combine(result, job.slots + i * job.slot_size, ctx);
+	free(job.slots);
+}
+
+void tg_init(os_task_group_t *tg, os_threadpool_t *tp)
+{
+	tg->tp = tp;
+	atomic_init(&tg->pending, 0);
+	DIE(pthread_mutex_init(&tg->lock, NULL) != 0, "mutex_init");
+	DIE(pthread_cond_init(&tg->cond, NULL) != 0, "cond_init");
+}
+
+void tg_destroy(os_task_group_t *tg)
+{
+	tg_wait(tg);
+	pthread_cond_destroy(&tg->cond);
+	pthread_mutex_destroy(&tg->lock);
+}
+
+void tg_enqueue(os_task_group_t *tg, os_task_t *t)
+{
+	tg_expect(tg);
+	t->group = tg;
+	enqueue_task(tg->tp, t);
+}
+
+void tg_expect(os_task_group_t *tg)
+{
+	atomic_fetch_add_explicit(&tg->pending, 1, memory_order_relaxed);
+}
+
+/*
+ * A worker runs other tasks while the group has some left, and naps
+ * whenever there are none to run; any other thread sleeps. Either way the
+ * lock is taken last, to be sure the last task has let go of the group.
+ */
+void tg_wait(os_task_group_t *tg)
+{
+	os_worker_t *self = current_worker;
+
+	if (self != NULL && self->tp == tg->tp)
+		help_while_pending(self, &tg->pending, &tg->lock, &tg->cond);
+
+	pthread_mutex_lock(&tg->lock);
+	while (atomic_load_explicit(&tg->pending, memory_order_acquire) > 0)
+		pthread_cond_wait(&tg->cond, &tg->lock);
+	pthread_mutex_unlock(&tg->lock);
+}
+
+static void future_action(void *arg)
+{
+	os_future_t *f = arg;
+
+	f->value = f->fn(f->argument);
+}
+
+os_future_t *future_async(os_threadpool_t *tp, void *(*fn)(void *), void *arg)
+{
+	os_future_t *f = malloc(sizeof(*f));
+
+	DIE(f == NULL, "malloc");
+	f->fn = fn;
+	f->argument = arg;
+	f->value = NULL;
+	tg_init(&f->group, tp);
+	tg_enqueue(&f->group, create_task(future_action, f, NULL));
+	return f;
+}
+
+int future_ready(os_future_t *f)
+{
+	return atomic_load_explicit(&f->group.pending, memory_order_acquire) == 0;
+}
+
+void *future_get(os_future_t *f)
+{
+	tg_wait(&f->group);
+	return f->value;
+}
+
+void future_destroy(os_future_t *f)
+{
+	tg_destroy(&f->group);
+	free(f);
+}
+
+/*
+ * Wait for every task enqueued so far, and those they enqueue, to finish,
+ * then stop the workers. This is to be called by the main thread.
+ */
 void wait_for_completion(os_threadpool_t *tp)
 {
-	pthread_cond_wait(&tp->cond_term, &tp->term_lock);
+	pthread_mutex_lock(&tp->term_lock);
+	while (atomic_load(&tp->pending) > 0)
+		pthread_cond_wait(&tp->cond_term, &tp->term_lock);
+	pthread_mutex_unlock(&tp->term_lock);
+
+	pthread_mutex_lock(&tp->lock);
+	atomic_store(&tp->sig_terminate, 1);
 	pthread_cond_broadcast(&tp->cond);
+	pthread_mutex_unlock(&tp->lock);
 
 	for (unsigned int i = 0; i < tp->num_threads; i++)
 		pthread_join(tp->threads[i], NULL);
 #ifdef DEBUG_WORKLOAD
-	printwork();
+	printwork(tp);
 #endif
 }
 
+int threadpool_worker_id(os_threadpool_t *tp)
+{
+	os_worker_t *self = current_worker;
+
+	return self != NULL && self->tp == tp ? (int)self->index : -1;
+}
+
+static os_topo_distance_t victim_distance(os_worker_t *w, unsigned int victim,
+					  os_cpu_t *cpus, int near)
+{
+	return near ? topology_distance(&cpus[w->index], &cpus[victim]) : TOPO_REMOTE;
+}
+
+/*
+ * List the other workers for w to steal from, by distance when the
+ * workers sit on known CPUs, all in the farthest tier otherwise.
+ */
+static void order_victims(os_threadpool_t *tp, os_worker_t *w, os_cpu_t *cpus, int near)
+{
+	unsigned int next[TOPO_DISTANCES] = { 0 };
+
+	w->victims = malloc(tp->num_threads * sizeof(*w->victims));
+	DIE(w->victims == NULL, "malloc");
+
+	for (unsigned int i = 0; i < tp->num_threads; ++i)
+		if (i != w->index)
+			next[victim_distance(w, i, cpus, near)]++;
+	for (unsigned int d = 0, start = 0; d < TOPO_DISTANCES; ++d) {
+		w->tier_end[d] = start + next[d];
+		next[d] = start;
+		start = w->tier_end[d];
+	}
+	for (unsigned int i = 0; i < tp->num_threads; ++i)
+		if (i != w->index)
+			w->victims[next[victim_distance(w, i, cpus, near)]++] = i;
+}
+
 /* Create a new threadpool. */
 os_threadpool_t *create_threadpool(unsigned int num_threads)
+{
+	return create_threadpool_flags(num_threads, POOL_DEFAULT);
+}
+
+os_threadpool_t *create_threadpool_flags(unsigned int num_threads, unsigned int flags)
 {
 	os_threadpool_t *tp = NULL;
+	os_cpu_t *cpus;
+	unsigned int num_cpus;
+	int pinned;
 	int rc;
 
+	num_cpus = topology_cpus(&cpus);
+	if (num_threads == 0)
+		num_threads = num_cpus;
+	pinned = (flags & POOL_PIN) && num_threads <= num_cpus;
+
 	tp = malloc(sizeof(*tp));
 	DIE(tp == NULL, "malloc");
 
@@ -189,16 +758,38 @@ os_threadpool_t *create_threadpool(unsigned int num_threads)
 	if (pthread_cond_init(&(tp->cond_term), NULL) != 0)
 		DIE(1, "condt_init");
 
-	tp->sig_terminate = 0;
-	tp->idle_threads = 0;
-	tp->begin = 0;
+	atomic_init(&tp->pending, 0);
+	atomic_init(&tp->sleepers, 0);
+	atomic_init(&tp->sig_terminate, 0);
 	tp->num_threads = num_threads;
 	tp->threads = malloc(num_threads * sizeof(*tp->threads));
 	DIE(tp->threads == NULL, "malloc");
+	tp->workers = calloc(num_threads, sizeof(*tp->workers));
+	DIE(tp->workers == NULL, "calloc");
 	for (unsigned int i = 0; i < num_threads; ++i) {
-		rc = pthread_create(&tp->threads[i], NULL, &thread_loop_function, (void *) tp);
-		DIE(rc < 0, "pthread_create");
+		deque_init(&tp->workers[i].deque);
+		tp->workers[i].tp = tp;
+		tp->workers[i].index = i;
+		tp->workers[i].seed = 2654435761u * (i + 1);
+		tp->workers[i].cpu = pinned ? cpus[i].cpu : -1;
+		order_victims(tp, &tp->workers[i], cpus, pinned && (flags & POOL_STEAL_NEAR));
 	}
+	for (unsigned int i = 0; i < num_threads; ++i) {
+		pthread_attr_t attr;
+
+		pthread_attr_init(&attr);
+		if (pinned) {
+			cpu_set_t cpu;
+
+			CPU_ZERO(&cpu);
+			CPU_SET(tp->workers[i].cpu, &cpu);
+			pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu);
+		}
+		rc = pthread_create(&tp->threads[i], &attr, &thread_loop_function, &tp->workers[i]);
+		DIE(rc != 0, "pthread_create");
+		pthread_attr_destroy(&attr);
+	}
+	free(cpus);
 	return tp;
 }
 
@@ -206,15 +797,25 @@ os_threadpool_t *create_threadpool(unsigned int num_threads)
 void destroy_threadpool(os_threadpool_t *tp)
 {
 	os_list_node_t *n, *p;
+	os_task_t *t;
 
 	pthread_mutex_destroy(&tp->lock);
 	pthread_cond_destroy(&tp->cond);
+	pthread_mutex_destroy(&tp->term_lock);
+	pthread_cond_destroy(&tp->cond_term);
 
 	list_for_each_safe(n, p, &tp->head) {
 		list_del(n);
 		destroy_task(list_entry(n, os_task_t, list));
 	}
+	for (unsigned int i = 0; i < tp->num_threads; ++i) {
+		while ((t = deque_steal(&tp->workers[i].deque)) != NULL)
+			destroy_task(t);
+		deque_destroy(&tp->workers[i].deque);
+		free(tp->workers[i].victims);
+	}
 
+	free(tp->workers);
 	free(tp->threads);
 	free(tp);
 }
@@ -4,7 +4,7 @@
 #define __OS_THREADPOOL_H__	1
 
 // #define DEBUG 1
-#define DEBUG_WORKLOAD 1
+// #define DEBUG_WORKLOAD 1
 #ifdef DEBUG
 #define DEBUG_PRINT(fmt, args...)    fprintf(stderr , fmt, ## args)
 #else
@@ -20,19 +20,50 @@
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdatomic.h>
 
 #include "os_list.h"
+#include "os_deque.h"
+#include "os_topology.h"
+
+struct os_threadpool;
+struct os_task_group;
 
 typedef struct {
 	void *argument;
 	void (*action)(void *arg);
 	void (*destroy_arg)(void *arg);
+	/* counted off once the task has run, if it was given to a group */
+	struct os_task_group *group;
 	os_list_node_t list;
 } os_task_t;
 
+/*
+ * Every worker owns a work-stealing deque. A task enqueued from inside a
+ * task goes to the bottom of the running worker's deque, which it pops
+ * LIFO; a worker that runs dry steals FIFO from the top of the others,
+ * nearest first: victims lists them by topology distance, tier_end[d]
+ * being where those farther than d start, and each tier is tried from a
+ * random one on. Tasks enqueued from any other thread go to the shared
+ * queue under tp->lock.
+ */
+typedef struct os_worker {
+	os_deque_t deque;
+	struct os_threadpool *tp;
+	unsigned int index;
+	unsigned int seed;
+	/* the CPU it is pinned to, -1 if it is not */
+	int cpu;
+	unsigned int *victims;
+	unsigned int tier_end[TOPO_DISTANCES];
+	unsigned long long tasks_run;
+	unsigned long long tasks_stolen;
+} os_worker_t;
+
 typedef struct os_threadpool {
 	unsigned int num_threads;
 	pthread_t *threads;
+	os_worker_t *workers;
 
 	/*
 	 * Head of queue used to store tasks.
@@ -43,25 +74,111 @@ typedef struct os_threadpool {
 	 */
 	os_list_node_t head;
 
-	/* TODO: Define threapool / queue synchronization data. */
+	/* Guards the shared queue; idle workers sleep on cond under it. */
 	pthread_mutex_t lock;
 	pthread_cond_t cond;
 	pthread_cond_t cond_term;
 	pthread_mutex_t term_lock;
 
-	int idle_threads;
-	int begin;
-	int sig_terminate;
+	/* Tasks enqueued and not yet finished. */
+	atomic_long pending;
+	atomic_int sleepers;
+	atomic_int sig_terminate;
 } os_threadpool_t;
 
 os_task_t *create_task(void (*f)(void *), void *arg, void (*destroy_arg)(void *));
 void destroy_task(os_task_t *t);
 
+/* Pin every worker to a CPU of its own, if there are as many CPUs. */
+#define POOL_PIN		1
+/* Steal from the workers on the same core first, then the same package. */
+#define POOL_STEAL_NEAR		2
+#define POOL_DEFAULT		(POOL_PIN | POOL_STEAL_NEAR)
+
+/*
+ * A pool of num_threads workers, or of one per CPU in the calling thread's
+ * affinity mask for 0, set up as POOL_DEFAULT says. Workers take the CPUs
+ * in the order topology_cpus() gives them. Stealing by distance needs the
+ * workers pinned; otherwise they steal from anyone.
+ */
 os_threadpool_t *create_threadpool(unsigned int num_threads);
+os_threadpool_t *create_threadpool_flags(unsigned int num_threads, unsigned int flags);
 void destroy_threadpool(os_threadpool_t *tp);
 
 void enqueue_task(os_threadpool_t *q, os_task_t *t);
+void enqueue_tasks(os_threadpool_t *tp, os_task_t **tasks, unsigned int n);
 os_task_t *dequeue_task(os_threadpool_t *tp);
 void wait_for_completion(os_threadpool_t *tp);
 
+/*
+ * A set of tasks that can be waited for together, so that one long-lived
+ * pool serves any number of jobs, one after the other or side by side.
+ * Tasks given to a group may add more tasks to it; tg_wait() returns once
+ * all of them have finished, after which the group can be used again.
+ * A worker waiting for a group runs queued tasks in the meantime.
+ */
+typedef struct os_task_group {
+	os_threadpool_t *tp;
+	atomic_long pending;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} os_task_group_t;
+
+void tg_init(os_task_group_t *tg, os_threadpool_t *tp);
+/* Waits for the group first. */
+void tg_destroy(os_task_group_t *tg);
+void tg_enqueue(os_task_group_t *tg, os_task_t *t);
+/*
+ * Count a task in tg ahead of its os_task_t, for tasks that only become
+ * ready later, such as those of a task graph; that os_task_t then goes to
+ * enqueue_task() with its group set to tg.
+ */
+void tg_expect(os_task_group_t *tg);
+void tg_wait(os_task_group_t *tg);
+
+/* The value fn(arg) returns on the pool, when it is ready. */
+typedef struct os_future {
+	os_task_group_t group;
+	void *(*fn)(void *arg);
+	void *argument;
+	void *value;
+} os_future_t;
+
+os_future_t *future_async(os_threadpool_t *tp, void *(*fn)(void *), void *arg);
+int future_ready(os_future_t *f);
+/* Waits for fn to return, the way tg_wait() does. */
+void *future_get(os_future_t *f);
+/* Waits for fn to return as well. */
+void future_destroy(os_future_t *f);
+
+/* Index of the calling thread among tp's workers, -1 if it is not one. */
+int threadpool_worker_id(os_threadpool_t *tp);
+
+typedef void (*os_range_fn_t)(long begin, long end, void *ctx);
+typedef void (*os_reduce_fn_t)(long begin, long end, void *acc, void *ctx);
+typedef void (*os_combine_fn_t)(void *acc, const void *other, void *ctx);
+
+/*
+ * Run fn over [begin, end) in chunks of up to grain iterations, on tp's
+ * workers, and return once every chunk is done. Chunks are split off only
+ * while other workers are likely to be idle, so grain is the smallest
+ * chunk rather than the size of every one; 0 picks one from the range and
+ * the pool size. Called from a task, the calling worker takes part in the
+ * loop and runs other queued tasks while it waits. Called from outside the
+ * pool, the caller sleeps until the loop is done.
+ */
+void os_parallel_for(os_threadpool_t *tp, long begin, long end, long grain,
+		     os_range_fn_t fn, void *ctx);
+
+/*
+ * As os_parallel_for(), with an accumulator of size bytes per worker. Each
+ * starts as a copy of *result, which must hold the identity, and reduce
+ * folds chunks into the running worker's. They are combined into *result
+ * at the end, in no particular order, so combine has to be associative
+ * and commutative.
+ */
+void os_parallel_reduce(os_threadpool_t *tp, long begin, long end, long grain,
+			os_reduce_fn_t reduce, os_combine_fn_t combine,
+			void *result, size_t size, void *ctx);
+
 #endif
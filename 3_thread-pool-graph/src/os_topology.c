@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "os_threadpool.h"
+#include "os_topology.h"
+#include "log/log.h"
+#include "utils.h"
+
+static int read_sysfs_int(int cpu, const char *name, int fallback)
+{
+	char path[128];
+	FILE *file;
+	int value;
+
+	snprintf(path, sizeof(path), SYSFS_CPU_PATH "/cpu%d/%s", cpu, name);
+	file = fopen(path, "r");
+	if (file == NULL)
+		return fallback;
+	if (fscanf(file, "%d", &value) != 1)
+		value = fallback;
+	fclose(file);
+	return value;
+}
+
+/* The node a CPU is on shows up as a nodeN link in its directory. */
+static int read_node(int cpu)
+{
+	char path[128];
+	struct dirent *entry;
+	DIR *dir;
+	int node = 0;
+
+	snprintf(path, sizeof(path), SYSFS_CPU_PATH "/cpu%d", cpu);
+	dir = opendir(path);
+	if (dir == NULL)
+		return 0;
+	while ((entry = readdir(dir)) != NULL)
+		if (sscanf(entry->d_name, "node%d", &node) == 1)
+			break;
+	closedir(dir);
+	return node;
+}
+
+static int compare_placement(const void *a, const void *b)
+{
+	const os_cpu_t *x = a, *y = b;
+
+	if (x->smt != y->smt)
+		return x->smt - y->smt;
+	if (x->package != y->package)
+		return x->package - y->package;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+unsigned int topology_cpus(os_cpu_t **cpus)
+{
+	cpu_set_t mask;
+	unsigned int n = 0;
+
+	DIE(sched_getaffinity(0, sizeof(mask), &mask) != 0, "sched_getaffinity");
+	*cpus = malloc(CPU_COUNT(&mask) * sizeof(**cpus));
+	DIE(*cpus == NULL, "malloc");
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		os_cpu_t *c = &(*cpus)[n];
+
+		if (!CPU_ISSET(cpu, &mask))
+			continue;
+		c->cpu = cpu;
+		c->package = read_sysfs_int(cpu, "topology/physical_package_id", 0);
+		c->core = read_sysfs_int(cpu, "topology/core_id", cpu);
+		c->node = read_node(cpu);
+		c->smt = 0;
+		for (unsigned int i = 0; i < n; ++i)
+			c->smt += (*cpus)[i].package == c->package && (*cpus)[i].core == c->core;
+		n++;
+	}
+	qsort(*cpus, n, sizeof(**cpus), compare_placement);
+	return n;
+}
+
+os_topo_distance_t topology_distance(const os_cpu_t *a, const os_cpu_t *b)
+{
+	if (a->package == b->package && a->core == b->core)
+		return TOPO_SAME_CORE;
+	if (a->package == b->package && a->node == b->node)
+		return TOPO_SAME_PACKAGE;
+	return TOPO_REMOTE;
+}
+
+unsigned int topology_num_nodes(const os_cpu_t *cpus, unsigned int n)
+{
+	unsigned int count = 0;
+
+	for (unsigned int i = 0; i < n; ++i) {
+		unsigned int j = 0;
+
+		while (j < i && cpus[j].node != cpus[i].node)
+			j++;
+		count += j == i;
+	}
+	return count;
+}
+
+typedef struct placement {
+	os_graph_t *from, *to;
+} placement_t;
+
+static void place_range(long begin, long end, void *ctx)
+{
+	placement_t *p = ctx;
+	unsigned int first = p->from->offsets[begin], last = p->from->offsets[end];
+
+	memcpy(p->to->offsets + begin, p->from->offsets + begin,
+	       (end - begin) * sizeof(*p->to->offsets));
+	if ((unsigned long)end == p->from->num_nodes)
+		p->to->offsets[end] = last;
+	memcpy(p->to->targets + first, p->from->targets + first,
+	       (last - first) * sizeof(*p->to->targets));
+	memcpy(p->to->info + begin, p->from->info + begin,
+	       (end - begin) * sizeof(*p->to->info));
+	for (long i = begin; i < end; ++i)
+		atomic_init(&p->to->visited[i],
+			    atomic_load_explicit(&p->from->visited[i], memory_order_relaxed));
+}
+
+/* Fresh anonymous pages, so that the first write decides where they go. */
+static void *untouched(size_t size)
+{
+	void *p = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	DIE(p == MAP_FAILED, "mmap");
+	return p;
+}
+
+void topology_place_graph(struct os_threadpool *tp, os_graph_t *graph)
+{
+	size_t offsets_size = (graph->num_nodes + 1) * sizeof(*graph->offsets);
+	size_t targets_size = 2 * (size_t)graph->num_edges * sizeof(*graph->targets);
+	size_t info_size = graph->num_nodes * sizeof(*graph->info);
+	size_t visited_size = graph->num_nodes * sizeof(*graph->visited);
+	os_graph_t placed = *graph;
+	placement_t p = { graph, &placed };
+	char *block;
+
+	if (graph->num_nodes == 0)
+		return;
+
+	/*
+	 * One mapping in the layout of a graph file, so that destroy_graph()
+	 * unmaps it the way it does a loaded one. visited is malloc()ed on
+	 * its own, as for any graph; at this size that is fresh pages too.
+	 */
+	placed.mapping_size = sizeof(os_graph_header_t) + info_size + offsets_size + targets_size;
+	block = untouched(placed.mapping_size);
+	placed.mapping = block;
+	placed.info = (int *)(block + sizeof(os_graph_header_t));
+	placed.offsets = (unsigned int *)(placed.info + graph->num_nodes);
+	placed.targets = placed.offsets + graph->num_nodes + 1;
+	placed.visited = malloc(visited_size);
+	DIE(placed.visited == NULL, "malloc");
+
+	os_parallel_for(tp, 0, graph->num_nodes,
+			(graph->num_nodes + tp->num_threads - 1) / tp->num_threads,
+			place_range, &p);
+
+	if (graph->mapping != NULL) {
+		munmap(graph->mapping, graph->mapping_size);
+	} else {
+		free(graph->offsets);
+		free(graph->targets);
+		free(graph->info);
+	}
+	free(graph->visited);
+	*graph = placed;
+}
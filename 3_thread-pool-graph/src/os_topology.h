@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * CPU topology of the calling thread's affinity mask, as the kernel shows
+ * it under /sys/devices/system/cpu: the core, package and NUMA node of
+ * every CPU it may run on. A CPU whose files are missing is taken as a
+ * core of its own on package and node 0.
+ */
+
+#ifndef __OS_TOPOLOGY_H__
+#define __OS_TOPOLOGY_H__	1
+
+#include "os_graph.h"
+
+struct os_threadpool;
+
+#define SYSFS_CPU_PATH	"/sys/devices/system/cpu"
+
+/* How far apart two CPUs are, for the order workers steal in. */
+typedef enum {
+	TOPO_SAME_CORE = 0,
+	TOPO_SAME_PACKAGE = 1,
+	TOPO_REMOTE = 2,
+	TOPO_DISTANCES
+} os_topo_distance_t;
+
+typedef struct os_cpu {
+	int cpu;
+	/* core_id, unique within a package only */
+	int core;
+	int package;
+	int node;
+	/* index among the hardware threads of its core */
+	int smt;
+} os_cpu_t;
+
+/*
+ * The CPUs in the affinity mask, in the order workers are placed on them:
+ * one hardware thread of every core first, package by package, then the
+ * second thread of every core, and so on. Returns how many, with the
+ * array to free in *cpus.
+ */
+unsigned int topology_cpus(os_cpu_t **cpus);
+os_topo_distance_t topology_distance(const os_cpu_t *a, const os_cpu_t *b);
+/* NUMA nodes the given CPUs span. */
+unsigned int topology_num_nodes(const os_cpu_t *cpus, unsigned int n);
+
+/*
+ * Move graph's arrays to memory first touched by tp's workers, each
+ * writing the nodes of the chunk of an os_parallel_for() it runs, so that
+ * on a NUMA machine a node's offsets, neighbours and info end up close to
+ * the worker likely to walk it. Later loops have to split the nodes the
+ * same way for it to pay off. A mapped graph file is copied and unmapped.
+ */
+void topology_place_graph(struct os_threadpool *tp, os_graph_t *graph);
+
+#endif
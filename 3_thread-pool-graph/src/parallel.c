@@ -7,66 +7,64 @@
 #include <time.h>
 #include <stdatomic.h>
 
+#include "os_bfs.h"
+#include "os_cc.h"
 #include "os_graph.h"
 #include "os_threadpool.h"
+#include "os_topology.h"
 #include "log/log.h"
 #include "utils.h"
 
-#define NUM_THREADS		4
-static atomic_int sum;
 static os_graph_t *graph;
 static os_threadpool_t *tp;
+static _Atomic unsigned int *levels;
 
-// #define SLEEP_CHECK
-
-static void graph_destroy_arg(void *arg)
+static void sum_reached(long begin, long end, void *acc, void *ctx)
 {
-	(void)arg;
+	long long *sum = acc;
+
+	(void)ctx;
+	for (long i = begin; i < end; ++i)
+		if (atomic_load_explicit(&levels[i], memory_order_relaxed) != BFS_UNREACHED)
+			*sum += graph->info[i];
 }
 
-static void graph_action(void *arg)
+static void add_sums(void *acc, const void *other, void *ctx)
 {
-	pthread_mutex_lock(&tp->lock);
-	long long idx = (long long)arg;
-
-	graph->visited[idx] = DONE;
-	pthread_mutex_unlock(&tp->lock);
-
-#ifdef SLEEP_CHECK
-	sleep(5);
-	printf("Thread %d ][ Node #%d\n", gettid(), idx);
-#endif
-
-	for (int i = 0; i < graph->nodes[idx]->num_neighbours; ++i) {
-		int node_id = graph->nodes[idx]->neighbours[i];
-
-		pthread_mutex_lock(&tp->lock);
-		if (graph->visited[node_id] == NOT_VISITED) {
-			graph->visited[node_id] = PROCESSING;
-			os_task_t *task = create_task(graph_action, (void *)node_id, graph_destroy_arg);
-
-			pthread_mutex_unlock(&tp->lock);
-			enqueue_task(tp, task);
-		} else {
-			pthread_mutex_unlock(&tp->lock);
-		}
-	}
-	atomic_fetch_add(&sum, graph->nodes[idx]->info);
-	DEBUG_PRINT("%d : adding : %d => %d\n", gettid(), graph->nodes[idx]->info, sum);
+	(void)ctx;
+	*(long long *)acc += *(const long long *)other;
 }
 
-static void process_node(unsigned int idx)
+/* Sum the info of the nodes reachable from idx, found a BFS level at a time. */
+static long long process_node(unsigned int idx)
 {
-	os_node_t *node;
+	long long sum = 0;
 
-	node = graph->nodes[idx];
-	graph->visited[idx] = PROCESSING;
-	DEBUG_PRINT("\n\n> Creating task...\n");
+	levels = malloc(graph->num_nodes * sizeof(*levels));
+	DIE(graph->num_nodes && levels == NULL, "malloc");
 
-	os_task_t *task = create_task(&graph_action, (void *)idx, &graph_destroy_arg);
+	bfs_levels(tp, graph, idx, levels, BFS_ADAPTIVE, NULL);
+	os_parallel_reduce(tp, 0, graph->num_nodes, 0, sum_reached, add_sums,
+			   &sum, sizeof(sum), NULL);
+	free(levels);
+	return sum;
+}
 
-	DEBUG_PRINT("> Created task, enqueueing.... %p\n", task->action);
-	enqueue_task(tp, task);
+/* One line per component: its smallest node and the sum of its info. */
+static void process_components(void)
+{
+	_Atomic unsigned int *comp = malloc(graph->num_nodes * sizeof(*comp));
+	_Atomic long long *sums = malloc(graph->num_nodes * sizeof(*sums));
+
+	DIE(graph->num_nodes && (comp == NULL || sums == NULL), "malloc");
+
+	cc_labels(tp, graph, comp);
+	cc_sums(tp, graph, comp, sums);
+	for (unsigned int i = 0; i < graph->num_nodes; ++i)
+		if (atomic_load_explicit(&comp[i], memory_order_relaxed) == i)
+			printf("%u %lld\n", i, atomic_load_explicit(&sums[i], memory_order_relaxed));
+	free(sums);
+	free(comp);
 }
 
 int abs(int x)
@@ -79,28 +77,49 @@ int abs(int x)
 int main(int argc, char *argv[])
 {
 	FILE *input_file;
-
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s input_file\n", argv[0]);
+	long long sum = 0;
+	unsigned int threads = 0;
+	int components = 0, numa_local = 0, opt;
+
+	while ((opt = getopt(argc, argv, "cnt:")) != -1) {
+		if (opt == 'c')
+			components = 1;
+		else if (opt == 'n')
+			numa_local = 1;
+		else if (opt == 't')
+			threads = atoi(optarg);
+		else
+			break;
+	}
+	if (opt != -1 || optind != argc - 1) {
+		fprintf(stderr, "Usage: %s [-c] [-n] [-t threads] input_file\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
-	input_file = fopen(argv[1], "r");
+	input_file = fopen(argv[optind], "r");
 	DIE(input_file == NULL, "fopen");
 
 	graph = create_graph_from_file(input_file);
+	DIE(graph == NULL, "create_graph_from_file");
 
 #ifdef TIME_IT
 	clock_t begin = clock();
 #endif
 
-	tp = create_threadpool(NUM_THREADS);
-	process_node(0);
+	/* by default one worker per CPU we may run on, each pinned to its own */
+	tp = create_threadpool(threads);
+	if (numa_local)
+		topology_place_graph(tp, graph);
+	if (components)
+		process_components();
+	else
+		sum = process_node(0);
 	wait_for_completion(tp);
 	destroy_threadpool(tp);
 	fflush(stdout);
 
-	printf("%d", (int)sum);
+	if (!components)
+		printf("%d", (int)sum);
 #ifdef TIME_IT
 	clock_t end = clock();
 	double time_spent = (double)(end - begin) / CLOCKS_PER_SEC;
@@ -2,44 +2,80 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "os_graph.h"
 #include "log/log.h"
 #include "utils.h"
 
-static int sum;
+static long long sum;
 static os_graph_t *graph;
+static unsigned int *stack;
 
+/* Depth-first, with an explicit stack: the recursion outgrew the thread's. */
 static void process_node(unsigned int idx)
 {
-	os_node_t *node;
+	unsigned int top = 0;
 
-	node = graph->nodes[idx];
-	sum += node->info;
 	graph->visited[idx] = DONE;
+	stack[top++] = idx;
+	while (top > 0) {
+		unsigned int node = stack[--top];
+		unsigned int *neighbours = graph_neighbours(graph, node);
 
-	for (unsigned int i = 0; i < node->num_neighbours; i++)
-		if (graph->visited[node->neighbours[i]] == NOT_VISITED)
-			process_node(node->neighbours[i]);
+		sum += graph->info[node];
+		for (unsigned int i = 0; i < graph_degree(graph, node); i++) {
+			if (graph->visited[neighbours[i]] == NOT_VISITED) {
+				graph->visited[neighbours[i]] = DONE;
+				stack[top++] = neighbours[i];
+			}
+		}
+	}
+}
+
+/* One line per component: its smallest node and the sum of its info. */
+static void process_components(void)
+{
+	for (unsigned int i = 0; i < graph->num_nodes; i++) {
+		if (graph->visited[i] != NOT_VISITED)
+			continue;
+		sum = 0;
+		process_node(i);
+		printf("%u %lld\n", i, sum);
+	}
 }
 
 int main(int argc, char *argv[])
 {
 	FILE *input_file;
+	int components = 0, opt;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s input_file\n", argv[0]);
+	while ((opt = getopt(argc, argv, "c")) != -1) {
+		if (opt != 'c')
+			break;
+		components = 1;
+	}
+	if (opt != -1 || optind != argc - 1) {
+		fprintf(stderr, "Usage: %s [-c] input_file\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
-	input_file = fopen(argv[1], "r");
+	input_file = fopen(argv[optind], "r");
 	DIE(input_file == NULL, "fopen");
 
 	graph = create_graph_from_file(input_file);
+	DIE(graph == NULL, "create_graph_from_file");
 
-	process_node(0);
+	stack = malloc(graph->num_nodes * sizeof(*stack));
+	DIE(graph->num_nodes && stack == NULL, "malloc");
 
-	printf("%d", sum);
+	if (components) {
+		process_components();
+	} else {
+		process_node(0);
+		printf("%d", (int)sum);
+	}
+	free(stack);
 
 	return 0;
 }
@@ -5,10 +5,12 @@ Checker for the "Parallel Graph" assignment.
 
 It walks through the input test files in in/ and compares the serial case
 to the parallel case. It adds points and gives out the final result.
+The extra cases that follow are not graded.
 """
 
 import os
 import subprocess
+import tempfile
 
 TOTAL = 0.0
 
@@ -33,6 +35,46 @@ def check(testname):
     return True
 
 
+def output(*args):
+    """Run an executable from `src` and return its standard output."""
+    res = subprocess.run([os.path.join(src, args[0])] + list(args[1:]),
+                         stdout=subprocess.PIPE, check=False)
+    return res.stdout.decode().strip("\n")
+
+
+def check_binary(testname):
+    """Check a test file converted to the binary graph format.
+
+    Both executables must give the same result as on the text file.
+    """
+    expected = output("serial", testname)
+    with tempfile.TemporaryDirectory() as tmp:
+        binary = os.path.join(tmp, "graph.bin")
+        if subprocess.run([os.path.join(src, "graph_convert"), testname, binary],
+                          check=False).returncode != 0:
+            return False
+        if output("serial", binary) != expected:
+            return False
+        for _ in range(0, 10):
+            if output("parallel", binary) != expected:
+                return False
+
+    return True
+
+
+def check_components(testname):
+    """Check the connected components (`-c`) of a test file.
+
+    The parallel executable must give the same result as the serial one.
+    """
+    expected = output("serial", "-c", testname)
+    for _ in range(0, 10):
+        if output("parallel", "-c", testname) != expected:
+            return False
+
+    return True
+
+
 lst = os.listdir("in")
 lst.sort(key=lambda s: (len(s), s))
 for filename in lst:
@@ -45,3 +87,11 @@ for filename in lst:
 
 TOTAL = int(TOTAL)
 print("\nTotal:" + 61 * " " + f" {TOTAL}/100")
+
+print()
+for filename in lst:
+    f = os.path.join("in", filename)
+    result = "passed" if check_binary(f) else "failed"
+    print((filename + " (binary)").ljust(33) + 23 * "." + f" {result}")
+    result = "passed" if check_components(f) else "failed"
+    print((filename + " (components)").ljust(33) + 23 * "." + f" {result}")